@@ -1,7 +1,9 @@
 // Include Standardheader, steht bei jedem C/C++-Programm am Anfang
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
+#include <algorithm>
 
 // Include GLEW, GLEW ist ein notwendiges bel. Der Hintergrund ist, dass OpenGL von Microsoft
 // zwar untersttzt wird, aber nur in einer Uralt-Version. Deshalb beinhaltet die Header-Datei,
@@ -38,8 +40,57 @@ using namespace glm;
 
 #include "objloader.hpp"
 
+#include "mesh.hpp"
+
 #include "texture.hpp"
 
+// Zaehlt alle OpenGL-Objekte (Buffer, Texturen, ...) und meldet im Debug-Build Objekte,
+// die in jedem Bild neu angelegt werden
+#include "resources.hpp"
+
+// Uniform-Variablen ueber Handles statt ueber ihren Namen setzen
+#include "uniforms.hpp"
+
+// Uniform-Bloecke PerFrame (P, V, Licht) und PerObject (M, MVP) fuer alle Shader
+#include "uniformbuffers.hpp"
+
+// Viele gleiche Objekte (Wuerfel, Kugeln) mit einem einzigen Aufruf zeichnen
+#include "instancing.hpp"
+
+// Szenengraph : Knoten mit Translation, Rotation und Skalierung relativ zum Elternknoten
+#include "scenegraph.hpp"
+
+// Matrixprodukte mit SSE/AVX, Ergebnis bitgleich zu glm
+#include "transformbatch.hpp"
+
+// Objekte ausserhalb des Sichtbereichs (Frustum) gar nicht erst zeichnen
+#include "culling.hpp"
+
+// Hierarchie von Quadern (BVH) fuer Culling und Picking mit der Maus
+#include "bvh.hpp"
+
+// Programm, Vertexarray und Textur nur binden, wenn sie nicht schon gebunden sind
+#include "glstate.hpp"
+
+// Draw-Aufrufe sammeln und nach Zustand sortiert ausfuehren
+#include "renderqueue.hpp"
+
+// Modelle und Texturen im Hintergrund laden, hochgeladen wird pro Bild nur ein wenig
+#include "assets.hpp"
+
+// Ringpuffer fuer Daten, die jedes Bild neu geschrieben werden (Uniform-Bloecke, Instanzen)
+#include "streambuffer.hpp"
+
+// BMP -> DDS (BC1/BC3) offline, Aufruf: CGTutorial --compress bild.bmp bild.dds [bc1|bc3]
+#include "blockcompression.hpp"
+
+// Pruefungen der Lader und der Mathematik ohne Fenster, Aufruf: CGTutorial --selftest
+#include "selftest.hpp"
+
+// Statische Meshes liegen gemeinsam in grossen Puffern, alle Meshes eines Puffers werden mit
+// einem einzigen glMultiDrawElementsIndirect gezeichnet
+#include "meshpool.hpp"
+
 
 // Callback-Mechanismen gibt es in unterschiedlicher Form in allen mglichen Programmiersprachen,
 // sehr hufig in interaktiven graphischen Anwendungen. In der Programmiersprache C werden dazu 
@@ -71,7 +122,7 @@ float z3 = 0.0f;
 // Generell berlassen wir der GLFW-Bibliothek die Behandlung der Input-Ereignisse (Mouse moved,
 // button click, Key pressed, etc.).
 // Durch die bergabe dieser Funktion knnen wir Keyboard-Events 
-// abfangen. Mouse-Events z. B. erhalten wir nicht, da wir keinen Callback an GLFW bergeben.
+// abfangen. Mausklicks erhalten wir ber einen zweiten Callback (s. mouse_button_callback).
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
 	switch (key)
@@ -123,72 +174,466 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 glm::mat4 Projection;
 glm::mat4 View;
 glm::mat4 Model;
-GLuint programID; // OpenGL untersttzt unterschiedliche Shaderprogramme, zwischen denen man
-// wechseln kann. Unser Programm wird mit der unsigned-integer-Variable programID
-// referenziert.
+// OpenGL untersttzt unterschiedliche Shaderprogramme, zwischen denen man wechseln kann.
+// Alle unsere Programme entstehen aus StandardShading.* mit verschiedenen #defines
+// (Permutationen, s. shader.hpp). Jedes Objekt nimmt das billigste, das noch reicht :
+// ohne Textur kein Texturzugriff, ohne Licht (Koordinatensystem) auch kein Blinn-Phong.
+// Instanzen lesen die Modelmatrix als Vertex-Attribut statt ueber sendMVP (s. instancing.hpp).
+#define SHADER_VERTEX_FILE   "StandardShading.vertexshader"
+#define SHADER_FRAGMENT_FILE "StandardShading.fragmentshader"
+GLuint shaderPrograms[64]; // nach ShaderFeature-Bits
+
+// Programm zu einer Kombination von SHADER_*-Bits, Licht gibt es genau mit SHADER_NORMALS.
+// Die Namen der Uniform-Variablen werden nur einmal nach dem Laden nachgeschlagen, nicht bei
+// jedem Zeichnen. setUniform schickt einen Wert ausserdem nur dann zur Grafikkarte, wenn er
+// sich seit dem letzten Aufruf geaendert hat. Matrizen und Licht stehen in den
+// Uniform-Bloecken (s. sendFrame und sendMVP).
+GLuint shaderProgram(unsigned int features)
+{
+	GLuint & program = shaderPrograms[features & 63];
+	if (!program) {
+		program = LoadShaderPermutation(SHADER_VERTEX_FILE, SHADER_FRAGMENT_FILE, features, (features & SHADER_NORMALS) ? 1 : 0);
+		if (program && (features & SHADER_TEXTURE)) {
+			// Set our "myTextureSampler" sampler to user Texture Unit 0
+			useProgram(program);
+			setUniform(findUniform(program, "myTextureSampler"), 0);
+		}
+	}
+	return program;
+}
+
+// Position der Lichtquelle in Weltkoordinaten, wird mit sendFrame uebertragen
+glm::vec3 LightPosition(0.0f);
+
+// Umrechnung quantisierter Positionen, s. sendPositionDequantization
+glm::vec3 PositionScale(1.0f);
+glm::vec3 PositionBias(0.0f);
+
+// Projection * View, einmal pro Bild in sendFrame berechnet
+glm::mat4 ViewProjection;
+
+// Daten, die fuer das ganze Bild gleich bleiben (Projection, View, Licht), werden einmal
+// pro Bild in den Uniform-Block PerFrame geschrieben. Alle Shader lesen denselben Block.
+void sendFrame()
+{
+	ViewProjection = Projection * View;
+
+	PerFrameUniforms frame;
+	frame.P = Projection;
+	frame.V = View;
+	frame.LightPosition_worldspace = glm::vec4(LightPosition, 1.0f);
+	sendPerFrame(frame);
+}
 
 // Ich habe Ihnen hier eine Hilfsfunktion definiert, die wir verwenden, um die Transformationsmatrizen
 // zwischen dem OpenGL-Programm auf der CPU und den Shaderprogrammen in den GPUs zu synchronisieren.
 // (Muss immer aufgerufen werden, bevor wir Geometriedaten in die Pipeline einspeisen.)
-void sendMVP()
+// (Die Render-Queue braucht die Werte erst spaeter, objectUniforms berechnet sie nur.)
+PerObjectUniforms objectUniforms(const glm::mat4 & MVP);
+
+PerObjectUniforms objectUniforms()
 {
-	glUniformMatrix4fv(glGetUniformLocation(programID, "M"), 1, GL_FALSE, &Model[0][0]);
-	glUniformMatrix4fv(glGetUniformLocation(programID, "V"), 1, GL_FALSE, &View[0][0]);
-	glUniformMatrix4fv(glGetUniformLocation(programID, "P"), 1, GL_FALSE, &Projection[0][0]);
 	// Zunchst knnen wir die drei Matrizen einfach kombinieren, da unser einfachster Shader
 	// wirklich nur eine Transformationsmatrix bentigt, wie in der Vorlesung erklrt.
 	// Spter werden wir hier auch die Teilmatrizen an den Shader bermitteln mssen.
 	// Interessant ist hier, dass man in C++ (wie auch in C#) den "*"-Operator berladen kann, so dass
 	// man Klassenobjekte miteinander multiplizieren kann (hier Matrizen bzw. "mat4"), 
 	// das ginge in JAVA so natrlich nicht. 
-	glm::mat4 MVP = Projection * View * Model;
+	// (Projection * View steht schon in ViewProjection, s. sendFrame. Das Produkt mit Model
+	// berechnet multiplyMatrix mit SSE bzw. AVX, das Ergebnis ist dasselbe wie mit "*".)
+	glm::mat4 MVP;
+	multiplyMatrix(ViewProjection, Model, MVP);
 
 	// "glGetUniformLocation" liefert uns eine Referenz auf eine Variable, die im Shaderprogramm
 	// definiert ist, in diesem Fall heisst die Variable "MVP".
+	// (Inzwischen stehen M und MVP im Uniform-Block PerObject. sendPerObject schreibt beide mit
+	// einem Aufruf in einen eigenen Bereich eines Ringpuffers, s. uniformbuffers.hpp.)
 	// "glUniformMatrix4fv" bertrgt Daten, genauer 4x4-Matrizen, aus dem Adressraum unserer CPU
 	// (vierter Parameter beim Funktionsaufruf, wir generieren mit "&" hier einen Pointer auf das erste 
 	//  Element, und damit auf das gesamte Feld bzw den Speicherbereich) 
 	// in den Adressraum der GPUs. Beim ersten Parameter 
 	// muss eine Referenz auf eine Variable im Adressraum der GPU angegeben werden.
-	glUniformMatrix4fv(glGetUniformLocation(programID, "MVP"), 1, GL_FALSE, &MVP[0][0]);
+	return objectUniforms(MVP);
+}
+
+// Dasselbe mit einem schon berechneten MVP = ViewProjection * Model (s. drawScene)
+PerObjectUniforms objectUniforms(const glm::mat4 & MVP)
+{
+	PerObjectUniforms object;
+	object.M = Model;
+	object.MVP = MVP;
+	object.PositionScale = glm::vec4(PositionScale, 0.0f);
+	object.PositionBias = glm::vec4(PositionBias, 0.0f);
+	return object;
+}
+
+void sendMVP()
+{
+	sendPerObject(objectUniforms());
+}
+
+// Quantisierte Meshes speichern Positionen relativ zu ihrer Bounding Box, der Vertexshader
+// rechnet sie mit PositionScale und PositionBias zurueck. Mit NULL gilt wieder Skalierung 1
+// und Verschiebung 0, das brauchen alle anderen Objekte. Gilt fuer das naechste sendMVP
+// bzw. objectUniforms.
+void sendPositionDequantization(const Mesh * mesh)
+{
+	PositionScale = mesh ? mesh->positionScale : glm::vec3(1.0f);
+	PositionBias = mesh ? mesh->positionBias : glm::vec3(0.0f);
+}
+
+
+
+
+// Die Szene als Baum : Welt (Rotation mit x, y, z) -> Teekanne und Roboterarm mit drei Gelenken.
+// Statt die globale Modelmatrix mit Save/Restore zu veraendern, hat jeder Knoten seine eigene
+// Transformation. updateSceneGraph berechnet nur die Weltmatrizen neu, die sich geaendert haben.
+SceneGraph scene;
+int worldNode, shoulderNode, elbowNode, wristNode, lightNode;
+
+// Koordinatensystem aus drei langen Wuerfeln, x rot, y gruen, z blau. Ohne Textur und Licht,
+// die Achsen brauchen nur ihre Farbe.
+void addCS(int parent) {
+	int axis = addSceneNode(scene, parent, DRAW_CUBE);
+	setScale(scene, axis, glm::vec3(2, 0.01, 0.01));
+	scene.nodes[axis].color = glm::vec4(1, 0, 0, 1);
+	scene.nodes[axis].unlit = true;
+	axis = addSceneNode(scene, parent, DRAW_CUBE);
+	setScale(scene, axis, glm::vec3(0.01, 0.01, 2));
+	scene.nodes[axis].color = glm::vec4(0, 0, 1, 1);
+	scene.nodes[axis].unlit = true;
+	axis = addSceneNode(scene, parent, DRAW_CUBE);
+	setScale(scene, axis, glm::vec3(0.01, 2, 0.01));
+	scene.nodes[axis].color = glm::vec4(0, 1, 0, 1);
+	scene.nodes[axis].unlit = true;
+}
+
+// Armsegment der Laenge h als gestreckte Kugel
+void addSeg(int parent, float h) {
+	int segment = addSceneNode(scene, parent, DRAW_SPHERE);
+	setTranslation(scene, segment, glm::vec3(0, h / 2, 0));
+	setScale(scene, segment, glm::vec3(h / 5, h / 2, h / 5));
+}
+
+// Knoten, deren Mesh noch geladen wird. Bis dahin zeichnen sie nichts.
+struct PendingMesh {
+	int node;
+	const MeshAsset * asset;
+};
+std::vector<PendingMesh> pendingMeshes;
+
+void addMeshNode(int node, const MeshAsset * asset) {
+	scene.nodes[node].drawable = DRAW_NOTHING;
+	PendingMesh pending = { node, asset };
+	pendingMeshes.push_back(pending);
+}
+
+// Haengt fertig geladene Meshes an ihre Knoten, true wenn sich dadurch etwas geaendert hat
+bool attachLoadedMeshes() {
+	bool attached = false;
+	for (size_t i = 0; i < pendingMeshes.size();) {
+		const PendingMesh & pending = pendingMeshes[i];
+		if (pending.asset->state == ASSET_LOADING) {
+			i++;
+			continue;
+		}
+		if (pending.asset->state == ASSET_READY) {
+			SceneNode & node = scene.nodes[pending.node];
+			node.drawable = DRAW_MESH;
+			node.mesh = &pending.asset->mesh;
+			node.triangles = pending.asset->triangles.bvh.nodes.empty() ? NULL : &pending.asset->triangles;
+			attached = true;
+		}
+		pendingMeshes.erase(pendingMeshes.begin() + i);
+	}
+	return attached;
+}
+
+void buildScene(const MeshAsset * teapot) {
+	worldNode = addSceneNode(scene, -1);
+
+	int teapotNode = addSceneNode(scene, worldNode);
+	addMeshNode(teapotNode, teapot);
+	setTranslation(scene, teapotNode, glm::vec3(1.5, 0.0, 0.0));
+	setScale(scene, teapotNode, glm::vec3(1.0 / 1000.0, 1.0 / 1000.0, 1.0 / 1000.0));
+
+	shoulderNode = addSceneNode(scene, worldNode);
+	addSeg(shoulderNode, 0.5f);
+
+	elbowNode = addSceneNode(scene, shoulderNode);
+	setTranslation(scene, elbowNode, glm::vec3(0, 0.5, 0));
+	addSeg(elbowNode, 0.4f);
+
+	wristNode = addSceneNode(scene, elbowNode);
+	setTranslation(scene, wristNode, glm::vec3(0, 0.4, 0));
+	addCS(wristNode);
+	addSeg(wristNode, 0.3f);
+
+	// Die Lampe sitzt an der Spitze des Arms
+	lightNode = addSceneNode(scene, wristNode);
+	setTranslation(scene, lightNode, glm::vec3(0, 0.4, 0));
+}
+
+// Uebernimmt die Winkel aus key_callback, nur geaenderte Knoten werden neu berechnet.
+// Gibt deren Anzahl zurueck.
+unsigned int updateScene() {
+	//Rotation - Uebung1
+	setRotation(scene, worldNode, glm::angleAxis(anglex, glm::vec3(1.0f, 0.0f, 0.0f))
+		* glm::angleAxis(angley, glm::vec3(0.0f, 1.0f, 0.0f))
+		* glm::angleAxis(anglez, glm::vec3(0.0f, 0.0f, 1.0f)));
+
+	setRotation(scene, shoulderNode, glm::angleAxis(z1, glm::vec3(0.0f, 0.0f, 1.0f)) * glm::angleAxis(y, glm::vec3(0, 1.0f, 0)));
+	setRotation(scene, elbowNode, glm::angleAxis(z2, glm::vec3(0, 0, 1.0f)));
+	setRotation(scene, wristNode, glm::angleAxis(z3, glm::vec3(0, 0, 1.0f)));
+
+	return updateSceneGraph(scene);
 }
 
+// Hoehe des Fensters in Pixeln (s. glfwCreateWindow), fuer die Feinheit der Kugeln
+const float viewportHeight = 768.0f;
+
+// Quader und Kugel um das, was ein Knoten zeichnet, in Modellkoordinaten (false, wenn er nichts zeichnet)
+static bool nodeBounds(const SceneNode & node, Bounds & bounds) {
+	switch (node.drawable) {
+	case DRAW_WIRE_CUBE: bounds = wireCubeBounds(); return true;
+	case DRAW_CUBE:      bounds = cubeBounds(); return true;
+	case DRAW_SPHERE:    bounds = sphereBounds(); return true;
+	case DRAW_MESH:
+		bounds.min = node.mesh->boundsMin;
+		bounds.max = node.mesh->boundsMax;
+		bounds.center = node.mesh->sphereCenter;
+		bounds.radius = node.mesh->sphereRadius;
+		return true;
+	default:
+		return false;
+	}
+}
 
+// BVH ueber die Quader (in Weltkoordinaten) aller Knoten, die etwas zeichnen, fuer Culling und Picking.
+// Primitiv i des BVH ist der Knoten bvhNodes[i].
+Bvh sceneBvh;
+std::vector<int> bvhNodes;
+std::vector<glm::vec3> bvhMin, bvhMax;
+std::vector<glm::vec3> bvhCenter;
+std::vector<float> bvhRadius;
+
+// Nach updateScene aufrufen, wenn sich Knoten bewegt haben. Der Baum wird nur beim ersten Mal
+// aufgebaut und danach an die neuen Quader angepasst (refit), die Szene aendert ja nur ihre Winkel.
+void updateSceneBvh() {
+	bvhNodes.clear();
+	bvhMin.clear(); bvhMax.clear();
+	bvhCenter.clear(); bvhRadius.clear();
+	for (size_t i = 0; i < scene.nodes.size(); i++) {
+		Bounds bounds;
+		if (!nodeBounds(scene.nodes[i], bounds))
+			continue;
+		glm::vec3 boxMin, boxMax, center;
+		float radius;
+		transformBox(scene.nodes[i].world, bounds.min, bounds.max, boxMin, boxMax);
+		transformSphere(scene.nodes[i].world, bounds.center, bounds.radius, center, radius);
+		bvhNodes.push_back((int)i);
+		bvhMin.push_back(boxMin);
+		bvhMax.push_back(boxMax);
+		bvhCenter.push_back(center);
+		bvhRadius.push_back(radius);
+	}
 
+	if (bvhNodes.empty())
+		sceneBvh.nodes.clear();
+	else if (sceneBvh.primitives.size() != bvhNodes.size())
+		buildBvh(sceneBvh, &bvhMin[0], &bvhMax[0], bvhNodes.size());
+	else
+		refitBvh(sceneBvh, &bvhMin[0], &bvhMax[0]);
+}
 
-void drawCS() {
-	glm::mat4 Save = Model;
-	Model = glm::scale(Model, glm::vec3(2,0.01,0.01));
-	sendMVP();
-	drawCube();
-	Model = Save;
+// Kandidaten aus dem BVH, ihre Kugeln getrennt nach Komponenten fuer cullSpheres
+static std::vector<unsigned int> cullCandidates;
+static std::vector<float> cullX, cullY, cullZ, cullRadius;
+static std::vector<unsigned char> cullVisible;
+// Weltmatrizen der sichtbaren Kugeln und der einzeln gezeichneten Meshes. Ihre Produkte mit View
+// bzw. ViewProjection berechnet multiplyMatrices fuer alle auf einmal statt einzeln pro Knoten.
+static std::vector<glm::mat4> sphereWorlds, sphereModelViews, meshWorlds, meshMVPs;
+
+// Meshes kommen als einzelne Draws in die Render-Queue, Wuerfel und Kugeln werden nur mit ihrer
+// Weltmatrix vorgemerkt. flushInstances stellt dann alle Wuerfel und alle Kugeln mit je einem
+// Aufruf in die Queue, flushRenderQueue zeichnet alles sortiert.
+void drawScene(const TextureLayer & texture) {
+	// Das BVH liefert die Knoten, deren Quader im Frustum liegt, deren Kugeln werden dann noch
+	// einmal getestet. Nur die sichtbaren Knoten werden hochgeladen und gezeichnet.
+	Frustum frustum = extractFrustum(ViewProjection);
+	cullCandidates.clear();
+	if (!bvhNodes.empty())
+		queryBvh(sceneBvh, &bvhMin[0], &bvhMax[0], frustum, cullCandidates);
+	addCullingStatistics(bvhNodes.size() - cullCandidates.size(), 0);
+	std::sort(cullCandidates.begin(), cullCandidates.end()); // in der Reihenfolge der Szene zeichnen
+
+	cullX.clear(); cullY.clear(); cullZ.clear(); cullRadius.clear();
+	for (size_t c = 0; c < cullCandidates.size(); c++) {
+		const glm::vec3 & center = bvhCenter[cullCandidates[c]];
+		cullX.push_back(center.x);
+		cullY.push_back(center.y);
+		cullZ.push_back(center.z);
+		cullRadius.push_back(bvhRadius[cullCandidates[c]]);
+	}
+	cullVisible.resize(cullCandidates.size());
+	if (!cullCandidates.empty())
+		cullSpheres(frustum, &cullX[0], &cullY[0], &cullZ[0], &cullRadius[0], &cullVisible[0], cullCandidates.size());
+
+	// Solange die Textur noch laedt, reicht ein Programm ohne Texturzugriff. BMP-Texturen liegen
+	// als Schicht in einem Textur-Array (s. texturearray.hpp), die Schicht kommt pro Instanz mit.
+	unsigned int textured = 0;
+	if (texture.texture)
+		textured = texture.target == GL_TEXTURE_2D_ARRAY ? SHADER_TEXTURE | SHADER_TEXTURE_ARRAY : SHADER_TEXTURE;
+
+	// Erst alle Matrizen sammeln und multiplizieren, die Schleife danach nimmt sie der Reihe nach
+	sphereWorlds.clear();
+	meshWorlds.clear();
+	for (size_t c = 0; c < cullCandidates.size(); c++) {
+		if (!cullVisible[c])
+			continue;
+		const SceneNode & node = scene.nodes[bvhNodes[cullCandidates[c]]];
+		if (node.drawable == DRAW_SPHERE)
+			sphereWorlds.push_back(node.world);
+		else if (node.drawable == DRAW_MESH && !(multiDrawSupported() && node.mesh->pool))
+			meshWorlds.push_back(node.world);
+	}
+	sphereModelViews.resize(sphereWorlds.size());
+	meshMVPs.resize(meshWorlds.size());
+	if (!sphereWorlds.empty())
+		multiplyMatrices(View, &sphereWorlds[0], &sphereModelViews[0], sphereWorlds.size());
+	if (!meshWorlds.empty())
+		multiplyMatrices(ViewProjection, &meshWorlds[0], &meshMVPs[0], meshWorlds.size());
+	size_t sphere = 0, mesh = 0;
+
+	for (size_t c = 0; c < cullCandidates.size(); c++) {
+		if (!cullVisible[c])
+			continue;
+		const SceneNode & node = scene.nodes[bvhNodes[cullCandidates[c]]];
+		if (node.unlit)
+			setInstanceMaterial(shaderProgram(SHADER_INSTANCED), plainTexture(0));
+		else
+			setInstanceMaterial(shaderProgram(SHADER_INSTANCED | SHADER_NORMALS | textured), texture);
+		switch (node.drawable) {
+		case DRAW_WIRE_CUBE:
+			queueWireCube(node.world, node.color);
+			break;
+		case DRAW_CUBE:
+			queueCube(node.world, node.color);
+			break;
+		case DRAW_SPHERE: {
+			// Kleine bzw. weit entfernte Kugeln werden mit weniger Dreiecken gezeichnet
+			GLuint slats, slongs;
+			sphereLOD(projectedRadius(sphereModelViews[sphere++], Projection, viewportHeight), slats, slongs);
+			queueSphere(node.world, node.color, slats, slongs);
+			break;
+		}
+		case DRAW_MESH: {
+			// Abstand vor der Kamera, fuer die Sortierung von vorne nach hinten
+			unsigned int features = SHADER_NORMALS | textured | (node.mesh->quantized ? SHADER_QUANTIZED : 0);
+			if (multiDrawSupported() && node.mesh->pool) {
+				// Matrix und Dequantisierung kommen pro Mesh aus dem Puffer "MeshDraws"
+				queueMeshDraw(shaderProgram(SHADER_MULTI_DRAW | features), texture, *node.mesh, node.world);
+				break;
+			}
+			float depth = -(View * glm::vec4(bvhCenter[cullCandidates[c]], 1.0f)).z;
+			PrimitiveDraw draw = { node.mesh->vertexArray, GL_TRIANGLES, node.mesh->indexCount, node.mesh->indexType,
+				node.mesh->baseVertex, node.mesh->firstIndex };
+			Model = node.world;
+			sendPositionDequantization(node.mesh);
+			submitDraw(shaderProgram(features), texture, draw, depth, objectUniforms(meshMVPs[mesh++]));
+			sendPositionDequantization(NULL);
+			break;
+		}
+		default:
+			break;
+		}
+	}
 
-	Model = glm::scale(Model, glm::vec3(0.01, 0.01, 2));
-	sendMVP();
-	drawCube();
-	Model = Save;
+	flushInstances();
+	flushMeshDraws();
+	flushRenderQueue();
+}
 
-	Model = glm::scale(Model, glm::vec3(0.01, 2, 0.01));
-	sendMVP();
-	drawCube();
-	Model = Save;
+// Strahl gegen das, was ein Knoten zeichnet (BvhRayFunction, primitive ist ein Eintrag in bvhNodes).
+// Getestet wird in Modellkoordinaten. Die Richtung wird dabei nicht normiert, so bleibt t gleich.
+static bool hitNode(void *, unsigned int primitive, const glm::vec3 & origin, const glm::vec3 & direction, float & t) {
+	const SceneNode & node = scene.nodes[bvhNodes[primitive]];
+	glm::mat4 inverseWorld = glm::inverse(node.world);
+	glm::vec3 modelOrigin = glm::vec3(inverseWorld * glm::vec4(origin, 1.0f));
+	glm::vec3 modelDirection = glm::vec3(inverseWorld * glm::vec4(direction, 0.0f));
+
+	switch (node.drawable) {
+	case DRAW_SPHERE:
+		return raycastSphere(glm::vec3(0.0f), 1.0f, modelOrigin, modelDirection, t);
+	case DRAW_MESH:
+		if (node.triangles) {
+			unsigned int triangle;
+			return raycastTriangles(*node.triangles, modelOrigin, modelDirection, t, t, triangle);
+		}
+		return raycastBox(node.mesh->boundsMin, node.mesh->boundsMax, modelOrigin, modelDirection, t);
+	default:
+		return raycastBox(glm::vec3(-1.0f), glm::vec3(1.0f), modelOrigin, modelDirection, t);
+	}
 }
 
-void drawSeg(float h) {
-	glm::mat4 Save = Model;
-	Model = glm::translate(Model, glm::vec3(0,h/2,0));
-	Model = glm::scale(Model, glm::vec3(h/5,h/2,h/5));
-	sendMVP();
-	drawSphere(10, 10);
-	Model = Save;}
+// Linke Maustaste : Strahl durch den Mauszeiger, der vorderste getroffene Knoten wird ausgegeben
+void mouse_button_callback(GLFWwindow* window, int button, int action, int /*mods*/)
+{
+	if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS)
+		return;
+
+	double x, y;
+	int width, height;
+	glfwGetCursorPos(window, &x, &y);
+	glfwGetWindowSize(window, &width, &height);
+	if (width <= 0 || height <= 0)
+		return;
+
+	// Fensterkoordinaten -> normierte Geraetekoordinaten -> Punkte auf Near- und Far-Plane in Weltkoordinaten
+	float ndcX = (float)(2.0 * x / width - 1.0);
+	float ndcY = (float)(1.0 - 2.0 * y / height);
+	glm::mat4 inverseViewProjection = glm::inverse(ViewProjection);
+	glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin; // t = 1 ist die Far-Plane
+
+	double start = glfwGetTime();
+	float t;
+	unsigned int primitive;
+	bool hit = raycastBvh(sceneBvh, origin, direction, hitNode, NULL, 1.0f, t, primitive);
+	double microseconds = (glfwGetTime() - start) * 1e6;
+
+	if (hit)
+		printf("Picked node %d at depth %.3f (%.1f us)\n", bvhNodes[primitive], t, microseconds);
+	else
+		printf("Nothing picked (%.1f us)\n", microseconds);
+}
 
 
 
 
 // Einstiegspunkt fr C- und C++-Programme (Funktion), Konsolenprogramme knnte hier auch Parameter erwarten
-int main(void)
+int main(int argc, char ** argv)
 
 {
+	// Nur Texturen umwandeln, ohne Fenster und OpenGL
+	if (argc >= 4 && strcmp(argv[1], "--compress") == 0)
+	{
+		BlockFormat format = BLOCK_BC1;
+		if (argc >= 5 && strcmp(argv[4], "bc3") == 0)
+			format = BLOCK_BC3;
+		else if (argc >= 5 && strcmp(argv[4], "bc1") != 0)
+		{
+			fprintf(stderr, "Unknown format %s, use bc1 or bc3\n", argv[4]);
+			return 1;
+		}
+		return convertBMPToDDS(argv[2], argv[3], format) ? 0 : 1;
+	}
+
+	if (argc >= 2 && strcmp(argv[1], "--selftest") == 0)
+		return runSelfTests() ? 0 : 1;
+
 	// Initialisierung der GLFW-Bibliothek
 	if (!glfwInit())
 	{
@@ -239,6 +684,9 @@ int main(void)
 	// Auf Keyboard-Events reagieren (s. o.)
 	glfwSetKeyCallback(window, key_callback);
 
+	// Mausklicks fuer das Picking (s. mouse_button_callback)
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
+
 	// Setzen von Dunkelblau als Hintergrundfarbe (erster OpenGL-Befehl in diesem Programm).
 	// Beim spteren Lschen gibt man die Farbe dann nicht mehr an, sondern liest sie aus dem GC
 	// Der Wertebereich in OpenGL geht nicht von 0 bis 255, sondern von 0 bis 1, hier sind Werte
@@ -248,73 +696,49 @@ int main(void)
 
 	// Kreieren von Shadern aus den angegebenen Dateien, kompilieren und linken und in
 	// die Grafikkarte bertragen.  
-	programID = LoadShaders("StandardShading.vertexshader", "StandardShading.fragmentshader");
+	// Alle Permutationen, die drawScene braucht, werden zusammen abgeschickt, der Treiber kann
+	// sie parallel uebersetzen. Fertig gelinkte Programme landen in *.cgprogram-Dateien, der
+	// naechste Start liest nur diese.
+	ShaderPermutation permutations[] = {
+		{ SHADER_NORMALS | SHADER_TEXTURE_ARRAY | SHADER_QUANTIZED, 1 }, // Teekanne
+		{ SHADER_NORMALS | SHADER_QUANTIZED, 1 },                        // Teekanne, solange die Textur laedt
+		{ SHADER_INSTANCED | SHADER_NORMALS | SHADER_TEXTURE_ARRAY, 1 }, // Wuerfel und Kugeln
+		{ SHADER_INSTANCED | SHADER_NORMALS, 1 },
+		{ SHADER_INSTANCED, 0 },                                         // Koordinatensystem
+		{ SHADER_MULTI_DRAW | SHADER_NORMALS | SHADER_TEXTURE_ARRAY | SHADER_QUANTIZED, 1 }, // Teekanne mit Multi-Draw
+		{ SHADER_MULTI_DRAW | SHADER_NORMALS | SHADER_QUANTIZED, 1 },
+	};
+	// Die letzten beiden nur, wenn drawScene sie auch benutzt
+	size_t permutationCount = sizeof(permutations) / sizeof(permutations[0]);
+	if (!multiDrawSupported())
+		permutationCount -= 2;
+	preloadShaderPermutations(SHADER_VERTEX_FILE, SHADER_FRAGMENT_FILE, permutations, permutationCount);
 
 
 	// Diesen Shader aktivieren ! (Man kann zwischen Shadern wechseln.) 
-	glUseProgram(programID);
-
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec2> uvs;
-	std::vector<glm::vec3> normals;
-	bool res = loadOBJ("teapot.obj", vertices, uvs, normals);
+	// (Das macht inzwischen die Render-Queue vor jedem Draw, hier muss kein Programm gebunden
+	// werden. Ein eigenes Programm nur dafuer wuerde ausserdem am Batch vorbei uebersetzt.)
+	createUniformBuffers();
 
-	// Jedes Objekt eigenem VAO zuordnen, damit mehrere Objekte moeglich sind
-	// VAOs sind Container fuer mehrere Buffer, die zusammen gesetzt werden sollen.
-	GLuint VertexArrayIDTeapot;
-	glGenVertexArrays(1, &VertexArrayIDTeapot);
-	glBindVertexArray(VertexArrayIDTeapot);
+	// Die Teekanne wird beim ersten Start aus teapot.obj gelesen und als teapot.obj.cgmesh
+	// gespeichert. Danach wird nur noch diese Datei in den Speicher eingeblendet und direkt
+	// an glBufferData uebergeben. VAO, Vertex- und Indexbuffer stecken in "teapot->mesh".
+	// Die Dreiecke bleiben zusaetzlich im Hauptspeicher, in einem BVH fuer das Picking.
+	// Beides passiert in einem Hintergrund-Thread, die Schleife unten laeuft sofort los und
+	// die Teekanne erscheint, sobald sie fertig ist (s. processUploads).
+	MeshAsset * teapot = loadMeshAsync("teapot.obj", true);
+	buildScene(teapot);
 
-	// Ein ArrayBuffer speichert Daten zu Eckpunkten (hier xyz bzw. Position)
-	GLuint vertexbuffer;
-	glGenBuffers(1, &vertexbuffer); // Kennung erhalten
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer); // Daten zur Kennung definieren
-	// Buffer zugreifbar fr die Shader machen
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
+	// Load the texture (ebenfalls im Hintergrund, bis dahin bleibt Texture Unit 0 leer)
+	TextureAsset * mandrill = loadTextureAsync("mandrill.bmp");
 
-	// Erst nach glEnableVertexAttribArray kann DrawArrays auf die Daten zugreifen...
-	glEnableVertexAttribArray(0); // siehe layout im vertex shader: location = 0 
-	glVertexAttribPointer(0,  // location = 0 
-		3,  // Datenformat vec3: 3 floats fuer xyz 
-		GL_FLOAT,
-		GL_FALSE, // Fixedpoint data normalisieren ?
-		0, // Eckpunkte direkt hintereinander gespeichert
-		(void*)0); // abweichender Datenanfang ? 
-
-	GLuint normalbuffer; // Hier alles analog fr Normalen in location == 2
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0], GL_STATIC_DRAW);
-	glEnableVertexAttribArray(2); // siehe layout im vertex shader 
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-
-
-
-
-	GLuint uvbuffer; // Hier alles analog fr Texturkoordinaten in location == 1 (2 floats u und v!)
-	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW);
-	glEnableVertexAttribArray(1); // siehe layout im vertex shader 
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-	// Load the texture
-	GLuint Texture = loadBMP_custom("mandrill.bmp");
-
-
-
-	// Bind our texture in Texture Unit 0
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, Texture);
-
-	// Set our "myTextureSampler" sampler to user Texture Unit 0
-	glUniform1i(glGetUniformLocation(programID, "myTextureSampler"), 0);
 
 
 	// Alles ist vorbereitet, jetzt kann die Eventloop laufen...
 	while (!glfwWindowShouldClose(window))
 	{
+		beginResourceFrame();
+
 		// Lschen des Bildschirms (COLOR_BUFFER), man kann auch andere Speicher zustzlich lschen, 
 		// kommt in spteren bungen noch...
 		// Per Konvention sollte man jedes Bild mit dem Lschen des Bildschirms beginnen, muss man aber nicht...
@@ -345,70 +769,25 @@ int main(void)
 
 			
 
+		// Projection, View und Licht gelten fuer alle Objekte dieses Bildes
+		sendFrame();
+
 		// Modelmatrix : Hier auf Einheitsmatrix gesetzt, was bedeutet, dass die Objekte sich im Ursprung
-		// des Weltkoordinatensystems befinden.
+		// des Weltkoordinatensystems befinden. Die Objekte selbst haben ihre Matrizen im Szenengraph.
 		Model = glm::mat4(1.0f);
 
-
-
-
-		//Rotation - Uebung1
-		Model = glm::rotate(Model, anglex, glm::vec3(1.0f, 0.0f, 0.0f));
-
-		Model = glm::rotate(Model, angley, glm::vec3(0.0f, 1.0f, 0.0f));
-
-		Model = glm::rotate(Model, anglez, glm::vec3(0.0f, 0.0f, 1.0f));
-
-
-		glm::mat4 Save = Model;
-		Model = glm::translate(Model, glm::vec3(1.5, 0.0, 0.0));
-
-
-		Model = glm::scale(Model, glm::vec3(1.0 / 1000.0, 1.0 / 1000.0, 1.0 / 1000.0));
-	
-		
-
-
-
-
 		// Diese Informationen (Projection, View, Model) mssen geeignet der Grafikkarte bermittelt werden,
-		// damit sie beim Zeichnen von Objekten bercksichtigt werden knnen.
-		sendMVP();
-
-		glBindVertexArray(VertexArrayIDTeapot);
-		glDrawArrays(GL_TRIANGLES, 0, vertices.size());
-
-
-		Model = Save;
-		Model = glm::scale(Model, glm::vec3(1, 1, 1));
-		sendMVP();
-		Model = glm::rotate(Model, z1, glm::vec3(0.0f, 0.0f, 1.0f));
-
-
-		Model = glm::rotate(Model, y, glm::vec3(0, 1.0f, 0));
+		// damit sie beim Zeichnen von Objekten bercksichtigt werden knnen. (Das macht drawScene.)
+		// Fertig geladene Modelle und Texturen hochladen, hoechstens etwa 2 ms pro Bild
+		processUploads(0.002);
+		bool attached = attachLoadedMeshes();
 
-		drawSeg(0.5f);
-		Model = glm::translate(Model, glm::vec3(0, 0.5, 0));
-		Model = glm::rotate(Model, z2, glm::vec3(0, 0, 1.0f));
+		if (updateScene() > 0 || attached)
+			updateSceneBvh();
+		drawScene(mandrill->state == ASSET_READY ? mandrill->texture : plainTexture(0));
 
-
-		drawSeg(0.4f);
-		Model = glm::translate(Model, glm::vec3(0, 0.4, 0));
-		Model = glm::rotate(Model, z3, glm::vec3(0, 0, 1.0f));
-		drawCS();
-
-	
-
-		drawSeg(0.3f);
-
-	
-		glm::vec4 lightPos = Model * glm::vec4(0.0f, 0.4f, 0.0f, 1.0f);
-		glUniform3f(glGetUniformLocation(programID, "LightPosition_worldspace"), lightPos.x, lightPos.y, lightPos.z);
-
-
-
-
-	
+		glm::vec4 lightPos = scene.nodes[lightNode].world * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		LightPosition = glm::vec3(lightPos); // gilt ab dem naechsten Bild (sendFrame)
 
 		// Nachdem der GC in der Grafikkarte aktuell ist, also z. B. auch ein sendMVP ausgefhrt wurde,
 		// zeichen wir hier nun einen Wrfel. Dazu werden in "drawWireCube" die Eckpunkte zur Grafikkarte 
@@ -419,15 +798,6 @@ int main(void)
 		//drawCube();
 
 
-		GLuint normalbuffer; // Hier alles analog fr Normalen in location == 2
-		glGenBuffers(1, &normalbuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-		glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(2); // siehe layout im vertex shader 
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-
-
 		// Bildende. 
 		// Bilder werden in den Bildspeicher gezeichnet (so schnell wie es geht.). 
 		// Der Bildspeicher wird mit der eingestellten Bildwiederholfrequenz (also z. B. 60Hz)
@@ -437,6 +807,9 @@ int main(void)
 		// Dieses Problem vermeidet man, wenn man zwei Bildspeicher benutzt, wobei in einen gerade
 		// gemalt wird, bzw. dort ein neues Bild entsteht, und der andere auf dem Bildschirm ausgegeben wird.
 		// Ist man mit dem Erstellen eines Bildes fertig, tauscht man diese beiden Speicher einfach aus ("swap").
+		endStreamFrames();
+		endResourceFrame();
+		endStateFrame();
 		glfwSwapBuffers(window);
 
 		// Hier fordern wir glfw auf, Ereignisse zu behandeln. GLFW knnte hier z. B. feststellen,
@@ -450,13 +823,21 @@ int main(void)
 	// wir kommen an diese Stelle. Hier knnen wir aufrumen, und z. B. das Shaderprogramm in der
 	// Grafikkarte lschen. (Das macht zurnot das OS aber auch automatisch.)
 
-	glDeleteBuffers(1, &uvbuffer);
-	glDeleteTextures(1, &Texture);
-
-	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &normalbuffer);
-
-	glDeleteProgram(programID);
+	// Vor deleteAssets, danach ist der Cache leer
+	printTextureCacheStatistics();
+	deleteAssets();
+	deleteMeshPools();
+
+	deleteUniformBuffers();
+	deleteInstanceBuffer();
+	printResourceStatistics();
+	printStateStatistics();
+	unsigned long long uniformUploads, uniformsSkipped;
+	getUniformStatistics(uniformUploads, uniformsSkipped);
+	printf("Uniforms : %llu uploaded, %llu unchanged and skipped\n", uniformUploads, uniformsSkipped);
+	CullingStatistics culling = getCullingStatistics();
+	printf("Culling : %llu tested, %llu visible, %llu culled\n", culling.tested, culling.visible, culling.tested - culling.visible);
+	deleteShaderPermutations();
 
 	// Schieen des OpenGL-Fensters und beenden von GLFW.
 	glfwTerminate();
@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <functional>
+
+#include <GL/glew.h>
+
+#include "assets.hpp"
+#include "threadpool.hpp"
+#include "texture.hpp"
+#include "resources.hpp"
+#include "mappedfile.hpp"
+#include "texturearray.hpp"
+
+// Work finished on a worker thread that still needs the OpenGL context
+static std::deque<std::function<void()> > uploads;
+static std::mutex uploadMutex;
+static std::condition_variable uploadQueued;
+
+// Only touched on the main thread
+static std::vector<MeshAsset *> meshAssets;
+static unsigned int pending = 0;
+static unsigned int loading = 0; // jobs not yet in "uploads", protected by uploadMutex
+
+static void startJob(const std::function<void()> & job)
+{
+	{
+		std::lock_guard<std::mutex> lock(uploadMutex);
+		loading++;
+	}
+	pending++;
+	runOnWorker(job);
+}
+
+static void queueUpload(const std::function<void()> & upload)
+{
+	{
+		std::lock_guard<std::mutex> lock(uploadMutex);
+		uploads.push_back(upload);
+		loading--;
+	}
+	uploadQueued.notify_all();
+}
+
+// A mesh file read on a worker. The MeshFile points into the mapped cache or into storage.
+struct LoadedMesh
+{
+	MeshFile file;
+	std::vector<char> storage;
+	bool ok;
+};
+
+MeshAsset * loadMeshAsync(const char * objPath, bool keepTriangles, bool quantize)
+{
+	MeshAsset * asset = new MeshAsset();
+	asset->state = ASSET_LOADING;
+	meshAssets.push_back(asset);
+
+	std::string path = objPath;
+	startJob([asset, path, keepTriangles, quantize]{
+		std::shared_ptr<LoadedMesh> loaded = std::make_shared<LoadedMesh>();
+		loaded->ok = readMeshCached(path.c_str(), quantize, loaded->file, loaded->storage);
+
+		// The handle is not ready yet, nobody else looks at the triangles
+		if (loaded->ok && keepTriangles){
+			MeshGeometry geometry;
+			readMeshGeometry(loaded->file, geometry);
+			buildTriangleBvh(asset->triangles, geometry.positions, geometry.indices);
+		}
+
+		queueUpload([asset, loaded, path]{
+			if (loaded->ok && uploadMesh(loaded->file, asset->mesh, true)){
+				asset->state = ASSET_READY;
+			}else{
+				printf("Could not load %s\n", path.c_str());
+				asset->state = ASSET_FAILED;
+			}
+			closeMeshFile(loaded->file);
+			pending--;
+		});
+	});
+	return asset;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Texture cache
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// One OpenGL texture or array layer, used by every cached path with this content
+struct SharedTexture
+{
+	TextureLayer texture;
+	unsigned long long bytes;
+	unsigned long long hash;
+	unsigned int users;
+};
+
+// Only touched on the main thread
+static std::unordered_map<std::string, TextureAsset *> texturesByPath;
+static std::unordered_map<unsigned long long, SharedTexture *> texturesByContent;
+static std::map<unsigned long long, TextureAsset *> unreferencedTextures; // by releaseOrder, oldest first
+static unsigned long long releaseCounter = 0;
+static unsigned long long plainTextureBytes = 0; // the array layers are counted by textureArrayBytes
+static TextureCacheStatistics textureStatistics = { 0, 0, 0, 0, 0, 0, DEFAULT_TEXTURE_BUDGET };
+
+// A texture file read on a worker, either format
+struct LoadedTexture
+{
+	bool compressed;
+	bool ok;
+	MipChain chain;           // .bmp
+	CompressedImage image;    // .dds, mapped until the upload
+	unsigned long long hash;  // of the pixels, not of the file
+};
+
+// The same file always gets the same key : "textures\\..\\a.bmp" and "./a.bmp" are both
+// "a.bmp". File names on Windows ignore case.
+static std::string canonicalPath(const char * path)
+{
+	std::vector<std::string> parts;
+	std::string part;
+	for (const char * c = path; ; c++){
+		if (*c == '/' || *c == '\\' || *c == 0){
+			if (part == ".." && !parts.empty() && parts.back() != "..")
+				parts.pop_back();
+			else if (!part.empty() && part != ".")
+				parts.push_back(part);
+			part.clear();
+			if (*c == 0)
+				break;
+		}else{
+#ifdef _WIN32
+			part += (char)tolower((unsigned char)*c);
+#else
+			part += *c;
+#endif
+		}
+	}
+
+	std::string key = path[0] == '/' || path[0] == '\\' ? "/" : "";
+	for (size_t i = 0; i < parts.size(); i++){
+		if (i > 0)
+			key += '/';
+		key += parts[i];
+	}
+	return key;
+}
+
+static bool isDDSPath(const std::string & key)
+{
+	return key.size() > 4 && tolower((unsigned char)key[key.size() - 4]) == '.' && tolower((unsigned char)key[key.size() - 3]) == 'd'
+		&& tolower((unsigned char)key[key.size() - 2]) == 'd' && tolower((unsigned char)key[key.size() - 1]) == 's';
+}
+
+static unsigned long long contentHash(GLenum format, unsigned int width, unsigned int height, const void * data, size_t size)
+{
+	unsigned int header[3] = { format, width, height };
+	return hashBytes(data, size, hashBytes(header, sizeof(header)));
+}
+
+static void deleteSharedTexture(SharedTexture * shared)
+{
+	if (shared->texture.target == GL_TEXTURE_2D_ARRAY){
+		removeTextureLayer(shared->texture);
+	}else{
+		plainTextureBytes -= shared->bytes;
+		deleteTexture(shared->texture.texture);
+	}
+	delete shared;
+}
+
+// What the cache really holds on the GPU : an array costs all its layers, used or not
+static unsigned long long residentTextureBytes()
+{
+	return plainTextureBytes + textureArrayBytes();
+}
+
+static void makeUnreferenced(TextureAsset * asset)
+{
+	asset->releaseOrder = ++releaseCounter;
+	unreferencedTextures[asset->releaseOrder] = asset;
+}
+
+static void evictTexture(TextureAsset * asset)
+{
+	unreferencedTextures.erase(asset->releaseOrder);
+	texturesByPath.erase(asset->key);
+
+	SharedTexture * shared = asset->shared;
+	if (shared && --shared->users == 0){
+		texturesByContent.erase(shared->hash);
+		deleteSharedTexture(shared);
+	}
+	delete asset;
+}
+
+// Points the textures and handles of moved array layers to their new place
+static void applyLayerMoves(const std::vector<TextureLayerMove> & moves)
+{
+	for (size_t m = 0; m < moves.size(); m++){
+		const TextureLayer & from = moves[m].from;
+		for (std::unordered_map<unsigned long long, SharedTexture *>::iterator it = texturesByContent.begin(); it != texturesByContent.end(); ++it){
+			TextureLayer & texture = it->second->texture;
+			if (texture.texture == from.texture && texture.layer == from.layer)
+				texture = moves[m].to;
+		}
+	}
+	for (std::unordered_map<std::string, TextureAsset *>::iterator it = texturesByPath.begin(); it != texturesByPath.end(); ++it){
+		if (it->second->shared)
+			it->second->texture = it->second->shared->texture;
+	}
+}
+
+// An evicted layer gives its memory back only when its array shrinks, so the arrays are
+// compacted before the next texture has to go
+static void enforceTextureBudget()
+{
+	std::vector<TextureLayerMove> moves;
+	while (residentTextureBytes() > textureStatistics.budget){
+		moves.clear();
+		compactTextureArrays(moves);
+		applyLayerMoves(moves);
+		if (residentTextureBytes() <= textureStatistics.budget || unreferencedTextures.empty())
+			break;
+		evictTexture(unreferencedTextures.begin()->second);
+		textureStatistics.evictions++;
+	}
+}
+
+// Main thread : uploads the texture, unless the same pixels are on the GPU already
+static void attachTexture(TextureAsset * asset, const LoadedTexture & loaded, const char * path)
+{
+	SharedTexture * shared;
+	std::unordered_map<unsigned long long, SharedTexture *>::iterator it = texturesByContent.find(loaded.hash);
+	if (it != texturesByContent.end()){
+		shared = it->second;
+		textureStatistics.shared++;
+	}else{
+		TextureLayer texture = loaded.compressed ? plainTexture(uploadCompressed(loaded.image, path)) : addTextureLayer(loaded.chain);
+		if (!texture.texture)
+			return;
+
+		shared = new SharedTexture();
+		shared->texture = texture;
+		shared->hash = loaded.hash;
+		shared->users = 0;
+		shared->bytes = loaded.compressed ? loaded.image.bytes : 0;
+		for (size_t level = 0; level < loaded.chain.levels.size(); level++)
+			shared->bytes += loaded.chain.levels[level].pixels.size();
+		texturesByContent[shared->hash] = shared;
+		if (loaded.compressed)
+			plainTextureBytes += shared->bytes;
+	}
+	shared->users++;
+	asset->shared = shared;
+	asset->texture = shared->texture;
+}
+
+TextureAsset * loadTextureAsync(const char * path)
+{
+	std::string key = canonicalPath(path);
+	std::unordered_map<std::string, TextureAsset *>::iterator it = texturesByPath.find(key);
+	if (it != texturesByPath.end()){
+		TextureAsset * asset = it->second;
+		if (asset->references++ == 0 && asset->state != ASSET_LOADING)
+			unreferencedTextures.erase(asset->releaseOrder);
+		textureStatistics.hits++;
+		return asset;
+	}
+	textureStatistics.misses++;
+
+	TextureAsset * asset = new TextureAsset();
+	asset->state = ASSET_LOADING;
+	asset->texture = plainTexture(0);
+	asset->key = key;
+	asset->references = 1;
+	asset->releaseOrder = 0;
+	asset->shared = 0;
+	texturesByPath[key] = asset;
+
+	// The key is a valid path as well, with "/" only
+	std::string file = key;
+	bool compressed = isDDSPath(key);
+	startJob([asset, file, compressed]{
+		std::shared_ptr<LoadedTexture> loaded = std::make_shared<LoadedTexture>();
+		loaded->compressed = compressed;
+		loaded->hash = 0;
+		if (compressed){
+			loaded->ok = readDDS(file.c_str(), loaded->image);
+			if (loaded->ok)
+				loaded->hash = contentHash(loaded->image.format, loaded->image.width, loaded->image.height, loaded->image.blocks, (size_t)loaded->image.bytes);
+		}else{
+			// Decoding and the mip levels use the other workers as well (parallelFor)
+			loaded->ok = readBMPMipmapped(file.c_str(), loaded->chain);
+			if (loaded->ok){
+				const Image & base = loaded->chain.levels[0];
+				loaded->hash = contentHash(GL_RGBA8, base.width, base.height, &base.pixels[0], base.pixels.size());
+			}
+		}
+
+		queueUpload([asset, loaded, file]{
+			if (loaded->ok)
+				attachTexture(asset, *loaded, file.c_str());
+			if (loaded->ok && loaded->compressed)
+				closeDDS(loaded->image);
+			if (!asset->texture.texture)
+				printf("Could not load %s\n", file.c_str());
+			asset->state = asset->texture.texture ? ASSET_READY : ASSET_FAILED;
+
+			// Released while it was loading
+			if (asset->references == 0 && asset->state == ASSET_FAILED)
+				evictTexture(asset);
+			else if (asset->references == 0)
+				makeUnreferenced(asset);
+			enforceTextureBudget();
+			pending--;
+		});
+	});
+	return asset;
+}
+
+void releaseTexture(TextureAsset * asset)
+{
+	if (!asset || asset->references == 0)
+		return;
+	// A texture that is still loading joins the LRU order when its upload is done
+	if (--asset->references > 0 || asset->state == ASSET_LOADING)
+		return;
+	// Nothing to keep, the next load of the path tries the file again
+	if (asset->state == ASSET_FAILED){
+		evictTexture(asset);
+		return;
+	}
+	makeUnreferenced(asset);
+	enforceTextureBudget();
+}
+
+void setTextureBudget(unsigned long long bytes)
+{
+	textureStatistics.budget = bytes;
+	enforceTextureBudget();
+}
+
+TextureCacheStatistics getTextureCacheStatistics()
+{
+	TextureCacheStatistics statistics = textureStatistics;
+	statistics.textures = (unsigned int)texturesByPath.size();
+	statistics.residentBytes = residentTextureBytes();
+	return statistics;
+}
+
+void printTextureCacheStatistics()
+{
+	TextureCacheStatistics statistics = getTextureCacheStatistics();
+	printf("Texture cache : %u hits, %u misses, %u shared, %u evictions, %u textures, %.1f of %.1f MB resident\n",
+		statistics.hits, statistics.misses, statistics.shared, statistics.evictions, statistics.textures,
+		statistics.residentBytes / (1024.0 * 1024.0), statistics.budget / (1024.0 * 1024.0));
+}
+
+unsigned int processUploads(double budget)
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+
+	unsigned int done = 0;
+	for (;;){
+		std::function<void()> upload;
+		{
+			std::lock_guard<std::mutex> lock(uploadMutex);
+			if (uploads.empty())
+				break;
+			upload.swap(uploads.front());
+			uploads.pop_front();
+		}
+		upload();
+		done++;
+
+		if (std::chrono::duration<double>(Clock::now() - start).count() >= budget)
+			break;
+	}
+	return done;
+}
+
+unsigned int pendingAssets()
+{
+	return pending;
+}
+
+void deleteAssets()
+{
+	// Jobs still running write into the handles. Wait for them and run their uploads, so
+	// everything below is in a known state.
+	{
+		std::unique_lock<std::mutex> lock(uploadMutex);
+		uploadQueued.wait(lock, []{ return loading == 0; });
+	}
+	processUploads(1e30);
+
+	for (size_t i = 0; i < meshAssets.size(); i++){
+		if (meshAssets[i]->state == ASSET_READY)
+			deleteMesh(meshAssets[i]->mesh);
+		delete meshAssets[i];
+	}
+	for (std::unordered_map<unsigned long long, SharedTexture *>::iterator it = texturesByContent.begin(); it != texturesByContent.end(); ++it)
+		deleteSharedTexture(it->second);
+	for (std::unordered_map<std::string, TextureAsset *>::iterator it = texturesByPath.begin(); it != texturesByPath.end(); ++it)
+		delete it->second;
+	meshAssets.clear();
+	texturesByPath.clear();
+	texturesByContent.clear();
+	unreferencedTextures.clear();
+	deleteTextureArrays(); // empty by now, unless a layer was added outside the cache
+	plainTextureBytes = 0;
+}
@@ -0,0 +1,92 @@
+#ifndef ASSETS_HPP
+#define ASSETS_HPP
+
+#include <string>
+
+#include <GL/glew.h>
+
+#include "mesh.hpp"
+#include "bvh.hpp"
+#include "texturearray.hpp"
+
+// Asynchronous loading. Reading and parsing files runs on the worker threads (threadpool.hpp),
+// only the OpenGL calls that create the buffers and textures are queued for the main thread.
+// processUploads executes them, as many as fit into a time budget per frame, so the render
+// loop starts at once and models appear as soon as they are ready.
+//
+// The load functions return a handle right away. Its state changes only inside
+// processUploads, i.e. on the main thread, so it can be read without locking.
+
+enum AssetState
+{
+	ASSET_LOADING,
+	ASSET_READY,
+	ASSET_FAILED
+};
+
+struct MeshAsset
+{
+	AssetState state;
+	Mesh mesh;
+	TriangleBvh triangles; // only with keepTriangles, for picking
+};
+
+// .bmp files become layers of texture arrays (see texturearray.hpp), .dds files plain textures
+struct TextureAsset
+{
+	AssetState state;
+	TextureLayer texture;
+
+	// Cache bookkeeping, only assets.cpp changes these
+	std::string key;                // normalized path
+	unsigned int references;
+	unsigned long long releaseOrder; // when the last reference was released, for the LRU order
+	struct SharedTexture * shared;   // owns "texture", files with the same content share it
+};
+
+// Textures without references are kept up to this many bytes on the GPU (all cached textures
+// together, texture arrays with all their allocated layers), see setTextureBudget
+#define DEFAULT_TEXTURE_BUDGET (256ull << 20)
+
+struct TextureCacheStatistics
+{
+	unsigned int hits;      // loadTextureAsync found the file in the cache
+	unsigned int misses;    // ... and had to load it
+	unsigned int shared;    // loaded, but the same content was on the GPU already
+	unsigned int evictions;
+	unsigned int textures;  // cached files, with or without references
+	unsigned long long residentBytes; // plain textures plus the whole texture arrays
+	unsigned long long budget;
+};
+
+// Handles stay valid until deleteAssets
+MeshAsset * loadMeshAsync(const char * objPath, bool keepTriangles = false, bool quantize = true);
+
+// Textures (.bmp or .dds) are cached. Loading a path that is cached already (after normalizing
+// "\\", "." and "..") returns the same handle with one more reference, identical files under
+// different paths share one OpenGL texture. A failed load is not cached : it is deleted with its
+// last reference, so loading the path again starts over (e.g. after the file was fixed).
+TextureAsset * loadTextureAsync(const char * path);
+
+// Gives up one reference, don't use the handle afterwards. Textures without references stay
+// cached for the next load. When the cache uses more than the budget, the ones released
+// longest ago are deleted until it fits (or none without references is left). Texture arrays
+// are compacted on the way (see compactTextureArrays), so the remaining textures may move to
+// another array or layer : read TextureAsset::texture again instead of keeping a copy.
+void releaseTexture(TextureAsset * asset);
+void setTextureBudget(unsigned long long bytes);
+
+TextureCacheStatistics getTextureCacheStatistics();
+void printTextureCacheStatistics();
+
+// Main thread, once per frame. Runs queued uploads until "budget" seconds are used up, but
+// at least one, so loading always makes progress. Returns the number of uploads done.
+unsigned int processUploads(double budget);
+
+// Assets that are not ready or failed yet
+unsigned int pendingAssets();
+
+// Waits for all workers, then deletes the OpenGL objects and the handles, referenced or not
+void deleteAssets();
+
+#endif
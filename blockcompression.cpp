@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "blockcompression.hpp"
+#include "texture.hpp"
+#include "threadpool.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define BLOCK_X86 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// GCC and clang only emit SSE2 instructions in functions that ask for them
+#if defined(BLOCK_X86) && defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_SSE2
+#endif
+
+#define FOURCC_DXT1 0x31545844 // "DXT1"
+#define FOURCC_DXT5 0x35545844 // "DXT5"
+
+unsigned int blockBytes(BlockFormat format)
+{
+	return format == BLOCK_BC1 ? 8 : 16;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Palette indices
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The 16 pixels of a block as separate channels
+struct BlockColors
+{
+	float r[16], g[16], b[16];
+};
+
+// Kernel : closest of the four palette colors for every pixel, returns the summed squared error
+typedef float (*IndexKernel)(const BlockColors & colors, const float palette[4][3], unsigned int * indices);
+
+static float closestScalar(const BlockColors & colors, const float palette[4][3], unsigned int * indices)
+{
+	// Summed in the same order as closestSSE2, both pick the same endpoints
+	float error[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++){
+		float best = 1e30f;
+		for (unsigned int p = 0; p < 4; p++){
+			float dr = colors.r[i] - palette[p][0], dg = colors.g[i] - palette[p][1], db = colors.b[i] - palette[p][2];
+			float d = dr * dr + dg * dg + db * db;
+			if (d < best){
+				best = d;
+				indices[i] = p;
+			}
+		}
+		error[i & 3] += best;
+	}
+	return (error[0] + error[1]) + (error[2] + error[3]);
+}
+
+#ifdef BLOCK_X86
+
+// Four pixels per instruction, the index of the minimum is selected with masks
+TARGET_SSE2 static float closestSSE2(const BlockColors & colors, const float palette[4][3], unsigned int * indices)
+{
+	__m128 total = _mm_setzero_ps();
+	for (int i = 0; i < 16; i += 4){
+		__m128 r = _mm_loadu_ps(colors.r + i), g = _mm_loadu_ps(colors.g + i), b = _mm_loadu_ps(colors.b + i);
+		__m128 best = _mm_set1_ps(1e30f);
+		__m128i index = _mm_setzero_si128();
+		for (int p = 0; p < 4; p++){
+			__m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[p][0]));
+			__m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[p][1]));
+			__m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[p][2]));
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+			index = _mm_or_si128(_mm_andnot_si128(closer, index), _mm_and_si128(closer, _mm_set1_epi32(p)));
+			best = _mm_min_ps(best, d);
+		}
+		_mm_storeu_si128((__m128i *)(indices + i), index);
+		total = _mm_add_ps(total, best);
+	}
+	float sums[4];
+	_mm_storeu_ps(sums, total);
+	return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+static bool haveSSE2()
+{
+	unsigned int registers[4];
+#ifdef _MSC_VER
+	__cpuid((int *)registers, 1);
+#else
+	__cpuid(1, registers[0], registers[1], registers[2], registers[3]);
+#endif
+	return (registers[3] & (1u << 26)) != 0;
+}
+
+#endif
+
+static IndexKernel chooseIndexKernel()
+{
+#ifdef BLOCK_X86
+	if (haveSSE2())
+		return closestSSE2;
+#endif
+	return closestScalar;
+}
+
+static IndexKernel closestColors()
+{
+	static const IndexKernel kernel = chooseIndexKernel();
+	return kernel;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Color block (BC1, and the color half of BC3)
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static unsigned short packColor(const float color[3])
+{
+	int r = (int)(color[0] * (31.0f / 255.0f) + 0.5f);
+	int g = (int)(color[1] * (63.0f / 255.0f) + 0.5f);
+	int b = (int)(color[2] * (31.0f / 255.0f) + 0.5f);
+	r = std::min(std::max(r, 0), 31);
+	g = std::min(std::max(g, 0), 63);
+	b = std::min(std::max(b, 0), 31);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+// Bits are replicated into the low bits, as the hardware does
+static void unpackColor(unsigned int color, float out[3])
+{
+	unsigned int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+	out[0] = (float)((r << 3) | (r >> 2));
+	out[1] = (float)((g << 2) | (g >> 4));
+	out[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Four color palette of two endpoints, the two others at 1/3 and 2/3
+static void colorPalette(unsigned int c0, unsigned int c1, float palette[4][3])
+{
+	unpackColor(c0, palette[0]);
+	unpackColor(c1, palette[1]);
+	for (int k = 0; k < 3; k++){
+		palette[2][k] = (2.0f * palette[0][k] + palette[1][k]) / 3.0f;
+		palette[3][k] = (palette[0][k] + 2.0f * palette[1][k]) / 3.0f;
+	}
+}
+
+// Endpoints at the extremes of the colors along their principal axis
+static void principalEndpoints(const BlockColors & colors, float e0[3], float e1[3])
+{
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++){
+		mean[0] += colors.r[i];
+		mean[1] += colors.g[i];
+		mean[2] += colors.b[i];
+	}
+	for (int k = 0; k < 3; k++)
+		mean[k] /= 16.0f;
+
+	// Covariance : xx, xy, xz, yy, yz, zz
+	float c[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++){
+		float r = colors.r[i] - mean[0], g = colors.g[i] - mean[1], b = colors.b[i] - mean[2];
+		c[0] += r * r; c[1] += r * g; c[2] += r * b;
+		c[3] += g * g; c[4] += g * b; c[5] += b * b;
+	}
+
+	// Power iteration, starting along the luminance
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; iteration++){
+		float x = c[0] * axis[0] + c[1] * axis[1] + c[2] * axis[2];
+		float y = c[1] * axis[0] + c[3] * axis[1] + c[4] * axis[2];
+		float z = c[2] * axis[0] + c[4] * axis[1] + c[5] * axis[2];
+		float length = std::max(fabsf(x), std::max(fabsf(y), fabsf(z)));
+		if (length < 1e-6f)
+			break; // all colors (nearly) the same, keep the last axis
+		axis[0] = x / length;
+		axis[1] = y / length;
+		axis[2] = z / length;
+	}
+	float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	for (int k = 0; k < 3; k++)
+		axis[k] /= length;
+
+	float minT = 0.0f, maxT = 0.0f;
+	for (int i = 0; i < 16; i++){
+		float t = (colors.r[i] - mean[0]) * axis[0] + (colors.g[i] - mean[1]) * axis[1] + (colors.b[i] - mean[2]) * axis[2];
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+	for (int k = 0; k < 3; k++){
+		e0[k] = mean[k] + axis[k] * maxT;
+		e1[k] = mean[k] + axis[k] * minT;
+	}
+}
+
+// Endpoints with the least squared error for the given indices
+static bool leastSquaresEndpoints(const BlockColors & colors, const unsigned int * indices, float e0[3], float e1[3])
+{
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f }; // of e0 per index
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++){
+		float a = weights[indices[i]], b = 1.0f - a;
+		float pixel[3] = { colors.r[i], colors.g[i], colors.b[i] };
+		aa += a * a; ab += a * b; bb += b * b;
+		for (int k = 0; k < 3; k++){
+			ax[k] += a * pixel[k];
+			bx[k] += b * pixel[k];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) < 1e-6f)
+		return false;
+	for (int k = 0; k < 3; k++){
+		e0[k] = (ax[k] * bb - bx[k] * ab) / determinant;
+		e1[k] = (bx[k] * aa - ax[k] * ab) / determinant;
+	}
+	return true;
+}
+
+// Always four colors (c0 > c1), BC3 ignores the order anyway
+static void compressColors(const unsigned char * pixels, unsigned char * out)
+{
+	BlockColors colors;
+	for (int i = 0; i < 16; i++){
+		colors.r[i] = pixels[i * 4];
+		colors.g[i] = pixels[i * 4 + 1];
+		colors.b[i] = pixels[i * 4 + 2];
+	}
+
+	float e0[3], e1[3];
+	principalEndpoints(colors, e0, e1);
+
+	unsigned int bestC0 = 0, bestC1 = 0, bestIndices[16] = { 0 };
+	float bestError = 1e30f;
+	for (int iteration = 0; iteration < 2; iteration++){
+		unsigned int c0 = packColor(e0), c1 = packColor(e1);
+		if (c0 < c1)
+			std::swap(c0, c1);
+
+		float palette[4][3];
+		colorPalette(c0, c1, palette);
+		unsigned int indices[16];
+		float error;
+		if (c0 == c1){
+			error = closestScalar(colors, palette, indices);
+			memset(indices, 0, sizeof(indices)); // a single color, every index means c0
+		}else{
+			error = closestColors()(colors, palette, indices);
+		}
+
+		if (error < bestError){
+			bestError = error;
+			bestC0 = c0;
+			bestC1 = c1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+		if (c0 == c1 || !leastSquaresEndpoints(colors, indices, e0, e1))
+			break;
+	}
+
+	unsigned int bits = 0;
+	for (int i = 0; i < 16; i++)
+		bits |= bestIndices[i] << (i * 2);
+	out[0] = (unsigned char)bestC0; out[1] = (unsigned char)(bestC0 >> 8);
+	out[2] = (unsigned char)bestC1; out[3] = (unsigned char)(bestC1 >> 8);
+	for (int k = 0; k < 4; k++)
+		out[4 + k] = (unsigned char)(bits >> (k * 8));
+}
+
+static void decompressColors(const unsigned char * block, bool fourColors, unsigned char * out)
+{
+	unsigned int c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+	float palette[4][3];
+	colorPalette(c0, c1, palette);
+	bool transparent = !fourColors && c0 <= c1;
+	if (transparent){
+		// BC1 three color mode : the middle color and transparent black
+		for (int k = 0; k < 3; k++){
+			palette[2][k] = (palette[0][k] + palette[1][k]) / 2.0f;
+			palette[3][k] = 0.0f;
+		}
+	}
+
+	unsigned int bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned int)block[7] << 24);
+	for (int i = 0; i < 16; i++){
+		unsigned int index = (bits >> (i * 2)) & 3;
+		for (int k = 0; k < 3; k++)
+			out[i * 4 + k] = (unsigned char)(palette[index][k] + 0.5f);
+		out[i * 4 + 3] = (transparent && index == 3) ? 0 : 255;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Alpha block (BC3)
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void alphaPalette(unsigned int a0, unsigned int a1, unsigned int palette[8])
+{
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1){
+		for (unsigned int i = 1; i < 7; i++)
+			palette[i + 1] = ((7 - i) * a0 + i * a1 + 3) / 7;
+	}else{
+		for (unsigned int i = 1; i < 5; i++)
+			palette[i + 1] = ((5 - i) * a0 + i * a1 + 2) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+// Eight alpha values between the largest and the smallest alpha of the block
+static void compressAlpha(const unsigned char * pixels, unsigned char * out)
+{
+	unsigned int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; i++){
+		a0 = std::max(a0, (unsigned int)pixels[i * 4 + 3]);
+		a1 = std::min(a1, (unsigned int)pixels[i * 4 + 3]);
+	}
+
+	unsigned long long bits = 0;
+	if (a0 > a1){
+		unsigned int palette[8];
+		alphaPalette(a0, a1, palette);
+		for (int i = 0; i < 16; i++){
+			int alpha = pixels[i * 4 + 3];
+			unsigned int best = 0;
+			for (unsigned int p = 1; p < 8; p++){
+				if (abs(alpha - (int)palette[p]) < abs(alpha - (int)palette[best]))
+					best = p;
+			}
+			bits |= (unsigned long long)best << (i * 3);
+		}
+	}
+
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int k = 0; k < 6; k++)
+		out[2 + k] = (unsigned char)(bits >> (k * 8));
+}
+
+static void decompressAlpha(const unsigned char * block, unsigned char * out)
+{
+	unsigned int palette[8];
+	alphaPalette(block[0], block[1], palette);
+	unsigned long long bits = 0;
+	for (int k = 0; k < 6; k++)
+		bits |= (unsigned long long)block[2 + k] << (k * 8);
+	for (int i = 0; i < 16; i++)
+		out[i * 4 + 3] = (unsigned char)palette[(bits >> (i * 3)) & 7];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Blocks and images
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void compressBlock(const unsigned char * pixels, BlockFormat format, unsigned char * out_block)
+{
+	if (format == BLOCK_BC1){
+		compressColors(pixels, out_block);
+	}else{
+		compressAlpha(pixels, out_block);
+		compressColors(pixels, out_block + 8);
+	}
+}
+
+void decompressBlock(const unsigned char * block, BlockFormat format, unsigned char * out_pixels)
+{
+	if (format == BLOCK_BC1){
+		decompressColors(block, false, out_pixels);
+	}else{
+		decompressColors(block + 8, true, out_pixels);
+		decompressAlpha(block, out_pixels);
+	}
+}
+
+void compressImage(const Image & image, BlockFormat format, std::vector<unsigned char> & out_blocks)
+{
+	unsigned int blocksX = (image.width + 3) / 4, blocksY = (image.height + 3) / 4;
+	unsigned int bytes = blockBytes(format);
+	out_blocks.resize((size_t)blocksX * blocksY * bytes);
+
+	unsigned char * blocks = &out_blocks[0];
+	parallelFor(blocksY, [&image, format, blocksX, bytes, blocks](size_t by){
+		unsigned char pixels[64];
+		for (unsigned int bx = 0; bx < blocksX; bx++){
+			for (unsigned int y = 0; y < 4; y++){
+				unsigned int sy = std::min((unsigned int)by * 4 + y, image.height - 1);
+				for (unsigned int x = 0; x < 4; x++){
+					unsigned int sx = std::min(bx * 4 + x, image.width - 1);
+					memcpy(pixels + (y * 4 + x) * 4, &image.pixels[((size_t)sy * image.width + sx) * 4], 4);
+				}
+			}
+			compressBlock(pixels, format, blocks + (by * blocksX + bx) * bytes);
+		}
+	});
+}
+
+// Root mean square error per channel of the compressed image against the original
+static double compressionError(const Image & image, BlockFormat format, const std::vector<unsigned char> & blocks)
+{
+	unsigned int blocksX = (image.width + 3) / 4;
+	unsigned int bytes = blockBytes(format);
+	int channels = format == BLOCK_BC1 ? 3 : 4;
+	double sum = 0.0;
+	unsigned char pixels[64];
+	for (unsigned int y = 0; y < image.height; y++){
+		for (unsigned int x = 0; x < image.width; x++){
+			if (x % 4 == 0)
+				decompressBlock(&blocks[((y / 4) * blocksX + x / 4) * bytes], format, pixels);
+			const unsigned char * decoded = pixels + ((y % 4) * 4 + x % 4) * 4;
+			const unsigned char * original = &image.pixels[((size_t)y * image.width + x) * 4];
+			for (int c = 0; c < channels; c++)
+				sum += (double)(decoded[c] - original[c]) * (decoded[c] - original[c]);
+		}
+	}
+	return sqrt(sum / ((double)image.width * image.height * channels));
+}
+
+static void writeU32(unsigned char * p, unsigned int value)
+{
+	for (int k = 0; k < 4; k++)
+		p[k] = (unsigned char)(value >> (k * 8));
+}
+
+static bool writeDDSLevels(const char * path, const MipChain & chain, BlockFormat format, const std::vector<std::vector<unsigned char> > & levels)
+{
+	// "DDS " and DDS_HEADER, the offsets are the ones loadDDS reads
+	unsigned char header[128];
+	memset(header, 0, sizeof(header));
+	memcpy(header, "DDS ", 4);
+	unsigned char * dds = header + 4;
+	writeU32(dds + 0, 124);
+	writeU32(dds + 4, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000); // caps, height, width, pixel format, mip count, linear size
+	writeU32(dds + 8, chain.levels[0].height);
+	writeU32(dds + 12, chain.levels[0].width);
+	writeU32(dds + 16, (unsigned int)levels[0].size());
+	writeU32(dds + 24, (unsigned int)levels.size());
+	writeU32(dds + 72, 32);  // pixel format size
+	writeU32(dds + 76, 0x4); // DDPF_FOURCC
+	writeU32(dds + 80, format == BLOCK_BC1 ? FOURCC_DXT1 : FOURCC_DXT5);
+	writeU32(dds + 104, 0x1000 | 0x8 | 0x400000); // texture, complex, mipmap
+
+	FILE * file = fopen(path, "wb");
+	if (!file){
+		printf("Could not write %s\n", path);
+		return false;
+	}
+	bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+	for (size_t i = 0; i < levels.size() && ok; i++)
+		ok = fwrite(&levels[i][0], 1, levels[i].size(), file) == levels[i].size();
+	if (fclose(file) != 0)
+		ok = false;
+	if (!ok)
+		printf("Could not write %s\n", path);
+	return ok;
+}
+
+bool writeDDS(const char * path, const MipChain & chain, BlockFormat format)
+{
+	std::vector<std::vector<unsigned char> > levels(chain.levels.size());
+	for (size_t i = 0; i < chain.levels.size(); i++)
+		compressImage(chain.levels[i], format, levels[i]);
+	return writeDDSLevels(path, chain, format, levels);
+}
+
+bool convertBMPToDDS(const char * bmpPath, const char * ddsPath, BlockFormat format)
+{
+	MipChain chain;
+	if (!readBMPMipmapped(bmpPath, chain))
+		return false;
+
+	size_t uncompressed = 0, compressed = 0;
+	std::vector<std::vector<unsigned char> > levels(chain.levels.size());
+	for (size_t i = 0; i < chain.levels.size(); i++){
+		compressImage(chain.levels[i], format, levels[i]);
+		uncompressed += chain.levels[i].pixels.size();
+		compressed += levels[i].size();
+	}
+
+	printf("Compressed %s to %s : %ux%u, %u levels, %.1f KiB -> %.1f KiB, RMS error %.2f\n",
+		bmpPath, format == BLOCK_BC1 ? "BC1" : "BC3", chain.levels[0].width, chain.levels[0].height,
+		(unsigned int)levels.size(), uncompressed / 1024.0, compressed / 1024.0,
+		compressionError(chain.levels[0], format, levels[0]));
+	return writeDDSLevels(ddsPath, chain, format, levels);
+}
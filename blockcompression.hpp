@@ -0,0 +1,40 @@
+#ifndef BLOCKCOMPRESSION_HPP
+#define BLOCKCOMPRESSION_HPP
+
+#include <vector>
+
+#include "image.hpp"
+
+// BC1 (DXT1) and BC3 (DXT5) encoder for DDS files that loadDDS reads (see texture.hpp).
+// A 4x4 block of RGBA pixels becomes 8 (BC1, no alpha) or 16 bytes (BC3), a quarter or half
+// of RGBA8 in memory and bandwidth on the GPU.
+//
+// Color endpoints lie on the principal axis of the block's colors, are refined once with
+// least squares and then quantized to 5:6:5. The closest palette entry for each pixel is found
+// with SSE2.
+
+enum BlockFormat
+{
+	BLOCK_BC1,
+	BLOCK_BC3
+};
+
+// 8 or 16
+unsigned int blockBytes(BlockFormat format);
+
+// "pixels" are 16 RGBA pixels, four rows of four
+void compressBlock(const unsigned char * pixels, BlockFormat format, unsigned char * out_block);
+void decompressBlock(const unsigned char * block, BlockFormat format, unsigned char * out_pixels);
+
+// Blocks row by row, the last row and column are repeated to fill blocks at the edges.
+// Block rows are compressed in parallel (see parallelFor).
+void compressImage(const Image & image, BlockFormat format, std::vector<unsigned char> & out_blocks);
+
+// Writes all levels as DXT1 or DXT5 DDS file. The rows stay in OpenGL order (bottom up), so
+// the texture looks like the one from loadBMP_custom, other viewers show it upside down.
+bool writeDDS(const char * path, const MipChain & chain, BlockFormat format);
+
+// readBMPMipmapped, compression and writeDDS in one, prints the error of the first level
+bool convertBMPToDDS(const char * bmpPath, const char * ddsPath, BlockFormat format);
+
+#endif
@@ -0,0 +1,380 @@
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode must not contain padding");
+
+// Deeper subtrees become leaves, so a fixed size traversal stack is always big enough
+#define BVH_MAX_DEPTH 64
+#define BVH_BINS      16
+
+static float surfaceArea(const glm::vec3 & boxMin, const glm::vec3 & boxMax)
+{
+	glm::vec3 extent = glm::max(boxMax - boxMin, glm::vec3(0.0f));
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+static void updateNodeBounds(Bvh & bvh, unsigned int nodeIndex, const glm::vec3 * boxMin, const glm::vec3 * boxMax)
+{
+	BvhNode & node = bvh.nodes[nodeIndex];
+	node.boundsMin = glm::vec3(1e30f);
+	node.boundsMax = glm::vec3(-1e30f);
+	for (unsigned int i = node.firstOrLeft; i < node.firstOrLeft + node.count; i++){
+		unsigned int primitive = bvh.primitives[i];
+		node.boundsMin = glm::min(node.boundsMin, boxMin[primitive]);
+		node.boundsMax = glm::max(node.boundsMax, boxMax[primitive]);
+	}
+}
+
+struct BvhBin
+{
+	glm::vec3 boundsMin, boundsMax;
+	unsigned int count;
+};
+
+static void subdivide(Bvh & bvh, unsigned int nodeIndex, const glm::vec3 * boxMin, const glm::vec3 * boxMax,
+	const std::vector<glm::vec3> & centroids, int depth)
+{
+	BvhNode node = bvh.nodes[nodeIndex];
+	if (node.count <= 1 || depth >= BVH_MAX_DEPTH)
+		return;
+
+	glm::vec3 centroidMin(1e30f), centroidMax(-1e30f);
+	for (unsigned int i = node.firstOrLeft; i < node.firstOrLeft + node.count; i++){
+		centroidMin = glm::min(centroidMin, centroids[bvh.primitives[i]]);
+		centroidMax = glm::max(centroidMax, centroids[bvh.primitives[i]]);
+	}
+
+	// Binned SAH : the primitives are sorted into bins along each axis by their centroid, the
+	// best split between two bins is the one with the smallest sum of count * area on both sides
+	int bestAxis = -1, bestSplit = 0;
+	float bestCost = node.count * surfaceArea(node.boundsMin, node.boundsMax); // as a leaf
+
+	for (int axis = 0; axis < 3; axis++){
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0.0f)
+			continue;
+
+		BvhBin bins[BVH_BINS];
+		for (int b = 0; b < BVH_BINS; b++){
+			bins[b].boundsMin = glm::vec3(1e30f);
+			bins[b].boundsMax = glm::vec3(-1e30f);
+			bins[b].count = 0;
+		}
+
+		float scale = BVH_BINS / extent;
+		for (unsigned int i = node.firstOrLeft; i < node.firstOrLeft + node.count; i++){
+			unsigned int primitive = bvh.primitives[i];
+			int b = std::min(BVH_BINS - 1, (int)((centroids[primitive][axis] - centroidMin[axis]) * scale));
+			bins[b].count++;
+			bins[b].boundsMin = glm::min(bins[b].boundsMin, boxMin[primitive]);
+			bins[b].boundsMax = glm::max(bins[b].boundsMax, boxMax[primitive]);
+		}
+
+		// Count and area left of every split plane, then sweep from the right
+		float leftArea[BVH_BINS - 1];
+		unsigned int leftCount[BVH_BINS - 1];
+		glm::vec3 sweepMin(1e30f), sweepMax(-1e30f);
+		unsigned int sweepCount = 0;
+		for (int b = 0; b < BVH_BINS - 1; b++){
+			sweepCount += bins[b].count;
+			sweepMin = glm::min(sweepMin, bins[b].boundsMin);
+			sweepMax = glm::max(sweepMax, bins[b].boundsMax);
+			leftCount[b] = sweepCount;
+			leftArea[b] = surfaceArea(sweepMin, sweepMax);
+		}
+
+		sweepMin = glm::vec3(1e30f);
+		sweepMax = glm::vec3(-1e30f);
+		sweepCount = 0;
+		for (int b = BVH_BINS - 1; b > 0; b--){
+			sweepCount += bins[b].count;
+			sweepMin = glm::min(sweepMin, bins[b].boundsMin);
+			sweepMax = glm::max(sweepMax, bins[b].boundsMax);
+			if (leftCount[b - 1] == 0 || sweepCount == 0)
+				continue;
+			float cost = leftCount[b - 1] * leftArea[b - 1] + sweepCount * surfaceArea(sweepMin, sweepMax);
+			if (cost < bestCost){
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b;
+			}
+		}
+	}
+
+	if (bestAxis < 0)
+		return; // cheaper as a leaf
+
+	float scale = BVH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+	unsigned int * first = &bvh.primitives[node.firstOrLeft];
+	unsigned int * middle = std::partition(first, first + node.count, [&](unsigned int primitive){
+		int b = std::min(BVH_BINS - 1, (int)((centroids[primitive][bestAxis] - centroidMin[bestAxis]) * scale));
+		return b < bestSplit;
+	});
+	unsigned int leftCount = (unsigned int)(middle - first);
+	if (leftCount == 0 || leftCount == node.count)
+		return;
+
+	unsigned int left = (unsigned int)bvh.nodes.size();
+	BvhNode child;
+	child.firstOrLeft = node.firstOrLeft;
+	child.count = leftCount;
+	bvh.nodes.push_back(child);
+	child.firstOrLeft = node.firstOrLeft + leftCount;
+	child.count = node.count - leftCount;
+	bvh.nodes.push_back(child);
+
+	bvh.nodes[nodeIndex].firstOrLeft = left;
+	bvh.nodes[nodeIndex].count = 0;
+
+	updateNodeBounds(bvh, left, boxMin, boxMax);
+	updateNodeBounds(bvh, left + 1, boxMin, boxMax);
+	subdivide(bvh, left, boxMin, boxMax, centroids, depth + 1);
+	subdivide(bvh, left + 1, boxMin, boxMax, centroids, depth + 1);
+}
+
+void buildBvh(Bvh & bvh, const glm::vec3 * boxMin, const glm::vec3 * boxMax, size_t count)
+{
+	bvh.nodes.clear();
+	bvh.primitives.resize(count);
+	if (count == 0)
+		return;
+
+	std::vector<glm::vec3> centroids(count);
+	for (size_t i = 0; i < count; i++){
+		bvh.primitives[i] = (unsigned int)i;
+		centroids[i] = (boxMin[i] + boxMax[i]) * 0.5f;
+	}
+
+	bvh.nodes.reserve(count * 2 - 1);
+	BvhNode root;
+	root.firstOrLeft = 0;
+	root.count = (unsigned int)count;
+	bvh.nodes.push_back(root);
+	updateNodeBounds(bvh, 0, boxMin, boxMax);
+	subdivide(bvh, 0, boxMin, boxMax, centroids, 0);
+}
+
+void refitBvh(Bvh & bvh, const glm::vec3 * boxMin, const glm::vec3 * boxMax)
+{
+	// Children are always behind their parent, so walking backwards visits them first
+	for (size_t i = bvh.nodes.size(); i-- > 0;){
+		BvhNode & node = bvh.nodes[i];
+		if (node.count){
+			updateNodeBounds(bvh, (unsigned int)i, boxMin, boxMax);
+		}else{
+			const BvhNode & left = bvh.nodes[node.firstOrLeft];
+			const BvhNode & right = bvh.nodes[node.firstOrLeft + 1];
+			node.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+			node.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+		}
+	}
+}
+
+void queryBvh(const Bvh & bvh, const glm::vec3 * boxMin, const glm::vec3 * boxMax, const Frustum & frustum,
+	std::vector<unsigned int> & out_primitives)
+{
+	if (bvh.nodes.empty())
+		return;
+
+	// A node completely inside the frustum needs no further tests below it
+	unsigned int stack[BVH_MAX_DEPTH + 2];
+	bool inside[BVH_MAX_DEPTH + 2];
+	int size = 0;
+	stack[size] = 0;
+	inside[size++] = false;
+
+	while (size > 0){
+		size--;
+		const BvhNode & node = bvh.nodes[stack[size]];
+		bool nodeInside = inside[size];
+		if (!nodeInside){
+			FrustumOverlap overlap = classifyBox(frustum, node.boundsMin, node.boundsMax);
+			if (overlap == FRUSTUM_OUTSIDE)
+				continue;
+			nodeInside = overlap == FRUSTUM_INSIDE;
+		}
+
+		if (node.count){
+			for (unsigned int i = node.firstOrLeft; i < node.firstOrLeft + node.count; i++){
+				unsigned int primitive = bvh.primitives[i];
+				if (nodeInside || classifyBox(frustum, boxMin[primitive], boxMax[primitive]) != FRUSTUM_OUTSIDE)
+					out_primitives.push_back(primitive);
+			}
+		}else{
+			stack[size] = node.firstOrLeft + 1;
+			inside[size++] = nodeInside;
+			stack[size] = node.firstOrLeft;
+			inside[size++] = nodeInside;
+		}
+	}
+}
+
+// Distance along the ray to the box, false if it is missed or farther than maxT
+static bool rayHitsBox(const BvhNode & node, const glm::vec3 & origin, const glm::vec3 & inverseDirection, float maxT, float & t)
+{
+	glm::vec3 t1 = (node.boundsMin - origin) * inverseDirection;
+	glm::vec3 t2 = (node.boundsMax - origin) * inverseDirection;
+	glm::vec3 nearT = glm::min(t1, t2), farT = glm::max(t1, t2);
+	float enter = glm::max(glm::max(nearT.x, nearT.y), glm::max(nearT.z, 0.0f));
+	float exit = glm::min(glm::min(farT.x, farT.y), glm::min(farT.z, maxT));
+	t = enter;
+	return enter <= exit;
+}
+
+bool raycastBox(const glm::vec3 & boxMin, const glm::vec3 & boxMax, const glm::vec3 & origin, const glm::vec3 & direction, float & t)
+{
+	BvhNode node;
+	node.boundsMin = boxMin;
+	node.boundsMax = boxMax;
+	float distance;
+	if (!rayHitsBox(node, origin, 1.0f / direction, t, distance))
+		return false;
+	t = distance;
+	return true;
+}
+
+bool raycastSphere(const glm::vec3 & center, float radius, const glm::vec3 & origin, const glm::vec3 & direction, float & t)
+{
+	glm::vec3 offset = origin - center;
+	float a = glm::dot(direction, direction);
+	float b = glm::dot(offset, direction);
+	float c = glm::dot(offset, offset) - radius * radius;
+	float discriminant = b * b - a * c;
+	if (a <= 0.0f || discriminant < 0.0f)
+		return false;
+
+	float root = sqrtf(discriminant);
+	float distance = (-b - root) / a;
+	if (distance < 0.0f)
+		distance = (-b + root) / a; // origin inside the sphere
+	if (distance < 0.0f || distance > t)
+		return false;
+	t = distance;
+	return true;
+}
+
+bool raycastBvh(const Bvh & bvh, const glm::vec3 & origin, const glm::vec3 & direction, BvhRayFunction hit, void * user,
+	float maxT, float & out_t, unsigned int & out_primitive)
+{
+	if (bvh.nodes.empty())
+		return false;
+
+	glm::vec3 inverseDirection = 1.0f / direction;
+	float closest = maxT;
+	bool found = false;
+
+	float t;
+	if (!rayHitsBox(bvh.nodes[0], origin, inverseDirection, closest, t))
+		return false;
+
+	unsigned int stack[BVH_MAX_DEPTH + 2];
+	float stackT[BVH_MAX_DEPTH + 2];
+	int size = 0;
+	stack[size] = 0;
+	stackT[size++] = t;
+
+	while (size > 0){
+		size--;
+		if (stackT[size] > closest)
+			continue; // something closer was hit since the node was pushed
+		const BvhNode & node = bvh.nodes[stack[size]];
+
+		if (node.count){
+			for (unsigned int i = node.firstOrLeft; i < node.firstOrLeft + node.count; i++){
+				float primitiveT = closest;
+				if (hit(user, bvh.primitives[i], origin, direction, primitiveT) && primitiveT <= closest){
+					closest = primitiveT;
+					out_primitive = bvh.primitives[i];
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		// The nearer child is pushed last and visited first
+		unsigned int left = node.firstOrLeft, right = node.firstOrLeft + 1;
+		float leftT, rightT;
+		bool hitLeft = rayHitsBox(bvh.nodes[left], origin, inverseDirection, closest, leftT);
+		bool hitRight = rayHitsBox(bvh.nodes[right], origin, inverseDirection, closest, rightT);
+		if (hitLeft && hitRight && leftT > rightT){
+			std::swap(left, right);
+			std::swap(leftT, rightT);
+		}else if (!hitLeft && hitRight){
+			left = right;
+			leftT = rightT;
+			hitLeft = true;
+			hitRight = false;
+		}
+		if (hitRight){
+			stack[size] = right;
+			stackT[size++] = rightT;
+		}
+		if (hitLeft){
+			stack[size] = left;
+			stackT[size++] = leftT;
+		}
+	}
+
+	if (found)
+		out_t = closest;
+	return found;
+}
+
+void buildTriangleBvh(TriangleBvh & triangles, std::vector<glm::vec3> & positions, std::vector<unsigned int> & indices)
+{
+	triangles.positions.swap(positions);
+	triangles.indices.swap(indices);
+
+	size_t count = triangles.indices.size() / 3;
+	std::vector<glm::vec3> boxMin(count), boxMax(count);
+	for (size_t i = 0; i < count; i++){
+		const glm::vec3 & a = triangles.positions[triangles.indices[i * 3]];
+		const glm::vec3 & b = triangles.positions[triangles.indices[i * 3 + 1]];
+		const glm::vec3 & c = triangles.positions[triangles.indices[i * 3 + 2]];
+		boxMin[i] = glm::min(a, glm::min(b, c));
+		boxMax[i] = glm::max(a, glm::max(b, c));
+	}
+	buildBvh(triangles.bvh, count ? &boxMin[0] : NULL, count ? &boxMax[0] : NULL, count);
+}
+
+// Moeller-Trumbore, both sides of the triangle count
+static bool hitTriangle(void * user, unsigned int triangle, const glm::vec3 & origin, const glm::vec3 & direction, float & t)
+{
+	const TriangleBvh & triangles = *(const TriangleBvh *)user;
+	const glm::vec3 & a = triangles.positions[triangles.indices[triangle * 3]];
+	const glm::vec3 & b = triangles.positions[triangles.indices[triangle * 3 + 1]];
+	const glm::vec3 & c = triangles.positions[triangles.indices[triangle * 3 + 2]];
+
+	glm::vec3 edge1 = b - a, edge2 = c - a;
+	glm::vec3 p = glm::cross(direction, edge2);
+	float determinant = glm::dot(edge1, p);
+	if (fabsf(determinant) < 1e-12f)
+		return false;
+
+	float inverse = 1.0f / determinant;
+	glm::vec3 s = origin - a;
+	float u = glm::dot(s, p) * inverse;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+	glm::vec3 q = glm::cross(s, edge1);
+	float v = glm::dot(direction, q) * inverse;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	float distance = glm::dot(edge2, q) * inverse;
+	if (distance < 0.0f || distance > t)
+		return false;
+	t = distance;
+	return true;
+}
+
+bool raycastTriangles(const TriangleBvh & triangles, const glm::vec3 & origin, const glm::vec3 & direction,
+	float maxT, float & out_t, unsigned int & out_triangle)
+{
+	return raycastBvh(triangles.bvh, origin, direction, hitTriangle, (void *)&triangles, maxT, out_t, out_triangle);
+}
@@ -0,0 +1,66 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <stddef.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "culling.hpp"
+
+// Bounding volume hierarchy over axis aligned boxes (scene nodes, triangles of a mesh, ...),
+// built with the surface area heuristic. The nodes are stored depth first in one array, the
+// two children of a node are always next to each other and behind their parent.
+
+// 32 bytes, two nodes per cache line
+struct BvhNode
+{
+	glm::vec3 boundsMin;
+	unsigned int firstOrLeft; // leaf : first entry in Bvh::primitives, inner node : left child (right = left + 1)
+	glm::vec3 boundsMax;
+	unsigned int count;       // primitives in a leaf, 0 for inner nodes
+};
+
+struct Bvh
+{
+	std::vector<BvhNode> nodes;
+	std::vector<unsigned int> primitives; // indices of the boxes passed to buildBvh, grouped by leaf
+};
+
+void buildBvh(Bvh & bvh, const glm::vec3 * boxMin, const glm::vec3 * boxMax, size_t count);
+
+// New boxes for the same primitives (e.g. after the scene moved), the tree keeps its shape.
+// Much cheaper than buildBvh, but the tree gets worse if the primitives move a lot.
+void refitBvh(Bvh & bvh, const glm::vec3 * boxMin, const glm::vec3 * boxMax);
+
+// Appends all primitives whose box is at least partly inside the frustum (same boxes as for buildBvh/refitBvh)
+void queryBvh(const Bvh & bvh, const glm::vec3 * boxMin, const glm::vec3 * boxMax, const Frustum & frustum,
+	std::vector<unsigned int> & out_primitives);
+
+// Tests the ray origin + t * direction against one primitive. Must return true and set t if it
+// is hit closer than the t passed in.
+typedef bool (*BvhRayFunction)(void * user, unsigned int primitive, const glm::vec3 & origin, const glm::vec3 & direction, float & t);
+
+// Ray against a box or sphere, for BvhRayFunction implementations. Same rules as BvhRayFunction.
+bool raycastBox(const glm::vec3 & boxMin, const glm::vec3 & boxMax, const glm::vec3 & origin, const glm::vec3 & direction, float & t);
+bool raycastSphere(const glm::vec3 & center, float radius, const glm::vec3 & origin, const glm::vec3 & direction, float & t);
+
+// Closest hit along the ray up to maxT, only the primitives of boxes hit by the ray are tested
+bool raycastBvh(const Bvh & bvh, const glm::vec3 & origin, const glm::vec3 & direction, BvhRayFunction hit, void * user,
+	float maxT, float & out_t, unsigned int & out_primitive);
+
+// Triangles of one mesh (see readMeshGeometry)
+struct TriangleBvh
+{
+	Bvh bvh;
+	std::vector<glm::vec3> positions;
+	std::vector<unsigned int> indices; // three per triangle
+};
+
+// Takes over the contents of positions and indices
+void buildTriangleBvh(TriangleBvh & triangles, std::vector<glm::vec3> & positions, std::vector<unsigned int> & indices);
+
+bool raycastTriangles(const TriangleBvh & triangles, const glm::vec3 & origin, const glm::vec3 & direction,
+	float maxT, float & out_t, unsigned int & out_triangle);
+
+#endif
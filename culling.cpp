@@ -0,0 +1,198 @@
+#include <math.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "culling.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CULLING_SSE 1
+#include <xmmintrin.h>
+#endif
+
+#if defined(CULLING_SSE) && defined(__GNUC__)
+#define TARGET_SSE __attribute__((target("sse")))
+#else
+#define TARGET_SSE
+#endif
+
+static CullingStatistics statistics = { 0, 0 };
+
+Bounds computeBounds(const std::vector<glm::vec3> & vertices)
+{
+	Bounds bounds;
+	bounds.min = bounds.max = bounds.center = glm::vec3(0.0f);
+	bounds.radius = 0.0f;
+	if (vertices.empty())
+		return bounds;
+
+	bounds.min = bounds.max = vertices[0];
+	for (size_t i = 1; i < vertices.size(); i++){
+		bounds.min = glm::min(bounds.min, vertices[i]);
+		bounds.max = glm::max(bounds.max, vertices[i]);
+	}
+
+	// Through the vertex farthest from the centre, tighter than half the diagonal
+	bounds.center = (bounds.min + bounds.max) * 0.5f;
+	for (size_t i = 0; i < vertices.size(); i++)
+		bounds.radius = glm::max(bounds.radius, glm::length(vertices[i] - bounds.center));
+	return bounds;
+}
+
+void transformSphere(const glm::mat4 & world, const glm::vec3 & center, float radius, glm::vec3 & out_center, float & out_radius)
+{
+	out_center = glm::vec3(world * glm::vec4(center, 1.0f));
+	float scale = glm::max(glm::length(glm::vec3(world[0])), glm::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+	out_radius = radius * scale;
+}
+
+void transformBox(const glm::mat4 & world, const glm::vec3 & boxMin, const glm::vec3 & boxMax, glm::vec3 & out_min, glm::vec3 & out_max)
+{
+	// Per axis the smaller product goes to the minimum, the larger to the maximum (Arvo)
+	glm::vec3 translation(world[3]);
+	out_min = out_max = translation;
+	for (int column = 0; column < 3; column++){
+		glm::vec3 a = glm::vec3(world[column]) * boxMin[column];
+		glm::vec3 b = glm::vec3(world[column]) * boxMax[column];
+		out_min += glm::min(a, b);
+		out_max += glm::max(a, b);
+	}
+}
+
+Frustum extractFrustum(const glm::mat4 & viewProjection)
+{
+	// Rows of the matrix (glm stores columns)
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0];
+	frustum.planes[1] = rows[3] - rows[0];
+	frustum.planes[2] = rows[3] + rows[1];
+	frustum.planes[3] = rows[3] - rows[1];
+	frustum.planes[4] = rows[3] + rows[2];
+	frustum.planes[5] = rows[3] - rows[2];
+
+	for (int i = 0; i < 6; i++){
+		float length = glm::length(glm::vec3(frustum.planes[i]));
+		if (length > 0.0f)
+			frustum.planes[i] /= length;
+	}
+	return frustum;
+}
+
+bool sphereInFrustum(const Frustum & frustum, const glm::vec3 & center, float radius)
+{
+	statistics.tested++;
+	for (int i = 0; i < 6; i++){
+		const glm::vec4 & plane = frustum.planes[i];
+		if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius)
+			return false;
+	}
+	statistics.visible++;
+	return true;
+}
+
+FrustumOverlap classifyBox(const Frustum & frustum, const glm::vec3 & boxMin, const glm::vec3 & boxMax)
+{
+	FrustumOverlap overlap = FRUSTUM_INSIDE;
+	for (int i = 0; i < 6; i++){
+		const glm::vec4 & plane = frustum.planes[i];
+
+		// Corner farthest along the plane normal, and the opposite one
+		glm::vec3 positive(plane.x >= 0.0f ? boxMax.x : boxMin.x, plane.y >= 0.0f ? boxMax.y : boxMin.y, plane.z >= 0.0f ? boxMax.z : boxMin.z);
+		glm::vec3 negative(plane.x >= 0.0f ? boxMin.x : boxMax.x, plane.y >= 0.0f ? boxMin.y : boxMax.y, plane.z >= 0.0f ? boxMin.z : boxMax.z);
+		if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+			return FRUSTUM_OUTSIDE;
+		if (glm::dot(glm::vec3(plane), negative) + plane.w < 0.0f)
+			overlap = FRUSTUM_INTERSECTS;
+	}
+	return overlap;
+}
+
+#ifdef CULLING_SSE
+
+TARGET_SSE static size_t cullSpheresSSE(const Frustum & frustum, const float * x, const float * y, const float * z, const float * radius,
+	unsigned char * visible, size_t count)
+{
+	size_t visibleCount = 0;
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4){
+		__m128 px = _mm_loadu_ps(x + i);
+		__m128 py = _mm_loadu_ps(y + i);
+		__m128 pz = _mm_loadu_ps(z + i);
+		__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+
+		// Bits stay set for spheres that are inside or intersect all planes so far
+		__m128 inside = _mm_cmpeq_ps(px, px);
+		for (int p = 0; p < 6; p++){
+			const glm::vec4 & plane = frustum.planes[p];
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(px, _mm_set1_ps(plane.x)),
+				_mm_mul_ps(py, _mm_set1_ps(plane.y))),
+				_mm_mul_ps(pz, _mm_set1_ps(plane.z))),
+				_mm_set1_ps(plane.w));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int k = 0; k < 4; k++){
+			visible[i + k] = (unsigned char)((mask >> k) & 1);
+			visibleCount += visible[i + k];
+		}
+	}
+
+	for (; i < count; i++){
+		glm::vec3 center(x[i], y[i], z[i]);
+		bool in = true;
+		for (int p = 0; p < 6 && in; p++){
+			const glm::vec4 & plane = frustum.planes[p];
+			in = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w >= -radius[i];
+		}
+		visible[i] = in ? 1 : 0;
+		visibleCount += visible[i];
+	}
+	return visibleCount;
+}
+
+#endif
+
+size_t cullSpheres(const Frustum & frustum, const float * x, const float * y, const float * z, const float * radius,
+	unsigned char * visible, size_t count)
+{
+	size_t visibleCount = 0;
+#ifdef CULLING_SSE
+	visibleCount = cullSpheresSSE(frustum, x, y, z, radius, visible, count);
+#else
+	for (size_t i = 0; i < count; i++){
+		bool in = true;
+		for (int p = 0; p < 6 && in; p++){
+			const glm::vec4 & plane = frustum.planes[p];
+			in = plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w >= -radius[i];
+		}
+		visible[i] = in ? 1 : 0;
+		visibleCount += visible[i];
+	}
+#endif
+	statistics.tested += count;
+	statistics.visible += visibleCount;
+	return visibleCount;
+}
+
+CullingStatistics getCullingStatistics()
+{
+	return statistics;
+}
+
+void resetCullingStatistics()
+{
+	statistics.tested = 0;
+	statistics.visible = 0;
+}
+
+void addCullingStatistics(size_t tested, size_t visible)
+{
+	statistics.tested += tested;
+	statistics.visible += visible;
+}
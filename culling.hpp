@@ -0,0 +1,66 @@
+#ifndef CULLING_HPP
+#define CULLING_HPP
+
+#include <stddef.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Frustum culling with bounding spheres. The planes come from Projection * View, draws whose
+// sphere lies completely outside one of them are skipped before anything is sent to OpenGL.
+
+struct Bounds
+{
+	glm::vec3 min, max;  // axis aligned box
+	glm::vec3 center;    // sphere around the centre of the box
+	float radius;
+};
+
+// Box and sphere of a point set, all zero for an empty set
+Bounds computeBounds(const std::vector<glm::vec3> & vertices);
+
+// Bounding sphere after transforming with "world" (scaling grows the radius)
+void transformSphere(const glm::mat4 & world, const glm::vec3 & center, float radius, glm::vec3 & out_center, float & out_radius);
+
+// Axis aligned box around the transformed box
+void transformBox(const glm::mat4 & world, const glm::vec3 & boxMin, const glm::vec3 & boxMax, glm::vec3 & out_min, glm::vec3 & out_max);
+
+// Planes as (normal, distance), normalised, pointing inwards: inside if dot(normal, p) + distance >= 0
+struct Frustum
+{
+	glm::vec4 planes[6]; // left, right, bottom, top, near, far
+};
+
+Frustum extractFrustum(const glm::mat4 & viewProjection);
+
+bool sphereInFrustum(const Frustum & frustum, const glm::vec3 & center, float radius);
+
+enum FrustumOverlap
+{
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE
+};
+
+// Box against all planes, not counted in the statistics (used for BVH nodes)
+FrustumOverlap classifyBox(const Frustum & frustum, const glm::vec3 & boxMin, const glm::vec3 & boxMax);
+
+// Tests count spheres given as separate arrays (four at a time with SSE), writes 1 for every
+// visible sphere and 0 for every culled one. Returns the number of visible spheres.
+size_t cullSpheres(const Frustum & frustum, const float * x, const float * y, const float * z, const float * radius,
+	unsigned char * visible, size_t count);
+
+struct CullingStatistics
+{
+	unsigned long long tested;
+	unsigned long long visible;
+};
+
+// Counters of all sphereInFrustum and cullSpheres calls
+CullingStatistics getCullingStatistics();
+void resetCullingStatistics();
+
+// For culling done elsewhere (e.g. queryBvh in drawScene)
+void addCullingStatistics(size_t tested, size_t visible);
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "glstate.hpp"
+
+// ~0 means unknown, 0 is a valid binding
+static const GLuint unknown = ~0u;
+
+static GLuint currentProgram = unknown;
+static GLuint currentVertexArray = unknown;
+static GLuint activeUnit = unknown;
+static GLuint currentTextures[STATE_TEXTURE_UNITS];
+static GLenum currentTargets[STATE_TEXTURE_UNITS];
+static bool texturesValid = false;
+
+static StateStatistics frameStatistics, lastFrameStatistics, totalStatistics;
+static unsigned int frames = 0;
+
+void useProgram(GLuint program)
+{
+	frameStatistics.programBinds++;
+	if (program == currentProgram)
+		return;
+	glUseProgram(program);
+	currentProgram = program;
+	frameStatistics.programChanges++;
+}
+
+void bindVertexArray(GLuint vertexArray)
+{
+	frameStatistics.vertexArrayBinds++;
+	if (vertexArray == currentVertexArray)
+		return;
+	glBindVertexArray(vertexArray);
+	currentVertexArray = vertexArray;
+	frameStatistics.vertexArrayChanges++;
+}
+
+void bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	if (!texturesValid){
+		for (int i = 0; i < STATE_TEXTURE_UNITS; i++)
+			currentTextures[i] = unknown;
+		texturesValid = true;
+	}
+
+	frameStatistics.textureBinds++;
+	if (unit < STATE_TEXTURE_UNITS && currentTextures[unit] == texture && currentTargets[unit] == target)
+		return;
+
+	if (unit != activeUnit){
+		glActiveTexture(GL_TEXTURE0 + unit);
+		activeUnit = unit;
+	}
+	glBindTexture(target, texture);
+	frameStatistics.textureChanges++;
+
+	if (unit < STATE_TEXTURE_UNITS){
+		currentTextures[unit] = texture;
+		currentTargets[unit] = target;
+	}
+}
+
+void resetStateCache()
+{
+	currentProgram = unknown;
+	currentVertexArray = unknown;
+	activeUnit = unknown;
+	texturesValid = false;
+}
+
+void forgetBinding(ResourceType type, GLuint id)
+{
+	switch (type){
+	case RESOURCE_VERTEX_ARRAY:
+		if (currentVertexArray == id)
+			currentVertexArray = 0;
+		break;
+	case RESOURCE_TEXTURE:
+		if (texturesValid){
+			for (int i = 0; i < STATE_TEXTURE_UNITS; i++){
+				if (currentTextures[i] == id)
+					currentTextures[i] = 0;
+			}
+		}
+		break;
+	case RESOURCE_PROGRAM:
+		// A deleted program stays in use until another one is installed, so the cache is still right
+		break;
+	default:
+		break;
+	}
+}
+
+void countDrawCall()
+{
+	frameStatistics.drawCalls++;
+}
+
+void endStateFrame()
+{
+	totalStatistics.programBinds += frameStatistics.programBinds;
+	totalStatistics.programChanges += frameStatistics.programChanges;
+	totalStatistics.vertexArrayBinds += frameStatistics.vertexArrayBinds;
+	totalStatistics.vertexArrayChanges += frameStatistics.vertexArrayChanges;
+	totalStatistics.textureBinds += frameStatistics.textureBinds;
+	totalStatistics.textureChanges += frameStatistics.textureChanges;
+	totalStatistics.drawCalls += frameStatistics.drawCalls;
+	frames++;
+
+	lastFrameStatistics = frameStatistics;
+	memset(&frameStatistics, 0, sizeof(frameStatistics));
+}
+
+StateStatistics getFrameStateStatistics()
+{
+	return lastFrameStatistics;
+}
+
+StateStatistics getTotalStateStatistics(unsigned int & out_frames)
+{
+	out_frames = frames;
+	return totalStatistics;
+}
+
+void printStateStatistics()
+{
+	if (frames == 0)
+		return;
+	const StateStatistics & total = totalStatistics;
+	printf("State changes per frame : programs %.1f of %.1f binds, vertex arrays %.1f of %.1f, textures %.1f of %.1f, %.1f draw calls\n",
+		(double)total.programChanges / frames, (double)total.programBinds / frames,
+		(double)total.vertexArrayChanges / frames, (double)total.vertexArrayBinds / frames,
+		(double)total.textureChanges / frames, (double)total.textureBinds / frames,
+		(double)total.drawCalls / frames);
+}
@@ -0,0 +1,45 @@
+#ifndef GLSTATE_HPP
+#define GLSTATE_HPP
+
+#include <GL/glew.h>
+
+#include "resources.hpp"
+
+// Shadow copy of the bound program, vertex array and textures. Binding what is already bound
+// costs nothing, the call never reaches the driver. All code must bind through these
+// functions, a direct glUseProgram/glBindVertexArray/glBindTexture makes the copy wrong
+// (call resetStateCache afterwards if that cannot be avoided).
+
+#define STATE_TEXTURE_UNITS 16
+
+void useProgram(GLuint program);
+void bindVertexArray(GLuint vertexArray);
+void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+// Forget everything, the next bind of each kind goes to OpenGL
+void resetStateCache();
+
+// Called by the delete functions in resources.cpp, OpenGL unbinds deleted objects
+void forgetBinding(ResourceType type, GLuint id);
+
+// Every glDraw* call, for the statistics
+void countDrawCall();
+
+struct StateStatistics
+{
+	unsigned int programBinds, programChanges; // requested, and the ones that reached OpenGL
+	unsigned int vertexArrayBinds, vertexArrayChanges;
+	unsigned int textureBinds, textureChanges;
+	unsigned int drawCalls;
+};
+
+// Call at the end of every frame
+void endStateFrame();
+
+// Counters of the last finished frame, and the sum over all frames
+StateStatistics getFrameStateStatistics();
+StateStatistics getTotalStateStatistics(unsigned int & frames);
+
+void printStateStatistics();
+
+#endif
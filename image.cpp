@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "image.hpp"
+#include "threadpool.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define IMAGE_X86 1
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// GCC and clang only emit SSSE3 instructions in functions that ask for them
+#if defined(IMAGE_X86) && defined(__GNUC__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define TARGET_SSSE3
+#endif
+
+// Rows per parallelFor job, small enough to spread a 512x512 image over a few threads
+#define ROWS_PER_JOB 32
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    BGR(A) -> RGBA
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef void (*SwizzleKernel)(const unsigned char * source, unsigned int bytesPerPixel, unsigned char * destination, size_t count);
+
+static void swizzleScalar(const unsigned char * source, unsigned int bytesPerPixel, unsigned char * destination, size_t count)
+{
+	for (size_t i = 0; i < count; i++, source += bytesPerPixel, destination += 4){
+		destination[0] = source[2];
+		destination[1] = source[1];
+		destination[2] = source[0];
+		destination[3] = bytesPerPixel == 4 ? source[3] : 255;
+	}
+}
+
+#ifdef IMAGE_X86
+
+// Four pixels per shuffle. 16 bytes are loaded for 12 bytes of BGR, the loop stops early
+// enough never to read past the end of the source.
+TARGET_SSSE3 static void swizzleSSSE3(const unsigned char * source, unsigned int bytesPerPixel, unsigned char * destination, size_t count)
+{
+	size_t i = 0;
+	if (bytesPerPixel == 3){
+		const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+		const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+		for (; i + 6 <= count; i += 4){
+			__m128i bgr = _mm_loadu_si128((const __m128i *)(source + i * 3));
+			__m128i rgba = _mm_or_si128(_mm_shuffle_epi8(bgr, shuffle), alpha);
+			_mm_storeu_si128((__m128i *)(destination + i * 4), rgba);
+		}
+	}else{
+		const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+		for (; i + 4 <= count; i += 4){
+			__m128i bgra = _mm_loadu_si128((const __m128i *)(source + i * 4));
+			_mm_storeu_si128((__m128i *)(destination + i * 4), _mm_shuffle_epi8(bgra, shuffle));
+		}
+	}
+	swizzleScalar(source + i * bytesPerPixel, bytesPerPixel, destination + i * 4, count - i);
+}
+
+static bool haveSSSE3()
+{
+	unsigned int registers[4];
+#ifdef _MSC_VER
+	__cpuid((int *)registers, 1);
+#else
+	__cpuid(1, registers[0], registers[1], registers[2], registers[3]);
+#endif
+	return (registers[2] & (1u << 9)) != 0;
+}
+
+#endif
+
+struct SwizzleChoice
+{
+	SwizzleKernel kernel;
+	const char * name;
+};
+
+static SwizzleChoice chooseSwizzle()
+{
+	SwizzleChoice choice = { swizzleScalar, "scalar" };
+#ifdef IMAGE_X86
+	if (haveSSSE3()){
+		choice.kernel = swizzleSSSE3;
+		choice.name = "SSSE3";
+	}
+#endif
+	return choice;
+}
+
+static const SwizzleChoice & swizzle()
+{
+	static const SwizzleChoice choice = chooseSwizzle();
+	return choice;
+}
+
+void convertToRGBA(const unsigned char * source, unsigned int bytesPerPixel, unsigned char * destination, size_t count)
+{
+	swizzle().kernel(source, bytesPerPixel, destination, count);
+}
+
+const char * swizzleKernelName()
+{
+	return swizzle().name;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    BMP
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The header fields are little endian and not aligned
+static unsigned int readU16(const unsigned char * p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int readU32(const unsigned char * p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+bool decodeBMP(const unsigned char * data, size_t size, Image & out_image)
+{
+	// 14 bytes file header and at least the 40 bytes of BITMAPINFOHEADER
+	if (size < 54 || data[0] != 'B' || data[1] != 'M' || readU32(data + 0x0E) < 40){
+		printf("Not a correct BMP file\n");
+		return false;
+	}
+
+	unsigned int dataPos     = readU32(data + 0x0A);
+	int width                = (int)readU32(data + 0x12);
+	int height               = (int)readU32(data + 0x16); // negative : rows top down
+	unsigned int bits        = readU16(data + 0x1C);
+	unsigned int compression = readU32(data + 0x1E);
+
+	// BI_RGB only, 32 bit files may say BI_BITFIELDS with the usual BGRA masks
+	bool bitfields = compression == 3 && bits == 32 && size >= 0x42
+		&& readU32(data + 0x36) == 0x00FF0000 && readU32(data + 0x3A) == 0x0000FF00 && readU32(data + 0x3E) == 0x000000FF;
+	if ((bits != 24 && bits != 32) || (compression != 0 && !bitfields)){
+		printf("Only uncompressed 24 and 32 bit BMP files are supported\n");
+		return false;
+	}
+
+	bool topDown = height < 0;
+	if (topDown)
+		height = -height;
+	if (width <= 0 || height <= 0 || width > 65536 || height > 65536){
+		printf("Not a correct BMP file\n");
+		return false;
+	}
+	if (dataPos == 0)
+		dataPos = 54; // some files leave it out
+
+	// Every row is padded to a multiple of 4 bytes
+	unsigned int bytesPerPixel = bits / 8;
+	size_t stride = ((size_t)width * bytesPerPixel + 3) & ~(size_t)3;
+	if (dataPos > size || (size - dataPos) / stride < (size_t)height){
+		printf("BMP file is truncated\n");
+		return false;
+	}
+
+	out_image.width = (unsigned int)width;
+	out_image.height = (unsigned int)height;
+	out_image.pixels.resize((size_t)width * height * 4);
+
+	const unsigned char * rows = data + dataPos;
+	unsigned char * pixels = &out_image.pixels[0];
+	size_t jobs = (height + ROWS_PER_JOB - 1) / ROWS_PER_JOB;
+	parallelFor(jobs, [=](size_t job){
+		size_t end = (job + 1) * ROWS_PER_JOB < (size_t)height ? (job + 1) * ROWS_PER_JOB : (size_t)height;
+		for (size_t y = job * ROWS_PER_JOB; y < end; y++){
+			size_t row = topDown ? height - 1 - y : y; // output is bottom up
+			convertToRGBA(rows + row * stride, bytesPerPixel, pixels + y * width * 4, width);
+		}
+	});
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Mip levels
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define LINEAR_STEPS 16384 // resolution of the linear -> sRGB table
+
+struct SRGBTables
+{
+	float toLinear[256];
+	unsigned char toSRGB[LINEAR_STEPS + 1];
+
+	SRGBTables()
+	{
+		for (int i = 0; i < 256; i++){
+			float c = i / 255.0f;
+			toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i <= LINEAR_STEPS; i++){
+			float l = (float)i / LINEAR_STEPS;
+			float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			toSRGB[i] = (unsigned char)(c * 255.0f + 0.5f);
+		}
+	}
+};
+
+static const SRGBTables & srgbTables()
+{
+	static const SRGBTables tables;
+	return tables;
+}
+
+// One row of the next level. Odd sizes drop the last row or column (the size is rounded down),
+// a dimension that is 1 already stays 1 and samples the same texel twice.
+static void downsampleRow(const Image & source, Image & destination, unsigned int y, const SRGBTables & tables)
+{
+	unsigned int y0 = y * 2, y1 = y * 2 + 1 < source.height ? y * 2 + 1 : source.height - 1;
+	const unsigned char * row0 = &source.pixels[(size_t)y0 * source.width * 4];
+	const unsigned char * row1 = &source.pixels[(size_t)y1 * source.width * 4];
+	unsigned char * out = &destination.pixels[(size_t)y * destination.width * 4];
+
+	for (unsigned int x = 0; x < destination.width; x++, out += 4){
+		unsigned int x0 = x * 2 * 4, x1 = (x * 2 + 1 < source.width ? x * 2 + 1 : source.width - 1) * 4;
+		for (int c = 0; c < 3; c++){
+			float linear = tables.toLinear[row0[x0 + c]] + tables.toLinear[row0[x1 + c]]
+				+ tables.toLinear[row1[x0 + c]] + tables.toLinear[row1[x1 + c]];
+			out[c] = tables.toSRGB[(int)(linear * (LINEAR_STEPS / 4.0f) + 0.5f)];
+		}
+		out[3] = (unsigned char)((row0[x0 + 3] + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) / 4);
+	}
+}
+
+void buildMipChain(Image & image, MipChain & out_chain)
+{
+	const SRGBTables & tables = srgbTables();
+
+	out_chain.levels.clear();
+	out_chain.levels.push_back(Image());
+	out_chain.levels[0].width = image.width;
+	out_chain.levels[0].height = image.height;
+	out_chain.levels[0].pixels.swap(image.pixels);
+	image.width = image.height = 0;
+
+	while (out_chain.levels.back().width > 1 || out_chain.levels.back().height > 1){
+		out_chain.levels.push_back(Image());
+		const Image & source = out_chain.levels[out_chain.levels.size() - 2];
+		Image & level = out_chain.levels.back();
+		level.width = source.width > 1 ? source.width / 2 : 1;
+		level.height = source.height > 1 ? source.height / 2 : 1;
+		level.pixels.resize((size_t)level.width * level.height * 4);
+
+		size_t jobs = (level.height + ROWS_PER_JOB - 1) / ROWS_PER_JOB;
+		parallelFor(jobs, [&](size_t job){
+			unsigned int end = (unsigned int)((job + 1) * ROWS_PER_JOB < level.height ? (job + 1) * ROWS_PER_JOB : level.height);
+			for (unsigned int y = (unsigned int)job * ROWS_PER_JOB; y < end; y++)
+				downsampleRow(source, level, y, tables);
+		});
+	}
+}
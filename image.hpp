@@ -0,0 +1,37 @@
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+
+#include <stddef.h>
+#include <vector>
+
+// Images on the CPU, everything here runs on any thread (see texture.hpp for the upload).
+
+// RGBA, 8 bits per channel, rows bottom up as glTexImage2D expects them, no padding
+struct Image
+{
+	unsigned int width, height;
+	std::vector<unsigned char> pixels;
+};
+
+// An image and all its mip levels down to 1x1, level 0 first
+struct MipChain
+{
+	std::vector<Image> levels;
+};
+
+// Decodes a BMP file in memory (24 or 32 bits, uncompressed, bottom up or top down rows)
+bool decodeBMP(const unsigned char * data, size_t size, Image & out_image);
+
+// Converts "count" pixels of 3 (BGR) or 4 (BGRA) bytes to RGBA, BGR gets alpha 255.
+// Uses SSSE3 shuffles if the CPU has them.
+void convertToRGBA(const unsigned char * source, unsigned int bytesPerPixel, unsigned char * destination, size_t count);
+
+// Halves the image down to 1x1 with a 2x2 box filter. The colors are sRGB, they are averaged
+// in linear space (alpha is linear already), otherwise every level gets darker. The levels are
+// computed in parallel (see parallelFor), the image is moved into the first level.
+void buildMipChain(Image & image, MipChain & out_chain);
+
+// "SSSE3" or "scalar", for messages
+const char * swizzleKernelName();
+
+#endif
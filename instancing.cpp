@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <map>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "instancing.hpp"
+#include "objects.hpp"
+#include "resources.hpp"
+#include "glstate.hpp"
+#include "renderqueue.hpp"
+#include "streambuffer.hpp"
+
+static_assert(sizeof(InstanceData) == 84, "InstanceData must match the instance attributes");
+
+// One batch per program, texture and primitive, spheres additionally per tessellation.
+// The layer is not part of the key, it is in the instance data.
+struct BatchKey
+{
+	GLuint program;
+	GLenum textureTarget;
+	GLuint texture;
+	Primitive primitive;
+	GLuint lats, longs;
+
+	bool operator < (const BatchKey & other) const
+	{
+		if (program != other.program) return program < other.program;
+		if (texture != other.texture) return texture < other.texture;
+		if (primitive != other.primitive) return primitive < other.primitive;
+		if (lats != other.lats) return lats < other.lats;
+		return longs < other.longs;
+	}
+};
+
+typedef std::map<BatchKey, std::vector<InstanceData> > BatchMap;
+
+static BatchMap batches;
+static GLuint batchProgram = 0; // see setInstanceMaterial
+static TextureLayer batchTexture = { GL_TEXTURE_2D, 0, 0 };
+
+// Instance data of one frame, about 12,500 instances at 84 bytes. Frames with more instances grow
+// the buffer (see growStreamBuffer).
+static const GLsizeiptr frameSize = 1024 * 1024;
+static StreamBuffer instanceStream;
+
+static void queueBatch(Primitive primitive, GLuint lats, GLuint longs, const glm::mat4 & model, const glm::vec4 & color)
+{
+	BatchKey key = { batchProgram, batchTexture.target, batchTexture.texture, primitive, lats, longs };
+	InstanceData instance;
+	instance.model = model;
+	instance.color = color;
+	instance.layer = (float)batchTexture.layer;
+	batches[key].push_back(instance);
+}
+
+void setInstanceMaterial(GLuint program, const TextureLayer & texture)
+{
+	batchProgram = program;
+	batchTexture = texture;
+}
+
+void queueInstance(Primitive primitive, const glm::mat4 & model, const glm::vec4 & color)
+{
+	if (primitive == PRIMITIVE_SPHERE)
+		queueBatch(primitive, 10, 10, model, color);
+	else
+		queueBatch(primitive, 0, 0, model, color);
+}
+
+void queueWireCube(const glm::mat4 & model, const glm::vec4 & color)
+{
+	queueInstance(PRIMITIVE_WIRE_CUBE, model, color);
+}
+
+void queueCube(const glm::mat4 & model, const glm::vec4 & color)
+{
+	queueInstance(PRIMITIVE_CUBE, model, color);
+}
+
+void queueSphere(const glm::mat4 & model, const glm::vec4 & color, GLuint lats, GLuint longs)
+{
+	queueBatch(PRIMITIVE_SPHERE, lats, longs, model, color);
+}
+
+void setInstanceAttributes(size_t offset)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, instanceStream.buffer);
+	for (int column = 0; column < 4; column++){
+		GLuint location = INSTANCE_MATRIX_LOCATION + column;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + column * sizeof(glm::vec4)));
+		glVertexAttribDivisor(location, 1);
+	}
+	glEnableVertexAttribArray(INSTANCE_COLOR_LOCATION);
+	glVertexAttribPointer(INSTANCE_COLOR_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + sizeof(glm::mat4)));
+	glVertexAttribDivisor(INSTANCE_COLOR_LOCATION, 1);
+	glEnableVertexAttribArray(INSTANCE_LAYER_LOCATION);
+	glVertexAttribPointer(INSTANCE_LAYER_LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + sizeof(glm::mat4) + sizeof(glm::vec4)));
+	glVertexAttribDivisor(INSTANCE_LAYER_LOCATION, 1);
+}
+
+void flushInstances()
+{
+	size_t total = 0;
+	for (BatchMap::iterator it = batches.begin(); it != batches.end(); ++it)
+		total += it->second.size();
+	if (total == 0)
+		return;
+
+	if (!instanceStream.buffer)
+		createStreamBuffer(instanceStream, GL_ARRAY_BUFFER, frameSize, 16, "instances");
+
+	// All batches go into one allocation, written straight into the buffer. It is the only
+	// allocation of the frame, so the buffer can still be replaced by a bigger one.
+	GLsizeiptr bytes = (GLsizeiptr)(total * sizeof(InstanceData));
+	if (bytes > instanceStream.regionSize)
+		growStreamBuffer(instanceStream, bytes, "instances");
+
+	StreamAllocation allocation;
+	if (!allocateStream(instanceStream, bytes, allocation)){
+		printf("%u instances do not fit into the instance buffer\n", (unsigned int)total);
+		for (BatchMap::iterator it = batches.begin(); it != batches.end(); ++it)
+			it->second.clear();
+		return;
+	}
+
+	size_t offset = allocation.offset;
+	for (BatchMap::iterator it = batches.begin(); it != batches.end(); ++it){
+		std::vector<InstanceData> & queue = it->second;
+		if (queue.empty())
+			continue;
+
+		memcpy((char *)allocation.data + (offset - allocation.offset), &queue[0], queue.size() * sizeof(InstanceData));
+
+		PrimitiveDraw draw;
+		switch (it->first.primitive){
+		case PRIMITIVE_WIRE_CUBE: draw = getWireCube(); break;
+		case PRIMITIVE_CUBE:      draw = getCube(); break;
+		default:                  draw = getSphere(it->first.lats, it->first.longs); break;
+		}
+
+		// A batch has no single depth, it sorts in front of the other draws with the same state
+		TextureLayer texture = { it->first.textureTarget, it->first.texture, 0 };
+		submitInstances(it->first.program, texture, draw, 0.0f, offset, (GLsizei)queue.size());
+
+		offset += queue.size() * sizeof(InstanceData);
+		queue.clear();
+	}
+	commitStream(instanceStream, allocation);
+}
+
+void deleteInstanceBuffer()
+{
+	deleteStreamBuffer(instanceStream);
+}
@@ -0,0 +1,56 @@
+#ifndef INSTANCING_HPP
+#define INSTANCING_HPP
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "texturearray.hpp"
+
+// Instanced drawing of the primitives from objects.cpp. Instead of one sendMVP and one draw
+// call per cube or sphere, callers queue (primitive, model matrix, color) records and
+// flushInstances submits each primitive as a single instanced draw call. Spheres are
+// batched per tessellation (see sphereLOD in objects.hpp), everything per program and texture
+// (see setInstanceMaterial). Layers of one texture array are the same texture here, each
+// instance brings its own layer.
+//
+// The model matrix goes to the vertex attributes 3 to 6 (one column each), the color to
+// attribute 7 and the layer to attribute 8, see StandardShading.vertexshader.
+
+#define INSTANCE_MATRIX_LOCATION 3
+#define INSTANCE_COLOR_LOCATION  7
+#define INSTANCE_LAYER_LOCATION  8
+
+enum Primitive
+{
+	PRIMITIVE_WIRE_CUBE,
+	PRIMITIVE_CUBE,
+	PRIMITIVE_SPHERE,
+	PRIMITIVE_COUNT
+};
+
+// Matches the instance attributes, 84 bytes
+struct InstanceData
+{
+	glm::mat4 model;
+	glm::vec4 color;
+	float layer;
+};
+
+// Program (must read the instance attributes) and texture for everything queued afterwards
+void setInstanceMaterial(GLuint program, const TextureLayer & texture);
+
+void queueInstance(Primitive primitive, const glm::mat4 & model, const glm::vec4 & color = glm::vec4(1.0f));
+void queueWireCube(const glm::mat4 & model, const glm::vec4 & color = glm::vec4(1.0f));
+void queueCube(const glm::mat4 & model, const glm::vec4 & color = glm::vec4(1.0f));
+void queueSphere(const glm::mat4 & model, const glm::vec4 & color = glm::vec4(1.0f), GLuint lats = 10, GLuint longs = 10);
+
+// Uploads and clears everything queued and submits one draw per batch to the render queue
+// (see renderqueue.hpp)
+void flushInstances();
+
+// Points the instance attributes of the bound vertex array to "offset" in the instance buffer
+void setInstanceAttributes(size_t offset);
+
+void deleteInstanceBuffer();
+
+#endif
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mappedfile.hpp"
+
+// Used for empty files, mmap/MapViewOfFile refuse to map zero bytes.
+static const char emptyFileData[1] = { 0 };
+
+#ifdef _WIN32
+
+bool mapFile(const char * path, MappedFile & file)
+{
+	memset(&file, 0, sizeof(file));
+
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size) || (unsigned long long)size.QuadPart > (size_t)-1){
+		CloseHandle(handle);
+		return false;
+	}
+
+	if (size.QuadPart == 0){
+		CloseHandle(handle);
+		file.data = emptyFileData;
+		return true;
+	}
+
+	HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL){
+		CloseHandle(handle);
+		return false;
+	}
+
+	const void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL){
+		CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file.data = (const char *)view;
+	file.size = (size_t)size.QuadPart;
+	file.fileHandle = handle;
+	file.mappingHandle = mapping;
+	return true;
+}
+
+void unmapFile(MappedFile & file)
+{
+	if (file.mappingHandle){
+		UnmapViewOfFile(file.data);
+		CloseHandle((HANDLE)file.mappingHandle);
+		CloseHandle((HANDLE)file.fileHandle);
+	}
+	memset(&file, 0, sizeof(file));
+}
+
+#else
+
+bool mapFile(const char * path, MappedFile & file)
+{
+	memset(&file, 0, sizeof(file));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0){
+		close(fd);
+		return false;
+	}
+
+	if (st.st_size == 0){
+		close(fd);
+		file.data = emptyFileData;
+		return true;
+	}
+
+	void * view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps its own reference to the file
+	if (view == MAP_FAILED)
+		return false;
+
+	madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	file.data = (const char *)view;
+	file.size = (size_t)st.st_size;
+	file.mappingHandle = view;
+	return true;
+}
+
+void unmapFile(MappedFile & file)
+{
+	if (file.mappingHandle)
+		munmap(file.mappingHandle, file.size);
+	memset(&file, 0, sizeof(file));
+}
+
+#endif
+
+bool fileStamp(const char * path, long long & time, unsigned long long & size)
+{
+#ifdef _WIN32
+	struct __stat64 st;
+	if (_stat64(path, &st) != 0)
+		return false;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+#endif
+	time = (long long)st.st_mtime;
+	size = (unsigned long long)st.st_size;
+	return true;
+}
+
+unsigned long long hashBytes(const void * data, size_t size, unsigned long long hash)
+{
+	const unsigned char * bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++){
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
@@ -0,0 +1,25 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <stddef.h>
+
+// Read-only view of a whole file. "data" stays valid until unmapFile is called.
+// Empty files are mapped successfully with size 0.
+struct MappedFile
+{
+	const char * data;
+	size_t size;
+	void * fileHandle;    // platform specific
+	void * mappingHandle; // platform specific
+};
+
+bool mapFile(const char * path, MappedFile & file);
+void unmapFile(MappedFile & file);
+
+// Modification time (seconds) and size of a file, false if it does not exist
+bool fileStamp(const char * path, long long & time, unsigned long long & size);
+
+// 64 bit FNV-1a hash, pass the result of a previous call as "hash" to continue it
+unsigned long long hashBytes(const void * data, size_t size, unsigned long long hash = 14695981039346656037ULL);
+
+#endif
@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+#include "resources.hpp"
+#include "glstate.hpp"
+#include "objloader.hpp"
+#include "meshopt.hpp"
+#include "culling.hpp"
+#include "meshpool.hpp"
+
+static_assert(sizeof(MeshFileHeader) == 128, "MeshFileHeader must not contain padding");
+static_assert(sizeof(MeshAttribute) == 24, "MeshAttribute must not contain padding");
+
+static size_t alignTo16(size_t size)
+{
+	return (size + 15) & ~(size_t)15;
+}
+
+// Appends "size" bytes to the file, starting at a multiple of 16
+static size_t appendSection(std::vector<char> & file, const void * data, size_t size)
+{
+	size_t offset = alignTo16(file.size());
+	file.resize(offset + size);
+	if (size)
+		memcpy(&file[offset], data, size);
+	return offset;
+}
+
+// Unsigned normalized 16 bit, 0 = boundsMin, 65535 = boundsMax
+static unsigned short quantizePosition(float value, float boundsMin, float extent)
+{
+	if (extent <= 0.0f)
+		return 0;
+	float scaled = (value - boundsMin) / extent * 65535.0f + 0.5f;
+	return (unsigned short)glm::clamp(scaled, 0.0f, 65535.0f);
+}
+
+// Signed normalized 10_10_10_2 (GL_INT_2_10_10_10_REV), w stays 0
+static unsigned int packNormal(const glm::vec3 & normal)
+{
+	unsigned int packed = 0;
+	for (int i = 0; i < 3; i++){
+		int value = (int)floorf(glm::clamp(normal[i], -1.0f, 1.0f) * 511.0f + 0.5f);
+		packed |= ((unsigned int)value & 0x3ff) << (10 * i);
+	}
+	return packed;
+}
+
+void buildMeshFile(
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals,
+	bool quantize,
+	std::vector<char> & out_file
+){
+	MeshFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MESH_FILE_MAGIC;
+	header.version = MESH_FILE_VERSION;
+	header.flags = quantize ? MESH_QUANTIZED : 0;
+	header.vertexCount = (unsigned int)vertices.size();
+	header.indexCount = (unsigned int)indices.size();
+
+	Bounds bounds = computeBounds(vertices);
+	memcpy(header.boundsMin, &bounds.min[0], sizeof(header.boundsMin));
+	memcpy(header.boundsMax, &bounds.max[0], sizeof(header.boundsMax));
+	memcpy(header.sphereCenter, &bounds.center[0], sizeof(header.sphereCenter));
+	header.sphereRadius = bounds.radius;
+
+	// All attributes of a vertex are stored next to each other, one fetch brings in the whole vertex
+	size_t count = vertices.size();
+	std::vector<char> vertexData;
+	MeshAttribute attributes[3];
+	header.attributeCount = 3;
+
+	if (quantize){
+		MeshAttribute position = { 0, 4, GL_UNSIGNED_SHORT,       GL_TRUE,  0,  16 };
+		MeshAttribute normal   = { 2, 4, GL_INT_2_10_10_10_REV,   GL_TRUE,  8,  16 };
+		MeshAttribute uv       = { 1, 2, GL_HALF_FLOAT,           GL_FALSE, 12, 16 };
+		attributes[0] = position;
+		attributes[1] = normal;
+		attributes[2] = uv;
+		header.vertexSize = 16;
+
+		glm::vec3 extent = bounds.max - bounds.min;
+		vertexData.resize(count * header.vertexSize);
+		for (size_t i = 0; i < count; i++){
+			char * vertex = &vertexData[i * header.vertexSize];
+			unsigned short quantized[4] = {
+				quantizePosition(vertices[i].x, bounds.min.x, extent.x),
+				quantizePosition(vertices[i].y, bounds.min.y, extent.y),
+				quantizePosition(vertices[i].z, bounds.min.z, extent.z),
+				0
+			};
+			unsigned int packedNormal = packNormal(normals[i]);
+			unsigned int packedUV = glm::packHalf2x16(uvs[i]);
+			memcpy(vertex,      quantized,     8);
+			memcpy(vertex + 8,  &packedNormal, 4);
+			memcpy(vertex + 12, &packedUV,     4);
+		}
+	}else{
+		MeshAttribute position = { 0, 3, GL_FLOAT, GL_FALSE, 0,  32 };
+		MeshAttribute normal   = { 2, 3, GL_FLOAT, GL_FALSE, 12, 32 };
+		MeshAttribute uv       = { 1, 2, GL_FLOAT, GL_FALSE, 24, 32 };
+		attributes[0] = position;
+		attributes[1] = normal;
+		attributes[2] = uv;
+		header.vertexSize = 32;
+
+		vertexData.resize(count * header.vertexSize);
+		for (size_t i = 0; i < count; i++){
+			char * vertex = &vertexData[i * header.vertexSize];
+			memcpy(vertex,      &vertices[i], 12);
+			memcpy(vertex + 12, &normals[i],  12);
+			memcpy(vertex + 24, &uvs[i],      8);
+		}
+	}
+
+	std::vector<unsigned short> indices16;
+	const void * indexData = indices.empty() ? NULL : &indices[0];
+	size_t indexSize = indices.size() * sizeof(unsigned int);
+	header.indexType = GL_UNSIGNED_INT;
+	if (packIndices16(indices, count, indices16)){
+		indexData = indices16.empty() ? NULL : &indices16[0];
+		indexSize = indices16.size() * sizeof(unsigned short);
+		header.indexType = GL_UNSIGNED_SHORT;
+	}
+
+	out_file.clear();
+	appendSection(out_file, &header, sizeof(header));
+	appendSection(out_file, attributes, sizeof(attributes));
+	header.vertexDataOffset = appendSection(out_file, vertexData.empty() ? NULL : &vertexData[0], vertexData.size());
+	header.vertexDataSize = vertexData.size();
+	header.indexDataOffset = appendSection(out_file, indexData, indexSize);
+	header.indexDataSize = indexSize;
+	memcpy(&out_file[0], &header, sizeof(header));
+}
+
+// Bytes of one attribute in a vertex, 0 for types a mesh file never contains
+static unsigned int attributeBytes(const MeshAttribute & attribute)
+{
+	if (attribute.components < 1 || attribute.components > 4)
+		return 0;
+	switch (attribute.type){
+	case GL_FLOAT:                return attribute.components * 4;
+	case GL_HALF_FLOAT:
+	case GL_UNSIGNED_SHORT:       return attribute.components * 2;
+	case GL_INT_2_10_10_10_REV:   return attribute.components == 4 ? 4 : 0;
+	default:                      return 0;
+	}
+}
+
+// Every index must name a vertex, otherwise a broken file draws whatever follows the buffer
+template <typename Index>
+static bool indicesInRange(const char * data, unsigned int count, unsigned int vertexCount)
+{
+	const Index * indices = (const Index *)data;
+	Index largest = 0;
+	for (unsigned int i = 0; i < count; i++)
+		largest = std::max(largest, indices[i]);
+	return count == 0 || largest < vertexCount;
+}
+
+bool parseMeshFile(const char * data, size_t size, MeshFile & mesh)
+{
+	mesh.header = NULL;
+	if (size < sizeof(MeshFileHeader))
+		return false;
+
+	const MeshFileHeader * header = (const MeshFileHeader *)data;
+	if (header->magic != MESH_FILE_MAGIC || header->version != MESH_FILE_VERSION)
+		return false;
+
+	size_t attributesOffset = alignTo16(sizeof(MeshFileHeader));
+	if (header->attributeCount > 16 || attributesOffset + header->attributeCount * sizeof(MeshAttribute) > size)
+		return false;
+	if (header->vertexDataOffset > size || header->vertexDataSize > size - header->vertexDataOffset)
+		return false;
+	if (header->indexDataOffset > size || header->indexDataSize > size - header->indexDataOffset)
+		return false;
+
+	unsigned int indexSize = header->indexType == GL_UNSIGNED_SHORT ? 2 : header->indexType == GL_UNSIGNED_INT ? 4 : 0;
+	if (indexSize == 0 || header->indexDataSize != (unsigned long long)header->indexCount * indexSize)
+		return false;
+	if (header->vertexDataSize != (unsigned long long)header->vertexCount * header->vertexSize)
+		return false;
+	if (header->vertexDataOffset % 16 != 0 || header->indexDataOffset % 16 != 0)
+		return false;
+
+	// The attributes go straight to glVertexAttribPointer, they have to stay inside a vertex
+	const MeshAttribute * attributes = (const MeshAttribute *)(data + attributesOffset);
+	for (unsigned int i = 0; i < header->attributeCount; i++){
+		unsigned int bytes = attributeBytes(attributes[i]);
+		if (bytes == 0 || attributes[i].location >= 16 || attributes[i].stride != header->vertexSize
+			|| attributes[i].offset > header->vertexSize || bytes > header->vertexSize - attributes[i].offset)
+			return false;
+	}
+
+	const char * indexData = data + header->indexDataOffset;
+	bool inRange = header->indexType == GL_UNSIGNED_SHORT
+		? indicesInRange<unsigned short>(indexData, header->indexCount, header->vertexCount)
+		: indicesInRange<unsigned int>(indexData, header->indexCount, header->vertexCount);
+	if (!inRange)
+		return false;
+
+	mesh.header = header;
+	mesh.attributes = attributes;
+	mesh.vertexData = data + header->vertexDataOffset;
+	mesh.indexData = data + header->indexDataOffset;
+	return true;
+}
+
+bool openMeshFile(const char * path, MeshFile & mesh)
+{
+	if (!mapFile(path, mesh.file))
+		return false;
+
+	if (!parseMeshFile(mesh.file.data, mesh.file.size, mesh)){
+		printf("%s is not a valid mesh file (version %d)\n", path, MESH_FILE_VERSION);
+		unmapFile(mesh.file);
+		return false;
+	}
+	return true;
+}
+
+void closeMeshFile(MeshFile & mesh)
+{
+	unmapFile(mesh.file);
+	mesh.header = NULL;
+}
+
+static bool writeFile(const char * path, const std::vector<char> & data)
+{
+	FILE * file = fopen(path, "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+	return (fclose(file) == 0) && ok;
+}
+
+// Fills the source fields of the header in "meshFile"
+static bool stampMeshFile(const char * objPath, std::vector<char> & meshFile)
+{
+	MeshFileHeader * header = (MeshFileHeader *)&meshFile[0];
+	MappedFile source;
+	if (!fileStamp(objPath, header->sourceTime, header->sourceSize) || !mapFile(objPath, source))
+		return false;
+	header->sourceHash = hashBytes(source.data, source.size);
+	unmapFile(source);
+	return true;
+}
+
+// Loads the OBJ file and builds the mesh file in memory
+static bool buildMeshFromOBJ(const char * objPath, bool quantize, std::vector<char> & meshFile)
+{
+	std::vector<unsigned int> indices;
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	if (!loadOBJIndexed(objPath, indices, vertices, uvs, normals))
+		return false;
+
+	// Done once when the cache is built, so it costs nothing at startup
+	optimizeMesh(indices, vertices, uvs, normals);
+
+	buildMeshFile(indices, vertices, uvs, normals, quantize, meshFile);
+	return stampMeshFile(objPath, meshFile);
+}
+
+bool convertOBJToMesh(const char * objPath, const char * meshPath, bool quantize)
+{
+	std::vector<char> meshFile;
+	if (!buildMeshFromOBJ(objPath, quantize, meshFile))
+		return false;
+
+	if (!writeFile(meshPath, meshFile)){
+		printf("Could not write %s\n", meshPath);
+		return false;
+	}
+	return true;
+}
+
+static void uploadOwnBuffers(const MeshFile & file, Mesh & mesh)
+{
+	const MeshFileHeader & header = *file.header;
+
+	mesh.vertexArray = createVertexArray("mesh");
+	bindVertexArray(mesh.vertexArray);
+
+	mesh.vertexBuffer = createBuffer("mesh vertices");
+	bufferData(GL_ARRAY_BUFFER, mesh.vertexBuffer, (GLsizeiptr)header.vertexDataSize, file.vertexData, GL_STATIC_DRAW);
+
+	for (unsigned int i = 0; i < header.attributeCount; i++){
+		const MeshAttribute & attribute = file.attributes[i];
+		glEnableVertexAttribArray(attribute.location);
+		glVertexAttribPointer(attribute.location, attribute.components, attribute.type,
+			(GLboolean)attribute.normalized, attribute.stride, (void*)(size_t)attribute.offset);
+	}
+
+	// The index buffer is part of the vertex array as well
+	mesh.indexBuffer = createBuffer("mesh indices");
+	bufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBuffer, (GLsizeiptr)header.indexDataSize, file.indexData, GL_STATIC_DRAW);
+
+	bindVertexArray(0);
+
+	mesh.pool = NULL;
+	mesh.baseVertex = 0;
+	mesh.firstIndex = 0;
+	mesh.vertexCount = header.vertexCount;
+	mesh.indexCount = (GLsizei)header.indexCount;
+	mesh.indexType = header.indexType;
+}
+
+bool uploadMesh(const MeshFile & file, Mesh & mesh, bool pooled)
+{
+	const MeshFileHeader & header = *file.header;
+
+	if (pooled){
+		if (!addToMeshPool(file, mesh))
+			return false;
+	}else{
+		uploadOwnBuffers(file, mesh);
+	}
+
+	mesh.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	mesh.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	mesh.sphereCenter = glm::vec3(header.sphereCenter[0], header.sphereCenter[1], header.sphereCenter[2]);
+	mesh.sphereRadius = header.sphereRadius;
+
+	mesh.quantized = (header.flags & MESH_QUANTIZED) != 0;
+	if (mesh.quantized){
+		mesh.positionScale = mesh.boundsMax - mesh.boundsMin;
+		mesh.positionBias = mesh.boundsMin;
+	}else{
+		mesh.positionScale = glm::vec3(1.0f);
+		mesh.positionBias = glm::vec3(0.0f);
+	}
+	return true;
+}
+
+void readMeshGeometry(const MeshFile & file, MeshGeometry & out_geometry)
+{
+	const MeshFileHeader & header = *file.header;
+	out_geometry.positions.resize(header.vertexCount);
+	out_geometry.indices.resize(header.indexCount);
+
+	for (unsigned int a = 0; a < header.attributeCount; a++){
+		const MeshAttribute & attribute = file.attributes[a];
+		if (attribute.location != 0)
+			continue;
+
+		glm::vec3 boundsMin(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+		glm::vec3 extent = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]) - boundsMin;
+		for (unsigned int i = 0; i < header.vertexCount; i++){
+			const char * vertex = file.vertexData + attribute.offset + (size_t)i * attribute.stride;
+			if (attribute.type == GL_UNSIGNED_SHORT){
+				unsigned short quantized[3];
+				memcpy(quantized, vertex, sizeof(quantized));
+				glm::vec3 normalized(quantized[0] / 65535.0f, quantized[1] / 65535.0f, quantized[2] / 65535.0f);
+				out_geometry.positions[i] = normalized * extent + boundsMin;
+			}else{
+				memcpy(&out_geometry.positions[i][0], vertex, sizeof(glm::vec3));
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < header.indexCount; i++){
+		if (header.indexType == GL_UNSIGNED_SHORT){
+			unsigned short index;
+			memcpy(&index, file.indexData + i * sizeof(index), sizeof(index));
+			out_geometry.indices[i] = index;
+		}else{
+			memcpy(&out_geometry.indices[i], file.indexData + i * sizeof(unsigned int), sizeof(unsigned int));
+		}
+	}
+}
+
+bool readMeshCached(const char * objPath, bool quantize, MeshFile & out_file, std::vector<char> & storage)
+{
+	std::string cachePath = std::string(objPath) + ".cgmesh";
+	memset(&out_file, 0, sizeof(out_file));
+
+	long long sourceTime = 0;
+	unsigned long long sourceSize = 0;
+	bool haveSource = fileStamp(objPath, sourceTime, sourceSize);
+
+	MeshFile cache;
+	if (openMeshFile(cachePath.c_str(), cache)){
+
+		MeshFileHeader header = *cache.header;
+		bool sameLayout = (header.flags & MESH_QUANTIZED) == (quantize ? MESH_QUANTIZED : 0u);
+		bool valid = sameLayout && (!haveSource || (header.sourceTime == sourceTime && header.sourceSize == sourceSize));
+		bool restamp = false;
+
+		if (!valid && sameLayout && header.sourceSize == sourceSize){
+			// Touched but maybe not changed, compare the contents
+			MappedFile source;
+			if (mapFile(objPath, source)){
+				valid = restamp = hashBytes(source.data, source.size) == header.sourceHash;
+				unmapFile(source);
+			}
+		}
+
+		if (valid){
+			printf("Loading mesh cache %s...\n", cachePath.c_str());
+
+			if (!restamp){
+				out_file = cache;
+				return true;
+			}
+
+			// Only the header changes, so the next start does not need to hash again. Windows
+			// does not open a mapped file for writing, so the mapping is closed first and the
+			// file is mapped again afterwards.
+			closeMeshFile(cache);
+			header.sourceTime = sourceTime;
+			FILE * file = fopen(cachePath.c_str(), "r+b");
+			bool written = file && fwrite(&header, sizeof(header), 1, file) == 1;
+			if (file && fclose(file) != 0)
+				written = false;
+			if (!written)
+				printf("Could not update %s, the OBJ file will be hashed again next time\n", cachePath.c_str());
+			if (openMeshFile(cachePath.c_str(), out_file))
+				return true;
+		}else{
+			closeMeshFile(cache);
+		}
+	}
+
+	if (!buildMeshFromOBJ(objPath, quantize, storage))
+		return false;
+
+	printf("Writing mesh cache %s\n", cachePath.c_str());
+	if (!writeFile(cachePath.c_str(), storage))
+		printf("Could not write %s, the OBJ file will be parsed again next time\n", cachePath.c_str());
+
+	return parseMeshFile(&storage[0], storage.size(), out_file);
+}
+
+bool loadMeshCached(const char * objPath, Mesh & mesh, bool quantize, MeshGeometry * out_geometry)
+{
+	MeshFile file;
+	std::vector<char> storage;
+	if (!readMeshCached(objPath, quantize, file, storage))
+		return false;
+
+	if (out_geometry)
+		readMeshGeometry(file, *out_geometry);
+	bool ok = uploadMesh(file, mesh);
+	closeMeshFile(file);
+	return ok;
+}
+
+void drawMesh(const Mesh & mesh)
+{
+	bindVertexArray(mesh.vertexArray);
+	if (mesh.pool){
+		// Pooled indices are 32 bit
+		glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT,
+			(void*)((size_t)mesh.firstIndex * 4), mesh.baseVertex);
+	}else{
+		glDrawElements(GL_TRIANGLES, mesh.indexCount, mesh.indexType, (void*)0);
+	}
+	countDrawCall();
+}
+
+void deleteMesh(Mesh & mesh)
+{
+	if (mesh.pool){
+		// The buffers belong to the pool
+		removeFromMeshPool(mesh);
+		mesh = Mesh();
+		return;
+	}
+	deleteBuffer(mesh.indexBuffer);
+	deleteBuffer(mesh.vertexBuffer);
+	deleteVertexArray(mesh.vertexArray);
+	mesh = Mesh();
+}
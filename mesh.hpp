@@ -0,0 +1,145 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "mappedfile.hpp"
+
+// Binary mesh files (*.cgmesh). Reading a model is just mapping the file and handing the
+// pointers to glBufferData, no parsing at runtime.
+//
+// Layout : MeshFileHeader, MeshAttribute[attributeCount], vertex data, index data.
+// All numbers are little endian, every section starts at a multiple of 16 bytes.
+
+#define MESH_FILE_MAGIC   0x48534D43 // "CMSH"
+#define MESH_FILE_VERSION 4 // 2 : triangles and vertices are cache optimised, 3 : interleaved, flags, 4 : bounding sphere
+
+// Quantized vertices (16 bytes instead of 32) :
+// - position as 4 x 16 bit unsigned normalized, relative to the bounding box, the vertex shader
+//   computes boundsMin + (boundsMax - boundsMin) * position (see Mesh::positionScale/Bias)
+// - normal as signed normalized 10_10_10_2
+// - uv as 2 half floats
+#define MESH_QUANTIZED 1
+
+// One vertex attribute, exactly the arguments of glVertexAttribPointer
+struct MeshAttribute
+{
+	unsigned int location;   // layout(location = ...) in the vertex shader
+	unsigned int components; // 1 to 4
+	unsigned int type;       // GL_FLOAT, ...
+	unsigned int normalized; // GL_TRUE or GL_FALSE
+	unsigned int offset;     // of the first vertex, from the start of the vertex data
+	unsigned int stride;     // bytes between two vertices
+};
+
+// No padding anywhere, the struct looks the same for every compiler
+struct MeshFileHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int flags;      // MESH_QUANTIZED
+	unsigned int attributeCount;
+	unsigned int vertexCount;
+	unsigned int vertexSize; // bytes per vertex, all attributes are interleaved
+	unsigned int indexCount;
+	unsigned int indexType;  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	unsigned long long vertexDataOffset, vertexDataSize;
+	unsigned long long indexDataOffset, indexDataSize;
+	float boundsMin[3];
+	float boundsMax[3];
+	float sphereCenter[3];
+	float sphereRadius;
+
+	// The OBJ file the mesh was built from, see loadMeshCached
+	long long sourceTime;
+	unsigned long long sourceSize;
+	unsigned long long sourceHash;
+};
+
+// A mesh file in memory (mapped or just built), the pointers point into it
+struct MeshFile
+{
+	MappedFile file;
+	const MeshFileHeader * header;
+	const MeshAttribute * attributes;
+	const char * vertexData;
+	const char * indexData;
+};
+
+// A mesh on the graphics card
+struct Mesh
+{
+	GLuint vertexArray;
+	GLuint vertexBuffer;
+	GLuint indexBuffer;
+	GLsizei indexCount;
+	GLenum indexType;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	glm::vec3 sphereCenter; // bounding sphere, for culling
+	float sphereRadius;
+
+	// Model space position = position attribute * positionScale + positionBias
+	glm::vec3 positionScale;
+	glm::vec3 positionBias;
+	bool quantized;      // MESH_QUANTIZED, positionScale and positionBias are not 1 and 0
+
+	// Pooled meshes (see meshpool.hpp) share vertex array and buffers with other meshes,
+	// they start at baseVertex and firstIndex. 0 for meshes with their own.
+	struct MeshPool * pool;
+	GLint baseVertex;
+	GLuint firstIndex;
+	GLuint vertexCount;
+};
+
+// Positions and triangles of a mesh on the CPU, e.g. for picking (see buildTriangleBvh)
+struct MeshGeometry
+{
+	std::vector<glm::vec3> positions; // model space, as the vertex shader computes them
+	std::vector<unsigned int> indices;
+};
+
+// Converts indexed geometry (see loadOBJIndexed) into the file format
+void buildMeshFile(
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals,
+	bool quantize,
+	std::vector<char> & out_file
+);
+
+// Checks a mesh file in memory and sets the pointers of "mesh". The data must stay alive.
+bool parseMeshFile(const char * data, size_t size, MeshFile & mesh);
+
+bool openMeshFile(const char * path, MeshFile & mesh);
+void closeMeshFile(MeshFile & mesh);
+
+// Loads an OBJ file and writes it as mesh file
+bool convertOBJToMesh(const char * objPath, const char * meshPath, bool quantize = true);
+
+// Creates vertex array and buffers straight from the file data. With "pooled" the data goes
+// into the shared buffers of a mesh pool instead (see meshpool.hpp).
+bool uploadMesh(const MeshFile & file, Mesh & mesh, bool pooled = false);
+
+// Decodes the positions (quantized or not) and the indices of a mesh file
+void readMeshGeometry(const MeshFile & file, MeshGeometry & out_geometry);
+
+// The mesh file of an OBJ file, from the cache or freshly built and written (see loadMeshCached).
+// Does not use OpenGL, so it can run on any thread. A freshly built file lives in "storage",
+// which must outlive "out_file". Call closeMeshFile when done.
+bool readMeshCached(const char * objPath, bool quantize, MeshFile & out_file, std::vector<char> & storage);
+
+// Loads "path.cgmesh" next to the OBJ file. If it is missing or older than the OBJ file it is
+// (re)built first. A cache with a different time stamp is still used if the OBJ contents are
+// unchanged (e.g. after a checkout), unless it was built with other "quantize" settings.
+// If out_geometry is given, the positions and indices are kept on the CPU as well.
+bool loadMeshCached(const char * objPath, Mesh & mesh, bool quantize = true, MeshGeometry * out_geometry = NULL);
+
+void drawMesh(const Mesh & mesh);
+void deleteMesh(Mesh & mesh);
+
+#endif
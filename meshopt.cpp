@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "meshopt.hpp"
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<unsigned int> & indices, size_t vertexCount, unsigned int cacheSize)
+{
+	// A vertex is in the FIFO cache if less than cacheSize vertices were transformed after it
+	std::vector<unsigned int> timestamps(vertexCount, 0);
+	unsigned int time = cacheSize + 1;
+
+	VertexCacheStatistics statistics;
+	statistics.transformed = 0;
+	for (size_t i = 0; i < indices.size(); i++){
+		unsigned int vertex = indices[i];
+		if (time - timestamps[vertex] > cacheSize){
+			timestamps[vertex] = time++;
+			statistics.transformed++;
+		}
+	}
+
+	size_t triangleCount = indices.size() / 3;
+	statistics.acmr = triangleCount ? (float)statistics.transformed / triangleCount : 0.0f;
+	statistics.atvr = vertexCount ? (float)statistics.transformed / vertexCount : 0.0f;
+	return statistics;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Vertex cache (Forsyth)
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const int   modelledCacheSize = 32;
+static const float cacheDecayPower   = 1.5f;
+static const float lastTriangleScore = 0.75f;
+static const float valenceBoostScale = 2.0f;
+static const float valenceBoostPower = 0.5f;
+
+// High scores for vertices that are in the cache and for vertices with few triangles left,
+// those would otherwise be left behind and transformed again later
+static float vertexScore(int cachePosition, unsigned int remainingTriangles)
+{
+	if (remainingTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0){
+		if (cachePosition < 3){
+			// Used by the last triangle. Fixed score, whichever of the three was used last
+			// depends on how the triangle is rasterised.
+			score = lastTriangleScore;
+		}else{
+			float scaler = 1.0f / (modelledCacheSize - 3);
+			score = powf(1.0f - (cachePosition - 3) * scaler, cacheDecayPower);
+		}
+	}
+	return score + valenceBoostScale * powf((float)remainingTriangles, -valenceBoostPower);
+}
+
+void optimizeVertexCache(std::vector<unsigned int> & indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	// Triangles of every vertex, the ones not emitted yet come first in each list
+	std::vector<unsigned int> remaining(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		remaining[indices[i]]++;
+
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> scores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		scores[v] = vertexScore(-1, remaining[v]);
+
+	// Start with the best triangle of the whole mesh
+	size_t best = 0;
+	float bestScore = -1.0f;
+	for (size_t t = 0; t < triangleCount; t++){
+		const unsigned int * triangle = &indices[t * 3];
+		float score = scores[triangle[0]] + scores[triangle[1]] + scores[triangle[2]];
+		if (score > bestScore){
+			best = t;
+			bestScore = score;
+		}
+	}
+
+	std::vector<unsigned int> output;
+	output.reserve(triangleCount * 3);
+	std::vector<char> emitted(triangleCount, 0);
+	size_t scanPosition = 0;
+
+	unsigned int cache[modelledCacheSize + 3];
+	int cacheCount = 0;
+
+	while (output.size() < triangleCount * 3){
+
+		if (best == (size_t)-1){
+			// Nothing connected to the cache is left, continue with the next triangle in input order
+			while (emitted[scanPosition])
+				scanPosition++;
+			best = scanPosition;
+		}
+
+		unsigned int triangle[3] = { indices[best * 3], indices[best * 3 + 1], indices[best * 3 + 2] };
+		output.insert(output.end(), triangle, triangle + 3);
+		emitted[best] = 1;
+
+		// Remove the triangle from the lists of its vertices
+		for (int k = 0; k < 3; k++){
+			unsigned int v = triangle[k];
+			unsigned int * list = &adjacency[offsets[v]];
+			for (unsigned int i = 0; i < remaining[v]; i++){
+				if (list[i] == best){
+					std::swap(list[i], list[remaining[v] - 1]);
+					remaining[v]--;
+					break;
+				}
+			}
+		}
+
+		// The vertices of the triangle move to the front of the (LRU) cache
+		unsigned int newCache[modelledCacheSize + 3];
+		int newCount = 0;
+		for (int k = 0; k < 3; k++){
+			if (std::find(newCache, newCache + newCount, triangle[k]) == newCache + newCount)
+				newCache[newCount++] = triangle[k];
+		}
+		for (int i = 0; i < cacheCount; i++){
+			if (std::find(triangle, triangle + 3, cache[i]) == triangle + 3)
+				newCache[newCount++] = cache[i];
+		}
+
+		for (int i = modelledCacheSize; i < newCount; i++)
+			cachePosition[newCache[i]] = -1; // dropped out of the cache
+
+		cacheCount = std::min(newCount, modelledCacheSize);
+		for (int i = 0; i < cacheCount; i++){
+			cache[i] = newCache[i];
+			cachePosition[cache[i]] = i;
+		}
+
+		// New scores for all vertices that moved, the next triangle is one of theirs
+		for (int i = 0; i < newCount; i++)
+			scores[newCache[i]] = vertexScore(cachePosition[newCache[i]], remaining[newCache[i]]);
+
+		best = (size_t)-1;
+		bestScore = -1.0f;
+		for (int i = 0; i < cacheCount; i++){
+			unsigned int v = cache[i];
+			const unsigned int * list = &adjacency[offsets[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++){
+				const unsigned int * candidate = &indices[list[j] * 3];
+				float score = scores[candidate[0]] + scores[candidate[1]] + scores[candidate[2]];
+				if (score > bestScore){
+					best = list[j];
+					bestScore = score;
+				}
+			}
+		}
+	}
+
+	indices.swap(output);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Overdraw
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct TriangleCluster
+{
+	size_t first;
+	size_t count;
+	float sortKey;
+};
+
+static bool facesMoreOutwards(const TriangleCluster & a, const TriangleCluster & b)
+{
+	return a.sortKey > b.sortKey;
+}
+
+void optimizeOverdraw(std::vector<unsigned int> & indices, const std::vector<glm::vec3> & vertices)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	// A new cluster starts wherever all three vertices of a triangle miss the cache
+	const unsigned int cacheSize = 16;
+	std::vector<unsigned int> timestamps(vertices.size(), 0);
+	unsigned int time = cacheSize + 1;
+
+	std::vector<TriangleCluster> clusters;
+	for (size_t t = 0; t < triangleCount; t++){
+		int misses = 0;
+		for (int k = 0; k < 3; k++){
+			unsigned int v = indices[t * 3 + k];
+			if (time - timestamps[v] > cacheSize){
+				timestamps[v] = time++;
+				misses++;
+			}
+		}
+		if (misses == 3 || clusters.empty()){
+			TriangleCluster cluster = { t, 0, 0.0f };
+			clusters.push_back(cluster);
+		}
+		clusters.back().count++;
+	}
+
+	// Area weighted centroid of the whole mesh
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t t = 0; t < triangleCount; t++){
+		const glm::vec3 & a = vertices[indices[t * 3]];
+		const glm::vec3 & b = vertices[indices[t * 3 + 1]];
+		const glm::vec3 & c = vertices[indices[t * 3 + 2]];
+		float area = glm::length(glm::cross(b - a, c - a));
+		meshCentroid += (a + b + c) * (area / 3.0f);
+		meshArea += area;
+	}
+	if (meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	// Clusters that point away from the centre are drawn first, they tend to cover the rest
+	for (size_t i = 0; i < clusters.size(); i++){
+		TriangleCluster & cluster = clusters[i];
+		glm::vec3 centroid(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = cluster.first; t < cluster.first + cluster.count; t++){
+			const glm::vec3 & a = vertices[indices[t * 3]];
+			const glm::vec3 & b = vertices[indices[t * 3 + 1]];
+			const glm::vec3 & c = vertices[indices[t * 3 + 2]];
+			glm::vec3 n = glm::cross(b - a, c - a);
+			float triangleArea = glm::length(n);
+			centroid += (a + b + c) * (triangleArea / 3.0f);
+			normal += n;
+			area += triangleArea;
+		}
+		if (area > 0.0f)
+			centroid /= area;
+		float length = glm::length(normal);
+		cluster.sortKey = length > 0.0f ? glm::dot(centroid - meshCentroid, normal / length) : 0.0f;
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), facesMoreOutwards);
+
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+	for (size_t i = 0; i < clusters.size(); i++)
+		output.insert(output.end(), indices.begin() + clusters[i].first * 3, indices.begin() + (clusters[i].first + clusters[i].count) * 3);
+	indices.swap(output);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Vertex fetch
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+static void remapVertices(std::vector<T> & attribute, const std::vector<unsigned int> & remap, size_t newCount)
+{
+	if (attribute.empty())
+		return;
+	std::vector<T> reordered(newCount);
+	for (size_t v = 0; v < remap.size(); v++){
+		if (remap[v] != 0xffffffffu)
+			reordered[remap[v]] = attribute[v];
+	}
+	attribute.swap(reordered);
+}
+
+void optimizeVertexFetch(
+	std::vector<unsigned int> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals
+){
+	std::vector<unsigned int> remap(vertices.size(), 0xffffffffu);
+	unsigned int next = 0;
+	for (size_t i = 0; i < indices.size(); i++){
+		unsigned int & vertex = remap[indices[i]];
+		if (vertex == 0xffffffffu)
+			vertex = next++;
+		indices[i] = vertex;
+	}
+
+	remapVertices(vertices, remap, next);
+	remapVertices(uvs, remap, next);
+	remapVertices(normals, remap, next);
+}
+
+void optimizeMesh(
+	std::vector<unsigned int> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals
+){
+	VertexCacheStatistics before = analyzeVertexCache(indices, vertices.size());
+
+	optimizeVertexCache(indices, vertices.size());
+	optimizeOverdraw(indices, vertices);
+	optimizeVertexFetch(indices, vertices, uvs, normals);
+
+	VertexCacheStatistics after = analyzeVertexCache(indices, vertices.size());
+	printf("Vertex cache : ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", before.acmr, after.acmr, before.atvr, after.atvr);
+}
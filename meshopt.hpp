@@ -0,0 +1,48 @@
+#ifndef MESHOPT_HPP
+#define MESHOPT_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Post-load optimisations for indexed triangle meshes (see loadOBJIndexed).
+// None of them changes what is drawn, only the order of triangles and vertices.
+
+// Result of simulating a FIFO post-transform cache with "cacheSize" entries.
+// acmr : transformed vertices per triangle (0.5 is ideal, 3 means no reuse at all)
+// atvr : transformed vertices per vertex (1 is ideal)
+struct VertexCacheStatistics
+{
+	unsigned int transformed;
+	float acmr;
+	float atvr;
+};
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<unsigned int> & indices, size_t vertexCount, unsigned int cacheSize = 16);
+
+// Reorders the triangles for the post-transform vertex cache (Tom Forsyth, "Linear-Speed
+// Vertex Cache Optimisation")
+void optimizeVertexCache(std::vector<unsigned int> & indices, size_t vertexCount);
+
+// Moves clusters of triangles that face outwards to the front, so less hidden surfaces are
+// shaded. Clusters start where the cache is cold anyway, the cache hit rate hardly changes.
+void optimizeOverdraw(std::vector<unsigned int> & indices, const std::vector<glm::vec3> & vertices);
+
+// Renumbers the vertices in the order they are first used, so the vertex fetch walks through
+// memory almost linearly. Unused vertices are dropped.
+void optimizeVertexFetch(
+	std::vector<unsigned int> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals
+);
+
+// All of the above, prints the cache statistics before and after
+void optimizeMesh(
+	std::vector<unsigned int> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals
+);
+
+#endif
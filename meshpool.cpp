@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "meshpool.hpp"
+#include "resources.hpp"
+#include "glstate.hpp"
+#include "renderqueue.hpp"
+#include "streambuffer.hpp"
+
+static_assert(sizeof(MeshDrawData) == 96, "MeshDrawData must match DrawData in the shader");
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Pools
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A free range of vertices or indices
+struct PoolRange
+{
+	GLuint first, count;
+};
+
+struct MeshPool
+{
+	unsigned long long format; // see vertexFormat
+	unsigned int vertexSize;
+	GLuint vertexCapacity, indexCapacity;
+	GLuint vertexArray, vertexBuffer, indexBuffer;
+	std::vector<PoolRange> freeVertices, freeIndices; // sorted, neighbours are merged
+	unsigned int meshes;
+};
+
+static std::vector<MeshPool *> pools;
+static GLuint drawIdBuffer = 0; // 0, 1, 2, ... for DRAW_ID_LOCATION, shared by all pools
+
+// First fit
+static bool allocateRange(std::vector<PoolRange> & ranges, GLuint count, GLuint & out_first)
+{
+	for (size_t i = 0; i < ranges.size(); i++){
+		if (ranges[i].count < count)
+			continue;
+		out_first = ranges[i].first;
+		ranges[i].first += count;
+		ranges[i].count -= count;
+		if (ranges[i].count == 0)
+			ranges.erase(ranges.begin() + i);
+		return true;
+	}
+	return false;
+}
+
+static void freeRange(std::vector<PoolRange> & ranges, GLuint first, GLuint count)
+{
+	size_t i = 0;
+	while (i < ranges.size() && ranges[i].first < first)
+		i++;
+	PoolRange range = { first, count };
+	ranges.insert(ranges.begin() + i, range);
+
+	if (i + 1 < ranges.size() && ranges[i].first + ranges[i].count == ranges[i + 1].first){
+		ranges[i].count += ranges[i + 1].count;
+		ranges.erase(ranges.begin() + i + 1);
+	}
+	if (i > 0 && ranges[i - 1].first + ranges[i - 1].count == ranges[i].first){
+		ranges[i - 1].count += ranges[i].count;
+		ranges.erase(ranges.begin() + i);
+	}
+}
+
+// Meshes can share a vertex array if their attributes are the same
+static unsigned long long vertexFormat(const MeshFile & file)
+{
+	const MeshFileHeader & header = *file.header;
+	return hashBytes(file.attributes, header.attributeCount * sizeof(MeshAttribute), hashBytes(&header.vertexSize, sizeof(header.vertexSize)));
+}
+
+static MeshPool * createMeshPool(const MeshFile & file, GLuint vertexCapacity, GLuint indexCapacity)
+{
+	const MeshFileHeader & header = *file.header;
+
+	if (!drawIdBuffer){
+		std::vector<GLuint> ids(MAX_DRAWS_PER_CALL);
+		for (GLuint i = 0; i < MAX_DRAWS_PER_CALL; i++)
+			ids[i] = i;
+		drawIdBuffer = createBuffer("draw ids");
+		bufferData(GL_ARRAY_BUFFER, drawIdBuffer, (GLsizeiptr)(ids.size() * sizeof(GLuint)), &ids[0], GL_STATIC_DRAW);
+	}
+
+	MeshPool * pool = new MeshPool();
+	pool->format = vertexFormat(file);
+	pool->vertexSize = header.vertexSize;
+	pool->vertexCapacity = vertexCapacity;
+	pool->indexCapacity = indexCapacity;
+	pool->meshes = 0;
+	PoolRange vertices = { 0, vertexCapacity }, indices = { 0, indexCapacity };
+	pool->freeVertices.push_back(vertices);
+	pool->freeIndices.push_back(indices);
+
+	// The same attributes as uploadMesh, the meshes are found by baseVertex
+	pool->vertexArray = createVertexArray("mesh pool");
+	bindVertexArray(pool->vertexArray);
+
+	pool->vertexBuffer = createBuffer("mesh pool vertices");
+	bufferData(GL_ARRAY_BUFFER, pool->vertexBuffer, (GLsizeiptr)vertexCapacity * header.vertexSize, NULL, GL_STATIC_DRAW);
+	for (unsigned int i = 0; i < header.attributeCount; i++){
+		const MeshAttribute & attribute = file.attributes[i];
+		glEnableVertexAttribArray(attribute.location);
+		glVertexAttribPointer(attribute.location, attribute.components, attribute.type,
+			(GLboolean)attribute.normalized, attribute.stride, (void*)(size_t)attribute.offset);
+	}
+
+	// One number per instance, a draw with baseInstance i reads i
+	glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+	glEnableVertexAttribArray(DRAW_ID_LOCATION);
+	glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, 0, (void*)0);
+	glVertexAttribDivisor(DRAW_ID_LOCATION, 1);
+
+	pool->indexBuffer = createBuffer("mesh pool indices");
+	bufferData(GL_ELEMENT_ARRAY_BUFFER, pool->indexBuffer, (GLsizeiptr)indexCapacity * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+
+	bindVertexArray(0);
+
+	pools.push_back(pool);
+	return pool;
+}
+
+static void deleteMeshPool(MeshPool * pool)
+{
+	deleteBuffer(pool->indexBuffer);
+	deleteBuffer(pool->vertexBuffer);
+	deleteVertexArray(pool->vertexArray);
+	pools.erase(std::find(pools.begin(), pools.end(), pool));
+	delete pool;
+}
+
+bool addToMeshPool(const MeshFile & file, Mesh & mesh)
+{
+	const MeshFileHeader & header = *file.header;
+	unsigned long long format = vertexFormat(file);
+
+	MeshPool * pool = NULL;
+	GLuint baseVertex = 0, firstIndex = 0;
+	GLuint largestVertices = 0, largestIndices = 0;
+	for (size_t i = 0; i < pools.size() && !pool; i++){
+		if (pools[i]->format != format)
+			continue;
+		largestVertices = std::max(largestVertices, pools[i]->vertexCapacity);
+		largestIndices = std::max(largestIndices, pools[i]->indexCapacity);
+		if (!allocateRange(pools[i]->freeVertices, header.vertexCount, baseVertex))
+			continue;
+		if (!allocateRange(pools[i]->freeIndices, header.indexCount, firstIndex)){
+			freeRange(pools[i]->freeVertices, baseVertex, header.vertexCount);
+			continue;
+		}
+		pool = pools[i];
+	}
+
+	if (!pool){
+		GLuint vertexCapacity = largestVertices ? largestVertices * 2 : (GLuint)(MESH_POOL_FIRST_VERTEX_BYTES / header.vertexSize);
+		GLuint indexCapacity = largestIndices ? largestIndices * 2 : (GLuint)MESH_POOL_FIRST_INDICES;
+		vertexCapacity = std::max(std::min(vertexCapacity, (GLuint)(MESH_POOL_VERTEX_BYTES / header.vertexSize)), header.vertexCount);
+		indexCapacity = std::max(std::min(indexCapacity, (GLuint)MESH_POOL_INDICES), header.indexCount);
+		pool = createMeshPool(file, vertexCapacity, indexCapacity);
+		allocateRange(pool->freeVertices, header.vertexCount, baseVertex);
+		allocateRange(pool->freeIndices, header.indexCount, firstIndex);
+	}
+	pool->meshes++;
+
+	glBindBuffer(GL_ARRAY_BUFFER, pool->vertexBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)baseVertex * pool->vertexSize, (GLsizeiptr)header.vertexDataSize, file.vertexData);
+
+	// The index buffer belongs to the vertex array. 16 bit indices are widened, a multi-draw
+	// has only one index type.
+	bindVertexArray(pool->vertexArray);
+	GLintptr indexOffset = (GLintptr)firstIndex * sizeof(GLuint);
+	if (header.indexType == GL_UNSIGNED_INT){
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexOffset, (GLsizeiptr)header.indexDataSize, file.indexData);
+	}else{
+		std::vector<GLuint> indices(header.indexCount);
+		const unsigned short * shortIndices = (const unsigned short *)file.indexData;
+		for (unsigned int i = 0; i < header.indexCount; i++)
+			indices[i] = shortIndices[i];
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexOffset, (GLsizeiptr)(indices.size() * sizeof(GLuint)), &indices[0]);
+	}
+	bindVertexArray(0);
+
+	mesh.pool = pool;
+	mesh.vertexArray = pool->vertexArray;
+	mesh.vertexBuffer = pool->vertexBuffer;
+	mesh.indexBuffer = pool->indexBuffer;
+	mesh.baseVertex = (GLint)baseVertex;
+	mesh.firstIndex = firstIndex;
+	mesh.vertexCount = header.vertexCount;
+	mesh.indexCount = (GLsizei)header.indexCount;
+	mesh.indexType = GL_UNSIGNED_INT;
+	return true;
+}
+
+void removeFromMeshPool(Mesh & mesh)
+{
+	MeshPool * pool = mesh.pool;
+	freeRange(pool->freeVertices, (GLuint)mesh.baseVertex, mesh.vertexCount);
+	freeRange(pool->freeIndices, mesh.firstIndex, (GLuint)mesh.indexCount);
+	if (--pool->meshes == 0)
+		deleteMeshPool(pool);
+	mesh.pool = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Multi-draw
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// One batch per program, texture and pool. The layer of the texture is in the draw data.
+struct MeshBatchKey
+{
+	GLuint program;
+	GLenum textureTarget;
+	GLuint texture;
+	MeshPool * pool;
+
+	bool operator < (const MeshBatchKey & other) const
+	{
+		if (program != other.program) return program < other.program;
+		if (texture != other.texture) return texture < other.texture;
+		return pool < other.pool;
+	}
+};
+
+struct MeshBatch
+{
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<MeshDrawData> draws;
+};
+
+typedef std::map<MeshBatchKey, MeshBatch> MeshBatchMap;
+
+static MeshBatchMap meshBatches;
+
+// Commands and draw data of one frame, about 18,000 draws at 116 bytes. Each call is its
+// commands followed by its draw data, both aligned for glBindBufferRange. Frames with more
+// draws grow the buffer (see growStreamBuffer).
+static const GLsizeiptr drawFrameSize = 2 * 1024 * 1024;
+static StreamBuffer drawStream;
+
+static GLsizeiptr alignUp(GLsizeiptr size, GLsizeiptr alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+static GLsizeiptr commandBytes(GLsizei drawCount)
+{
+	return alignUp(drawCount * (GLsizeiptr)sizeof(DrawElementsIndirectCommand), drawStream.alignment);
+}
+
+bool multiDrawSupported()
+{
+	// A driver may have shader storage blocks in the fragment shader only
+	static int supported = -1;
+	if (supported < 0){
+		GLint blocks = 0;
+		if (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_program_interface_query)
+			glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &blocks);
+		supported = blocks > 0 ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+void bindMeshDrawBlock(GLuint program)
+{
+	if (!multiDrawSupported())
+		return;
+	GLuint block = glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "MeshDraws");
+	if (block != GL_INVALID_INDEX)
+		glShaderStorageBlockBinding(program, block, MESH_DRAWS_BINDING);
+}
+
+void queueMeshDraw(GLuint program, const TextureLayer & texture, const Mesh & mesh, const glm::mat4 & model)
+{
+	if (!mesh.pool)
+		return;
+
+	MeshBatchKey key = { program, texture.target, texture.texture, mesh.pool };
+	MeshBatch & batch = meshBatches[key];
+
+	// baseInstance is the index inside its call, see flushMeshDraws
+	DrawElementsIndirectCommand command = { (GLuint)mesh.indexCount, 1, mesh.firstIndex, mesh.baseVertex, (GLuint)(batch.commands.size() % MAX_DRAWS_PER_CALL) };
+	batch.commands.push_back(command);
+
+	MeshDrawData draw;
+	draw.M = model;
+	draw.PositionScale = glm::vec4(mesh.positionScale, (float)texture.layer);
+	draw.PositionBias = glm::vec4(mesh.positionBias, 0.0f);
+	batch.draws.push_back(draw);
+}
+
+void flushMeshDraws()
+{
+	size_t queued = 0;
+	for (MeshBatchMap::iterator it = meshBatches.begin(); it != meshBatches.end(); ++it)
+		queued += it->second.commands.size();
+	if (queued == 0)
+		return;
+
+	if (!drawStream.buffer){
+		GLint storageAlignment = 0;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+		createStreamBuffer(drawStream, GL_DRAW_INDIRECT_BUFFER, drawFrameSize, std::max(storageAlignment, 16), "mesh draws");
+	}
+
+	GLsizeiptr total = 0;
+	for (MeshBatchMap::iterator it = meshBatches.begin(); it != meshBatches.end(); ++it){
+		GLsizei count = (GLsizei)it->second.commands.size();
+		for (GLsizei first = 0; first < count; first += MAX_DRAWS_PER_CALL){
+			GLsizei n = std::min(count - first, (GLsizei)MAX_DRAWS_PER_CALL);
+			total += commandBytes(n) + alignUp(n * (GLsizeiptr)sizeof(MeshDrawData), drawStream.alignment);
+		}
+	}
+
+	// Like flushInstances : the only allocation of the frame, so a bigger buffer can replace it
+	if (total > drawStream.regionSize)
+		growStreamBuffer(drawStream, total, "mesh draws");
+
+	StreamAllocation allocation;
+	if (!allocateStream(drawStream, total, allocation)){
+		printf("%u bytes of mesh draws do not fit into the draw buffer\n", (unsigned int)total);
+		for (MeshBatchMap::iterator it = meshBatches.begin(); it != meshBatches.end(); ++it){
+			it->second.commands.clear();
+			it->second.draws.clear();
+		}
+		return;
+	}
+
+	size_t offset = allocation.offset;
+	for (MeshBatchMap::iterator it = meshBatches.begin(); it != meshBatches.end(); ++it){
+		MeshBatch & batch = it->second;
+		GLsizei count = (GLsizei)batch.commands.size();
+		for (GLsizei first = 0; first < count; first += MAX_DRAWS_PER_CALL){
+			GLsizei n = std::min(count - first, (GLsizei)MAX_DRAWS_PER_CALL);
+			char * data = (char *)allocation.data + (offset - allocation.offset);
+			memcpy(data, &batch.commands[first], n * sizeof(DrawElementsIndirectCommand));
+			memcpy(data + commandBytes(n), &batch.draws[first], n * sizeof(MeshDrawData));
+
+			// Like instance batches, sorted in front of the other draws with the same state
+			PrimitiveDraw draw = { it->first.pool->vertexArray, GL_TRIANGLES, 0, GL_UNSIGNED_INT, 0, 0 };
+			TextureLayer texture = { it->first.textureTarget, it->first.texture, 0 };
+			submitMultiDraw(it->first.program, texture, draw, 0.0f, offset, n);
+
+			offset += commandBytes(n) + alignUp(n * (GLsizeiptr)sizeof(MeshDrawData), drawStream.alignment);
+		}
+		batch.commands.clear();
+		batch.draws.clear();
+	}
+	commitStream(drawStream, allocation);
+}
+
+void drawMeshBatch(size_t offset, GLsizei drawCount)
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawStream.buffer);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, MESH_DRAWS_BINDING, drawStream.buffer,
+		(GLintptr)(offset + commandBytes(drawCount)), drawCount * (GLsizeiptr)sizeof(MeshDrawData));
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)offset, drawCount, 0);
+	countDrawCall();
+}
+
+void deleteMeshPools()
+{
+	while (!pools.empty())
+		deleteMeshPool(pools.back());
+	if (drawIdBuffer)
+		deleteBuffer(drawIdBuffer);
+	if (drawStream.buffer)
+		deleteStreamBuffer(drawStream);
+	meshBatches.clear();
+}
@@ -0,0 +1,76 @@
+#ifndef MESHPOOL_HPP
+#define MESHPOOL_HPP
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+#include "texturearray.hpp"
+
+// Static meshes in shared buffers. All meshes with the same vertex format (the attributes of
+// their mesh file) go into one pool : one vertex array, one vertex buffer and one index buffer
+// with 32 bit indices. Each mesh is a range of vertices (Mesh::baseVertex) and indices
+// (Mesh::firstIndex), so switching between them binds nothing, and with multi-draw indirect
+// (see queueMeshDraw) all meshes of a pool are drawn with a single call.
+//
+// A pool is never resized. A mesh that does not fit starts a new pool of its format with twice
+// the capacity of the largest one so far (at least the mesh), up to the maximums below. The
+// first pool of a format is small, a scene with few meshes per format needs 2 MB for each.
+// A pool is deleted with its last mesh.
+//
+// Only call these functions from the thread that owns the OpenGL context.
+
+#define MESH_POOL_FIRST_VERTEX_BYTES (1 << 20)
+#define MESH_POOL_FIRST_INDICES      (256 << 10) // 1 MB
+#define MESH_POOL_VERTEX_BYTES       (32 << 20)
+#define MESH_POOL_INDICES            (4 << 20)   // 16 MB
+
+// Places the vertices and indices of the file in a pool, sets vertexArray, the buffers, the
+// ranges and indexCount/indexType of the mesh. Called by uploadMesh.
+bool addToMeshPool(const MeshFile & file, Mesh & mesh);
+// Frees the ranges of the mesh, called by deleteMesh
+void removeFromMeshPool(Mesh & mesh);
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// Multi-draw : queueMeshDraw collects pooled meshes per program, texture and pool,
+// flushMeshDraws writes one DrawElementsIndirectCommand and one MeshDrawData record per mesh
+// and submits one glMultiDrawElementsIndirect per batch to the render queue.
+//
+// The shader (SHADER_MULTI_DRAW, see shader.hpp) reads its MeshDrawData from the shader storage
+// block "MeshDraws". The index comes from the vertex attribute DRAW_ID_LOCATION : every command
+// draws one instance with baseInstance = its index, and the attribute (divisor 1) reads the
+// numbers 0, 1, 2, ... of a static buffer, so it sees the baseInstance.
+//
+// Needs ARB_multi_draw_indirect, ARB_base_instance, ARB_shader_storage_buffer_object (in the
+// vertex shader) and ARB_program_interface_query, OpenGL 4.3 has them all. Without them,
+// pooled meshes are drawn one by one with glDrawElementsBaseVertex.
+
+#define DRAW_ID_LOCATION       9
+#define MESH_DRAWS_BINDING     0 // shader storage binding point of "MeshDraws"
+#define MAX_DRAWS_PER_CALL 16384 // longer batches are split
+
+// Matches "DrawData" in StandardShading.vertexshader (std430), 96 bytes
+struct MeshDrawData
+{
+	glm::mat4 M;
+	glm::vec4 PositionScale; // w : texture array layer, as in PerObject
+	glm::vec4 PositionBias;
+};
+
+bool multiDrawSupported();
+
+// Connects the "MeshDraws" block of a program to MESH_DRAWS_BINDING (if it has the block)
+void bindMeshDrawBlock(GLuint program);
+
+// The mesh must be pooled (see uploadMesh)
+void queueMeshDraw(GLuint program, const TextureLayer & texture, const Mesh & mesh, const glm::mat4 & model);
+void flushMeshDraws();
+
+// Executes a batch submitted by flushMeshDraws, the pool's vertex array must be bound
+// (the render queue does both)
+void drawMeshBatch(size_t offset, GLsizei drawCount);
+
+// Deletes the remaining pools, the draw ID buffer and the command buffer
+void deleteMeshPools();
+
+#endif
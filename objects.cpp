@@ -4,10 +4,41 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <vector>
+#include <map>
 
 // Include GLEW
 #include <GL/glew.h>
 
+#include <glm/glm.hpp>
+
+#include "objects.hpp"
+#include "culling.hpp"
+
+#include "resources.hpp"
+#include "glstate.hpp"
+
+
+void drawPrimitive(const PrimitiveDraw & draw, GLsizei instances)
+{
+	countDrawCall();
+	if (draw.indexType && (draw.baseVertex || draw.firstIndex)){
+		// Ausschnitt eines Mesh-Pools
+		size_t indexSize = draw.indexType == GL_UNSIGNED_INT ? 4 : draw.indexType == GL_UNSIGNED_SHORT ? 2 : 1;
+		void * indices = (void*)(draw.firstIndex * indexSize);
+		if (instances == 1)
+			glDrawElementsBaseVertex(draw.mode, draw.count, draw.indexType, indices, draw.baseVertex);
+		else
+			glDrawElementsInstancedBaseVertex(draw.mode, draw.count, draw.indexType, indices, instances, draw.baseVertex);
+	}
+	else if (draw.indexType && instances == 1)
+		glDrawElements(draw.mode, draw.count, draw.indexType, (void*)0);
+	else if (draw.indexType)
+		glDrawElementsInstanced(draw.mode, draw.count, draw.indexType, (void*)0, instances);
+	else if (instances == 1)
+		glDrawArrays(draw.mode, 0, draw.count);
+	else
+		glDrawArraysInstanced(draw.mode, 0, draw.count, instances);
+}
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////    DrahtWuerfel-Objekt
@@ -18,8 +49,8 @@ GLuint VertexArrayIDWireCube = 0;
 static void createWireCube()
 {
 	// Vertexarrays kapseln ab OpenGL3 Eckpunkte, Texturen und Normalen
-	glGenVertexArrays(1, &VertexArrayIDWireCube);
-	glBindVertexArray(VertexArrayIDWireCube);
+	VertexArrayIDWireCube = createVertexArray("wire cube");
+	bindVertexArray(VertexArrayIDWireCube);
 
 	// Our vertices. Tree consecutive floats give a 3D vertex; Three consecutive vertices give a triangle.
 	// A cube has 6 faces with 2 triangles each, so this makes 6*2=12 triangles, and 12*3 vertices
@@ -39,10 +70,8 @@ static void createWireCube()
 	};
 
 	// Vertexbuffer-Daten z.B. auf Grafikkarte kopieren
-	GLuint vertexbuffer;
-	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
+	GLuint vertexbuffer = createBuffer("wire cube vertices");
+	bufferData(GL_ARRAY_BUFFER, vertexbuffer, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
 
 	// Erklren wie die Vertex-Daten zu benutzen sind
 	glEnableVertexAttribArray(0); // Kein Disable ausfhren !
@@ -55,18 +84,30 @@ static void createWireCube()
 			(void*)0            // array buffer offset
 	);
 
-	glBindVertexArray(0);
+	bindVertexArray(0);
 }
 
-void drawWireCube()
+PrimitiveDraw getWireCube()
 {
 	if (!VertexArrayIDWireCube)
 	{
 		createWireCube();
 	}
 
-	glBindVertexArray(VertexArrayIDWireCube);
-	glDrawArrays(GL_LINES, 0, 24); // 12 Linien haben 24 Punkte
+	PrimitiveDraw draw = { VertexArrayIDWireCube, GL_LINES, 24, 0, 0, 0 }; // 12 Linien haben 24 Punkte
+	return draw;
+}
+
+PrimitiveDraw bindWireCube()
+{
+	PrimitiveDraw draw = getWireCube();
+	bindVertexArray(draw.vertexArray);
+	return draw;
+}
+
+void drawWireCube()
+{
+	drawPrimitive(bindWireCube());
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -80,8 +121,8 @@ static void createCube()
 	GLuint vertexbuffer;
 	GLuint colorbuffer;
 	
-	glGenVertexArrays(1, &VertexArrayIDSolidCube);
-	glBindVertexArray(VertexArrayIDSolidCube);
+	VertexArrayIDSolidCube = createVertexArray("cube");
+	bindVertexArray(VertexArrayIDSolidCube);
 
 	// Our vertices. Tree consecutive floats give a 3D vertex; Three consecutive vertices give a triangle.
 	// A cube has 6 faces with 2 triangles each, so this makes 6*2=12 triangles, and 12*3 vertices
@@ -100,9 +141,8 @@ static void createCube()
 		 1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 1.0f,  1.0f,-1.0f, 1.0f
 	};
 
-	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
+	vertexbuffer = createBuffer("cube vertices");
+	bufferData(GL_ARRAY_BUFFER, vertexbuffer, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
 
 	// One color for each vertex. They were generated randomly.
 	static const GLfloat g_color_buffer_data[] = { 
@@ -120,9 +160,8 @@ static void createCube()
 		0.673f,  0.211f,  0.457f,	0.820f,  0.883f,  0.371f,	0.982f,  0.099f,  0.879f
 	};
 
-	glGenBuffers(1, &colorbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, colorbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(g_color_buffer_data), g_color_buffer_data, GL_STATIC_DRAW);
+	colorbuffer = createBuffer("cube colors");
+	bufferData(GL_ARRAY_BUFFER, colorbuffer, sizeof(g_color_buffer_data), g_color_buffer_data, GL_STATIC_DRAW);
 
 	glEnableVertexAttribArray(0); // Kein Disable ausfhren !
 	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
@@ -147,19 +186,31 @@ static void createCube()
 			(void*)0                          // array buffer offset
 	);
 	
-	glBindVertexArray(0);
+	bindVertexArray(0);
 }
 
-void drawCube()
+PrimitiveDraw getCube()
 {
 	if (!VertexArrayIDSolidCube)
 	{
 		createCube();
 	}
 
+	PrimitiveDraw draw = { VertexArrayIDSolidCube, GL_TRIANGLES, 12*3, 0, 0, 0 }; // 12*3 indices starting at 0 -> 12 triangles
+	return draw;
+}
+
+PrimitiveDraw bindCube()
+{
+	PrimitiveDraw draw = getCube();
+	bindVertexArray(draw.vertexArray);
+	return draw;
+}
+
+void drawCube()
+{
 	// Draw the triangles !
-	glBindVertexArray(VertexArrayIDSolidCube);
-	glDrawArrays(GL_TRIANGLES, 0, 12*3); // 12*3 indices starting at 0 -> 12 triangles
+	drawPrimitive(bindCube());
 }
 
 
@@ -167,104 +218,171 @@ void drawCube()
 ////    Kugel-Objekt
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-GLuint VertexArrayIDSphere = 0;
-GLuint lats;
-GLuint longs;
+// Fuer jede Feinheit (lats, longs) wird die Kugel nur einmal erzeugt und dann wiederverwendet.
+struct SphereGeometry
+{
+	GLuint vertexArray;
+	GLsizei indexCount;
+	GLenum indexType;
+};
 
+static std::map<std::pair<GLuint, GLuint>, SphereGeometry> spheres;
 
-// Dieser Code  basiert auf http://ozark.hendrix.edu/~burch/cs/490/sched/feb8/
-static void createSphere()
+// Indizierte Dreiecke, jeder Eckpunkt wird nur einmal gespeichert. Bei der Einheitskugel
+// ist die Normale gleich der Position, beide Attribute lesen deshalb denselben Buffer.
+// Die Pole liegen wie bisher auf der z-Achse.
+static SphereGeometry createSphere(GLuint lats, GLuint longs)
 {
-	glGenVertexArrays(1, &VertexArrayIDSphere);
-	glBindVertexArray(VertexArrayIDSphere);
+	std::vector<GLfloat> vertices;
+	vertices.reserve(3 * (lats + 1) * (longs + 1));
+	for (GLuint i = 0; i <= lats; i++)
+	{
+		GLfloat lat = (GLfloat) M_PI * ((GLfloat) -0.5 + (GLfloat) i / (GLfloat) lats);
+		GLfloat z = sin(lat);
+		GLfloat zr = cos(lat);
+
+		for (GLuint j = 0; j <= longs; j++)
+		{
+			GLfloat lng = (GLfloat) 2 * (GLfloat) M_PI * (GLfloat) j / (GLfloat) longs;
+			vertices.push_back(cos(lng) * zr);
+			vertices.push_back(sin(lng) * zr);
+			vertices.push_back(z);
+		}
+	}
+
+	// Zwei Dreiecke pro Feld, gegen den Uhrzeigersinn von aussen gesehen. An den Polen
+	// faellt jeweils eines weg, dort liegen zwei seiner Eckpunkte aufeinander.
+	std::vector<GLuint> indices;
+	for (GLuint i = 0; i < lats; i++)
+	{
+		for (GLuint j = 0; j < longs; j++)
+		{
+			GLuint a = i * (longs + 1) + j;
+			GLuint b = a + longs + 1;
+			if (i != 0)
+			{
+				indices.push_back(a);
+				indices.push_back(a + 1);
+				indices.push_back(b);
+			}
+			if (i != lats - 1)
+			{
+				indices.push_back(a + 1);
+				indices.push_back(b + 1);
+				indices.push_back(b);
+			}
+		}
+	}
 
-	static GLuint sphereVertexBuffer = 0;
-	static GLfloat* sphereVertexBufferData = NULL;
-	static GLfloat* sphereNormalBufferData = NULL;
+	SphereGeometry sphere;
+	sphere.vertexArray = createVertexArray("sphere");
+	sphere.indexCount = (GLsizei)indices.size();
+	bindVertexArray(sphere.vertexArray);
 
-	sphereVertexBufferData = new GLfloat [6 * (lats + 1) * (longs + 1)];
-	sphereNormalBufferData = new GLfloat [6 * (lats + 1) * (longs + 1)];
-	int index = 0;
+	GLuint vertexbuffer = createBuffer("sphere vertices");
+	bufferData(GL_ARRAY_BUFFER, vertexbuffer, sizeof(GLfloat) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
 
-    for (int i = 0; i <= lats; i++) 
+	glEnableVertexAttribArray(0); // Kein Disable ausfhren !
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0); // Positionen
+	glEnableVertexAttribArray(2); // Kein Disable ausfhren !
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0); // Normalen
+
+	// Der Indexbuffer gehoert zum Vertexarray, 16 Bit reichen fast immer
+	GLuint indexbuffer = createBuffer("sphere indices");
+	if (vertices.size() / 3 <= 65536)
 	{
-          GLfloat lat0 = (GLfloat) M_PI * ((GLfloat) -0.5 + (GLfloat) (i - 1) / (GLfloat) lats);
-          GLfloat z0  = sin(lat0);
-          GLfloat zr0 =  cos(lat0);
-    
-          GLfloat lat1 = (GLfloat) M_PI * ((GLfloat) -0.5 + (GLfloat) i / (GLfloat) lats);
-          GLfloat z1 = sin(lat1);
-          GLfloat zr1 = cos(lat1);
-    
-		  for (int j = 0; j <= longs; j++)
-		  {
-              GLfloat lng = (GLfloat) 2 * (GLfloat) M_PI * (GLfloat) (j - 1) / (GLfloat) longs;
-              GLfloat x = cos(lng);
-              GLfloat y = sin(lng);
-
-			  sphereNormalBufferData[index] = x * zr0;
-			  sphereVertexBufferData[index++] = x * zr0;
-			  sphereNormalBufferData[index] = y * zr0;
-			  sphereVertexBufferData[index++] = y * zr0;
-			  sphereNormalBufferData[index] = z0;
-			  sphereVertexBufferData[index++] = z0;
-			  sphereNormalBufferData[index] = x * zr1;
-			  sphereVertexBufferData[index++] = x * zr1;
-			  sphereNormalBufferData[index] = y * zr1;
-			  sphereVertexBufferData[index++] = y * zr1;
-			  sphereNormalBufferData[index] = z1;
-			  sphereVertexBufferData[index++] = z1;
-          }
-     }
+		std::vector<GLushort> indices16(indices.begin(), indices.end());
+		bufferData(GL_ELEMENT_ARRAY_BUFFER, indexbuffer, sizeof(GLushort) * indices16.size(), &indices16[0], GL_STATIC_DRAW);
+		sphere.indexType = GL_UNSIGNED_SHORT;
+	}
+	else
+	{
+		bufferData(GL_ELEMENT_ARRAY_BUFFER, indexbuffer, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+		sphere.indexType = GL_UNSIGNED_INT;
+	}
 
-	GLuint vertexbuffer;
-	GLuint normalbuffer;
-	
-	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * (lats + 1) * (longs + 1), sphereVertexBufferData, GL_STATIC_DRAW);
+	bindVertexArray(0);
+	return sphere;
+}
 
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 6 * (lats + 1) * (longs + 1), sphereNormalBufferData, GL_STATIC_DRAW);
+PrimitiveDraw getSphere(GLuint slats, GLuint slongs)
+{
+	if (slats < 2) slats = 2;
+	if (slongs < 3) slongs = 3;
 
-	glEnableVertexAttribArray(0); // Kein Disable ausfhren !
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glVertexAttribPointer(
-			0,                  // attribute. No particular reason for 0, but must match the layout in the shader.
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-	);
+	std::pair<GLuint, GLuint> key(slats, slongs);
+	std::map<std::pair<GLuint, GLuint>, SphereGeometry>::iterator it = spheres.find(key);
+	if (it == spheres.end())
+		it = spheres.insert(std::make_pair(key, createSphere(slats, slongs))).first;
 
-	// 2nd attribute buffer : normals
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glEnableVertexAttribArray(2); // Kein Disable ausfhren !
-	glVertexAttribPointer(
-			2,                                // attribute. No particular reason for 2, but must match the layout in the shader.
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-	);
+	PrimitiveDraw draw = { it->second.vertexArray, GL_TRIANGLES, it->second.indexCount, it->second.indexType, 0, 0 };
+	return draw;
+}
 
-	glBindVertexArray(0);
+PrimitiveDraw bindSphere(GLuint slats, GLuint slongs)
+{
+	PrimitiveDraw draw = getSphere(slats, slongs);
+	bindVertexArray(draw.vertexArray);
+	return draw;
 }
 
-// Nur die Angabe bei der ersten Kugel ist relevant
 void drawSphere(GLuint slats, GLuint slongs)
 {
-	if (!VertexArrayIDSphere)
-	{
-		lats = slats;
-		longs = slongs;
-		createSphere();
-	}
-
-	glBindVertexArray(VertexArrayIDSphere);
 	// Draw the triangles !
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 2 * (lats + 1) * (longs + 1)); 
-}
\ No newline at end of file
+	drawPrimitive(bindSphere(slats, slongs));
+}
+
+// Stufen der Feinheit, ab welchem Radius in Pixeln sie verwendet werden
+static const struct { float minRadius; GLuint lats; GLuint longs; } sphereLODs[] = {
+	{ 0.0f,   6,  8 },
+	{ 8.0f,  10, 12 },
+	{ 32.0f, 16, 20 },
+	{ 128.0f, 32, 40 },
+};
+
+void sphereLOD(float screenRadius, GLuint & slats, GLuint & slongs)
+{
+	int level = 0;
+	while (level + 1 < (int)(sizeof(sphereLODs) / sizeof(sphereLODs[0])) && screenRadius >= sphereLODs[level + 1].minRadius)
+		level++;
+	slats = sphereLODs[level].lats;
+	slongs = sphereLODs[level].longs;
+}
+
+float projectedRadius(const glm::mat4 & modelView, const glm::mat4 & projection, float viewportHeight)
+{
+	// Groesster Radius nach der Skalierung (Laenge der laengsten Achse der Matrix)
+	float radius = glm::max(glm::length(glm::vec3(modelView[0])),
+		glm::max(glm::length(glm::vec3(modelView[1])), glm::length(glm::vec3(modelView[2]))));
+	float distance = -modelView[3].z; // Abstand des Mittelpunkts vor der Kamera
+	if (distance <= radius)
+		return viewportHeight; // Kamera in oder direkt an der Kugel
+
+	// projection[1][1] = 1 / tan(fovy / 2)
+	return radius / distance * projection[1][1] * viewportHeight * 0.5f;
+}
+
+static Bounds boundsOf(float halfSize, float radius)
+{
+	Bounds bounds;
+	bounds.min = glm::vec3(-halfSize);
+	bounds.max = glm::vec3(halfSize);
+	bounds.center = glm::vec3(0.0f);
+	bounds.radius = radius;
+	return bounds;
+}
+
+Bounds wireCubeBounds()
+{
+	return boundsOf(1.0f, sqrtf(3.0f)); // Ecken bei (+-1, +-1, +-1)
+}
+
+Bounds cubeBounds()
+{
+	return boundsOf(1.0f, sqrtf(3.0f));
+}
+
+Bounds sphereBounds()
+{
+	return boundsOf(1.0f, 1.0f);
+}
@@ -1,8 +1,47 @@
 #ifndef OBJECTS_HPP
 #define OBJECTS_HPP
 
+#include <glm/glm.hpp>
+
+#include "culling.hpp"
+
 void drawWireCube(); // Wuerfel mit Kantenlaenge 2 im Drahtmodell
 void drawCube();     // Bunter Wuerfel mit Kantenlaenge 2
 void drawSphere(GLuint slices, GLuint stacks); // Kugel mit radius 1 bzw. Durchmesser 2
 
+// Was glDrawArrays bzw. glDrawElements fuer ein gebundenes Objekt brauchen
+struct PrimitiveDraw
+{
+	GLuint vertexArray;
+	GLenum mode;
+	GLsizei count;
+	GLenum indexType; // 0 : keine Indizes, glDrawArrays
+	GLint baseVertex; // Meshes im Mesh-Pool (s. meshpool.hpp), sonst 0
+	GLuint firstIndex;
+};
+
+// Erzeugen das Objekt bei Bedarf, binden aber nichts (z. B. fuer die Render-Queue, s. renderqueue.hpp)
+PrimitiveDraw getWireCube();
+PrimitiveDraw getCube();
+PrimitiveDraw getSphere(GLuint slices, GLuint stacks);
+
+// Binden nur das Vertexarray, z. B. fuer instanziertes Zeichnen (s. instancing.hpp)
+PrimitiveDraw bindWireCube();
+PrimitiveDraw bindCube();
+PrimitiveDraw bindSphere(GLuint slices, GLuint stacks); // jede Feinheit wird nur einmal erzeugt
+
+// Zeichnet das gebundene Objekt, bei instances > 1 instanziert
+void drawPrimitive(const PrimitiveDraw & draw, GLsizei instances = 1);
+
+// Feinheit einer Kugel passend zu ihrem Radius auf dem Bildschirm in Pixeln
+void sphereLOD(float screenRadius, GLuint & slices, GLuint & stacks);
+
+// Radius in Pixeln, den eine Einheitskugel mit dieser (View * Model)-Matrix auf dem Bildschirm hat
+float projectedRadius(const glm::mat4 & modelView, const glm::mat4 & projection, float viewportHeight);
+
+// Quader und Kugel um die Objekte im Modellkoordinatensystem, fuer das Culling
+Bounds wireCubeBounds();
+Bounds cubeBounds();
+Bounds sphereBounds();
+
 #endif
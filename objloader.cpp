@@ -2,10 +2,15 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
 
 #include <glm/glm.hpp>
 
 #include "objloader.hpp"
+#include "mappedfile.hpp"
+#include "threadpool.hpp"
 
 // Very, VERY simple OBJ loader.
 // Here is a short list of features a real function would provide : 
@@ -13,125 +18,562 @@
 // - Animations & bones (includes bones weights)
 // - Multiple UVs
 // - All attributes should be optional, not "forced"
-// - More stable. Change a line in the OBJ file and it crashes.
-// - More secure. Change another line and you can inject code.
 // - Loading from memory, stream, etc
+//
+// The file is mapped into memory as a whole and walked with a pointer based tokenizer,
+// fscanf with its locale handling and per-call locking was far too slow for big meshes.
+
+// Everything the parser collects from the file (or one chunk of it), before the face corners
+// are expanded. Indices are 1-based like in the file, 0 means "not given" (only allowed for uv
+// and normal).
+// Negative indices in the file count backwards from the last element read so far. Inside a chunk
+// they are resolved against the chunk's own elements, the "relative" lists remember where that
+// happened so mergeOBJ can move them once the sizes of the preceding chunks are known.
+struct ObjRecords
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
+	std::vector<size_t> relativeVertexIndices, relativeUVIndices, relativeNormalIndices;
+};
 
-bool loadOBJ(
+static inline bool isBlank(char c){
+	return c == ' ' || c == '\t' || c == '\r';
+}
 
+static inline bool isDigit(char c){
+	return (unsigned char)(c - '0') < 10;
+}
 
+static inline const char * skipBlanks(const char * p, const char * end){
+	while (p < end && isBlank(*p))
+		++p;
+	return p;
+}
 
-	const char * path, 
-	std::vector<glm::vec3> & out_vertices, 
-	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals
+// Exactly representable as double, so a single multiplication or division rounds correctly
+static const double powersOf10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
+// Parses a number like "12", "-0.5" or "1.25e-3". Returns NULL if there is no number at p.
+static const char * parseFloat(const char * p, const char * end, float & out){
 
-){
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')){
+		negative = (*p == '-');
+		++p;
+	}
 
-	printf("Loading OBJ file %s...\n", path);
+	// Collect up to 19 significant digits, that fits into 64 bits
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool found = false;
+
+	while (p < end && isDigit(*p)){
+		if (digits < 19){
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa)
+				++digits;
+		}else{
+			++exponent;
+		}
+		found = true;
+		++p;
+	}
+	if (p < end && *p == '.'){
+		++p;
+		while (p < end && isDigit(*p)){
+			if (digits < 19){
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa)
+					++digits;
+				--exponent;
+			}
+			found = true;
+			++p;
+		}
+	}
+	if (!found)
+		return NULL;
+
+	if (p < end && (*p == 'e' || *p == 'E')){
+		const char * q = p + 1;
+		bool negativeExponent = false;
+		if (q < end && (*q == '-' || *q == '+')){
+			negativeExponent = (*q == '-');
+			++q;
+		}
+		if (q < end && isDigit(*q)){
+			int e = 0;
+			while (q < end && isDigit(*q)){
+				if (e < 10000)
+					e = e * 10 + (*q - '0');
+				++q;
+			}
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
 
-	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-	std::vector<glm::vec3> temp_vertices; 
-	std::vector<glm::vec2> temp_uvs;
-	std::vector<glm::vec3> temp_normals;
+	double value = (double)mantissa;
+	if (exponent < 0)
+		value = (exponent >= -22) ? value / powersOf10[-exponent] : value * pow(10.0, exponent);
+	else if (exponent > 0)
+		value = (exponent <= 22) ? value * powersOf10[exponent] : value * pow(10.0, exponent);
 
+	out = (float)(negative ? -value : value);
+	return p;
+}
 
+// Parses an optionally signed integer. Returns NULL if there is no number at p.
+static const char * parseInt(const char * p, const char * end, int & out){
 
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')){
+		negative = (*p == '-');
+		++p;
+	}
+	if (p >= end || !isDigit(*p))
+		return NULL;
+
+	long long value = 0;
+	while (p < end && isDigit(*p)){
+		if (value < 0x7fffffff)
+			value = value * 10 + (*p - '0');
+		++p;
+	}
+	if (value > 0x7fffffff)
+		value = 0x7fffffff;
 
-	FILE * file = fopen(path, "r");
-	if( file == NULL ){
-		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-		getchar();
+	out = (int)(negative ? -value : value);
+	return p;
+}
+
+// Parses "count" blank separated floats
+static const char * parseFloats(const char * p, const char * end, float * out, int count){
+	for (int i = 0; i < count && p; i++)
+		p = parseFloat(skipBlanks(p, end), end, out[i]);
+	return p;
+}
+
+// One face corner : "v", "v/vt", "v//vn" or "v/vt/vn"
+static const char * parseCorner(const char * p, const char * end, int corner[3]){
+
+	corner[1] = corner[2] = 0;
+	p = parseInt(p, end, corner[0]);
+	if (p && p < end && *p == '/'){
+		++p;
+		if (p < end && *p != '/')
+			p = parseInt(p, end, corner[1]);
+		if (p && p < end && *p == '/')
+			p = parseInt(p + 1, end, corner[2]);
+	}
+	return p;
+}
+
+// OBJ indices are 1-based, negative values count backwards from the last element read so far.
+// Returns true for such a relative index. If it points into a preceding chunk the result wraps
+// around and is corrected by mergeOBJ.
+static inline bool resolveIndex(int index, size_t count, unsigned int & out){
+	if (index >= 0){
+		out = (unsigned int)index;
 		return false;
 	}
+	out = (unsigned int)(count + index + 1);
+	return true;
+}
+
+// corner : v, vt, vn and one bit per relative index
+static inline void addCorner(ObjRecords & records, const unsigned int * corner){
+	if (corner[3] & 1) records.relativeVertexIndices.push_back(records.vertexIndices.size());
+	if (corner[3] & 2) records.relativeUVIndices    .push_back(records.uvIndices.size());
+	if (corner[3] & 4) records.relativeNormalIndices.push_back(records.normalIndices.size());
+	records.vertexIndices.push_back(corner[0]);
+	records.uvIndices    .push_back(corner[1]);
+	records.normalIndices.push_back(corner[2]);
+}
+
+// Parses the lines in [p, end), which must start at the beginning of a line.
+// fileStart is only needed to give the right line number in error messages.
+static bool parseOBJ(const char * fileStart, const char * p, const char * end, ObjRecords & records){
 
-	while( 1 ){
+	std::vector<unsigned int> polygon; // 4 values per corner of the current face, see addCorner
 
-		char lineHeader[128];
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
+	while (p < end){
 
-		// else : parse lineHeader
-		
-		if ( strcmp( lineHeader, "v" ) == 0 ){
+		const char * lineEnd = (const char *)memchr(p, '\n', end - p);
+		if (lineEnd == NULL)
+			lineEnd = end;
+
+		const char * q = skipBlanks(p, lineEnd);
+		size_t length = lineEnd - q;
+		bool ok = true;
+
+		if (length >= 2 && q[0] == 'v' && isBlank(q[1])){
 			glm::vec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z );
-			temp_vertices.push_back(vertex);
-		}else if ( strcmp( lineHeader, "vt" ) == 0 ){
+			ok = parseFloats(q + 1, lineEnd, &vertex.x, 3) != NULL;
+			records.vertices.push_back(vertex);
+		}else if (length >= 3 && q[0] == 'v' && q[1] == 't' && isBlank(q[2])){
 			glm::vec2 uv;
-			fscanf(file, "%f %f\n", &uv.x, &uv.y );
+			ok = parseFloats(q + 2, lineEnd, &uv.x, 2) != NULL;
 			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-			temp_uvs.push_back(uv);
-		}else if ( strcmp( lineHeader, "vn" ) == 0 ){
+			records.uvs.push_back(uv);
+		}else if (length >= 3 && q[0] == 'v' && q[1] == 'n' && isBlank(q[2])){
 			glm::vec3 normal;
-			fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z );
-			temp_normals.push_back(normal);
-		}else if ( strcmp( lineHeader, "f" ) == 0 ){
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2] );
-			if (matches != 9){
-				// Der folgende Code wurde eingefgt, um die Teddy-obj-Dateien lesen zu knnen, TJ !!!!!!!!!!!!!
-				if (matches == 1)
-				{
-					matches = fscanf(file, "%d %d\n", &vertexIndex[1], &vertexIndex[2] );
-
-					if (matches != 2)
-					{
-						printf("File can't be read by our simple parser (%d matches) :-( Try exporting with other options\n", matches);
-						return false;
-					}
-					else
-					{
-						uvIndex[0] = uvIndex[1] = uvIndex[2] = normalIndex[0] = normalIndex[1] = normalIndex[2] = 0;
- 					}
+			ok = parseFloats(q + 2, lineEnd, &normal.x, 3) != NULL;
+			records.normals.push_back(normal);
+		}else if (length >= 2 && q[0] == 'f' && isBlank(q[1])){
+			// "f 1 2 3" (e.g. the Teddy obj files) has no uvs and normals, their indices stay 0
+			polygon.clear();
+			q = skipBlanks(q + 1, lineEnd);
+			while (q < lineEnd){
+				int corner[3];
+				q = parseCorner(q, lineEnd, corner);
+				if (q == NULL || (q < lineEnd && !isBlank(*q)) || corner[0] == 0){
+					ok = false;
+					break;
 				}
+				unsigned int resolved[4];
+				resolved[3]  = resolveIndex(corner[0], records.vertices.size(), resolved[0]) ? 1 : 0;
+				resolved[3] |= resolveIndex(corner[1], records.uvs.size(),      resolved[1]) ? 2 : 0;
+				resolved[3] |= resolveIndex(corner[2], records.normals.size(),  resolved[2]) ? 4 : 0;
+				polygon.insert(polygon.end(), resolved, resolved + 4);
+				q = skipBlanks(q, lineEnd);
+			}
+			if (polygon.size() < 12)
+				ok = false;
+
+			// Polygons with more than three corners are split into a triangle fan
+			for (size_t i = 4; ok && i + 4 < polygon.size(); i += 4){
+				addCorner(records, &polygon[0]);
+				addCorner(records, &polygon[i]);
+				addCorner(records, &polygon[i + 4]);
 			}
-			vertexIndices.push_back(vertexIndex[0]);
-			vertexIndices.push_back(vertexIndex[1]);
-			vertexIndices.push_back(vertexIndex[2]);
-			uvIndices    .push_back(uvIndex[0]);
-			uvIndices    .push_back(uvIndex[1]);
-			uvIndices    .push_back(uvIndex[2]);
-			normalIndices.push_back(normalIndex[0]);
-			normalIndices.push_back(normalIndex[1]);
-			normalIndices.push_back(normalIndex[2]);
-		}else{
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
 		}
+		// Everything else (comments, groups, materials, ...) is skipped
 
+		if (!ok){
+			unsigned int lineNumber = 1 + (unsigned int)std::count(fileStart, p, '\n');
+			printf("Line %u can't be read by our simple parser :-( Try exporting with other options\n", lineNumber);
+			return false;
+		}
+
+		p = lineEnd + (lineEnd < end ? 1 : 0);
 	}
 
-	// For each vertex of each triangle
-	for( unsigned int i=0; i<vertexIndices.size(); i++ ){
+	return true;
+}
 
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertexIndices[i];
-		unsigned int uvIndex = uvIndices[i];
-		unsigned int normalIndex = normalIndices[i];
-		
-		// Get the attributes thanks to the index
-		glm::vec3 vertex = temp_vertices[ vertexIndex-1 ];
+// Concatenates the chunks in file order into "records". The elements of the preceding chunks
+// are added to the relative indices of every chunk, which makes all indices absolute.
+static void mergeOBJ(std::vector<ObjRecords> & chunks, ObjRecords & records){
+
+	size_t chunkCount = chunks.size();
+	std::vector<size_t> vertexBase(chunkCount), uvBase(chunkCount), normalBase(chunkCount), cornerBase(chunkCount);
+	size_t vertices = 0, uvs = 0, normals = 0, corners = 0;
+	for (size_t i = 0; i < chunkCount; i++){
+		vertexBase[i] = vertices;
+		uvBase[i]     = uvs;
+		normalBase[i] = normals;
+		cornerBase[i] = corners;
+		vertices += chunks[i].vertices.size();
+		uvs      += chunks[i].uvs.size();
+		normals  += chunks[i].normals.size();
+		corners  += chunks[i].vertexIndices.size();
+	}
 
-	    // Fr Teddy-Obj-import ohne Normalen und UVs, TJ !!!!!!!!!!!!!!!!!!!!!
-		// glm::vec2 uv = temp_uvs[ uvIndex-1 ];
-		glm::vec2 uv = uvIndex ? temp_uvs[ uvIndex-1 ] : glm::vec2(0.0, 0.0);
-		
-		// glm::vec3 normal = temp_normals[ normalIndex-1 ];
-		glm::vec3 normal = normalIndex ? temp_normals[ normalIndex-1 ] : glm::vec3(0.0, 0.0, 0.0);
+	records.vertices.resize(vertices);
+	records.uvs.resize(uvs);
+	records.normals.resize(normals);
+	records.vertexIndices.resize(corners);
+	records.uvIndices.resize(corners);
+	records.normalIndices.resize(corners);
+
+	parallelFor(chunkCount, [&](size_t i){
+		ObjRecords & chunk = chunks[i];
+
+		std::copy(chunk.vertices.begin(), chunk.vertices.end(), records.vertices.begin() + vertexBase[i]);
+		std::copy(chunk.uvs     .begin(), chunk.uvs     .end(), records.uvs     .begin() + uvBase[i]);
+		std::copy(chunk.normals .begin(), chunk.normals .end(), records.normals .begin() + normalBase[i]);
+
+		std::vector<unsigned int>::iterator vertexIndices = records.vertexIndices.begin() + cornerBase[i];
+		std::vector<unsigned int>::iterator uvIndices     = records.uvIndices    .begin() + cornerBase[i];
+		std::vector<unsigned int>::iterator normalIndices = records.normalIndices.begin() + cornerBase[i];
+		std::copy(chunk.vertexIndices.begin(), chunk.vertexIndices.end(), vertexIndices);
+		std::copy(chunk.uvIndices    .begin(), chunk.uvIndices    .end(), uvIndices);
+		std::copy(chunk.normalIndices.begin(), chunk.normalIndices.end(), normalIndices);
+
+		// Unsigned arithmetic, so indices that wrapped around in the chunk come out right
+		for (size_t k = 0; k < chunk.relativeVertexIndices.size(); k++)
+			vertexIndices[chunk.relativeVertexIndices[k]] += (unsigned int)vertexBase[i];
+		for (size_t k = 0; k < chunk.relativeUVIndices.size(); k++)
+			uvIndices[chunk.relativeUVIndices[k]] += (unsigned int)uvBase[i];
+		for (size_t k = 0; k < chunk.relativeNormalIndices.size(); k++)
+			normalIndices[chunk.relativeNormalIndices[k]] += (unsigned int)normalBase[i];
+
+		chunk = ObjRecords(); // free the memory early
+	});
+}
 
-		// Put the attributes in buffers
-		out_vertices.push_back(vertex);
-		out_uvs     .push_back(uv);
-		out_normals .push_back(normal);
-	
+// Looks up the attributes of every face corner, so three consecutive vertices give a triangle
+static bool expandOBJ(
+	const ObjRecords & records,
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	bool parallel
+){
+	size_t count = records.vertexIndices.size();
+	size_t first = out_vertices.size();
+	out_vertices.resize(first + count);
+	out_uvs     .resize(first + count);
+	out_normals .resize(first + count);
+
+	size_t blockSize = parallel ? (1 << 16) : (count ? count : 1);
+	size_t blocks = (count + blockSize - 1) / blockSize;
+	std::atomic<bool> ok(true);
+
+	parallelFor(blocks, [&](size_t block){
+		size_t end = std::min(count, (block + 1) * blockSize);
+		for (size_t i = block * blockSize; i < end; i++){
+
+			// Get the indices of its attributes
+			unsigned int vertexIndex = records.vertexIndices[i];
+			unsigned int uvIndex = records.uvIndices[i];
+			unsigned int normalIndex = records.normalIndices[i];
+
+			if (vertexIndex - 1 >= records.vertices.size() || uvIndex > records.uvs.size() || normalIndex > records.normals.size()){
+				ok = false;
+				return;
+			}
+
+			// Without uv or normal index (Teddy obj files) we use zeros
+			out_vertices[first + i] = records.vertices[vertexIndex - 1];
+			out_uvs     [first + i] = uvIndex ? records.uvs[uvIndex - 1] : glm::vec2(0.0, 0.0);
+			out_normals [first + i] = normalIndex ? records.normals[normalIndex - 1] : glm::vec3(0.0, 0.0, 0.0);
+		}
+	});
+
+	if (!ok){
+		printf("Face index out of range, the OBJ file is broken\n");
+		out_vertices.resize(first);
+		out_uvs     .resize(first);
+		out_normals .resize(first);
+		return false;
+	}
+	return true;
+}
+
+// Files smaller than this are not worth splitting
+static const size_t minimumChunkSize = 1 << 20;
+
+// Maps the file and fills "records". With more than one chunk the file is split into newline
+// aligned chunks which are parsed on the worker threads and merged afterwards. chunkCount 0 :
+// one chunk per minimumChunkSize, at most four per thread.
+static bool readOBJ(const char * path, ObjRecords & records, size_t chunkCount){
+
+	printf("Loading OBJ file %s...\n", path);
+
+	MappedFile file;
+	if (!mapFile(path, file)){
+		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+		return false;
+	}
+
+	const char * begin = file.data;
+	const char * end = file.data + file.size;
+
+	if (chunkCount == 0)
+		chunkCount = std::min(file.size / minimumChunkSize, (size_t)(workerThreadCount() + 1) * 4);
+
+	bool ok = true;
+	if (chunkCount <= 1){
+		ok = parseOBJ(begin, begin, end, records);
+	}else{
+		std::vector<const char *> bounds(chunkCount + 1);
+		bounds[0] = begin;
+		bounds[chunkCount] = end;
+		for (size_t i = 1; i < chunkCount; i++){
+			const char * split = std::max(begin + file.size / chunkCount * i, bounds[i - 1]);
+			const char * newline = (const char *)memchr(split, '\n', end - split);
+			bounds[i] = newline ? newline + 1 : end;
+		}
+
+		std::vector<ObjRecords> chunks(chunkCount);
+		std::vector<char> chunkOk(chunkCount);
+		parallelFor(chunkCount, [&](size_t i){
+			chunkOk[i] = parseOBJ(begin, bounds[i], bounds[i + 1], chunks[i]);
+		});
+
+		for (size_t i = 0; i < chunkCount; i++)
+			ok = ok && chunkOk[i];
+		if (ok)
+			mergeOBJ(chunks, records);
+	}
+
+	unmapFile(file);
+	return ok;
+}
+
+bool loadOBJ(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	ObjRecords records;
+	if (!readOBJ(path, records, 1))
+		return false;
+
+	return expandOBJ(records, out_vertices, out_uvs, out_normals, false);
+}
+
+bool loadOBJParallel(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	size_t chunkCount
+){
+	ObjRecords records;
+	if (!readOBJ(path, records, chunkCount))
+		return false;
+
+	return expandOBJ(records, out_vertices, out_uvs, out_normals, true);
+}
+
+
+// Open addressing hash table from a (v, vt, vn) combination to its vertex in the indexed mesh.
+// "expected" is only a first guess : uvs split at seams (or one uv per corner) give more
+// vertices than positions, the table doubles whenever it gets half full.
+struct CornerTable
+{
+	std::vector<unsigned int> slots; // vertex index + 1, 0 = empty
+	std::vector<unsigned int> keys;  // v, vt, vn of every vertex
+	size_t mask;
+
+	explicit CornerTable(size_t expected){
+		size_t size = 64;
+		while (size < expected * 2)
+			size *= 2;
+		slots.assign(size, 0);
+		keys.reserve(expected * 3);
+		mask = size - 1;
+	}
+
+	static size_t hash(unsigned int v, unsigned int vt, unsigned int vn){
+		return v * 0x9E3779B1u ^ vt * 0x85EBCA77u ^ vn * 0xC2B2AE3Du;
+	}
+
+	// Puts all vertices into a table twice the size
+	void grow(){
+		slots.assign(slots.size() * 2, 0);
+		mask = slots.size() - 1;
+		for (size_t vertex = 0; vertex < keys.size() / 3; vertex++){
+			const unsigned int * key = &keys[vertex * 3];
+			size_t slot = hash(key[0], key[1], key[2]) & mask;
+			while (slots[slot] != 0)
+				slot = (slot + 1) & mask;
+			slots[slot] = (unsigned int)vertex + 1;
+		}
 	}
 
+	// Returns the vertex for the combination, a new one is added if it has not been seen before
+	unsigned int find(unsigned int v, unsigned int vt, unsigned int vn, bool & added){
+		size_t slot = hash(v, vt, vn) & mask;
+		for (;;){
+			unsigned int entry = slots[slot];
+			if (entry == 0){
+				unsigned int vertex = (unsigned int)(keys.size() / 3);
+				if ((vertex + 1) * 2 > slots.size()){
+					// Keeps at least half of the slots empty, so probing always ends
+					grow();
+					return find(v, vt, vn, added);
+				}
+				slots[slot] = vertex + 1;
+				keys.push_back(v);
+				keys.push_back(vt);
+				keys.push_back(vn);
+				added = true;
+				return vertex;
+			}
+			const unsigned int * key = &keys[(entry - 1) * 3];
+			if (key[0] == v && key[1] == vt && key[2] == vn){
+				added = false;
+				return entry - 1;
+			}
+			slot = (slot + 1) & mask;
+		}
+	}
+};
+
+// Like expandOBJ, but face corners with the same v, vt and vn share one vertex
+static bool indexOBJ(
+	const ObjRecords & records,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	size_t count = records.vertexIndices.size();
+	unsigned int first = (unsigned int)out_vertices.size();
+	CornerTable table(std::max(records.vertices.size(), records.normals.size()));
+	out_indices.reserve(out_indices.size() + count);
+
+	for (size_t i = 0; i < count; i++){
+
+		unsigned int vertexIndex = records.vertexIndices[i];
+		unsigned int uvIndex = records.uvIndices[i];
+		unsigned int normalIndex = records.normalIndices[i];
+
+		if (vertexIndex - 1 >= records.vertices.size() || uvIndex > records.uvs.size() || normalIndex > records.normals.size()){
+			printf("Face index out of range, the OBJ file is broken\n");
+			return false;
+		}
+
+		bool added;
+		unsigned int vertex = table.find(vertexIndex, uvIndex, normalIndex, added);
+		if (added){
+			out_vertices.push_back(records.vertices[vertexIndex - 1]);
+			out_uvs     .push_back(uvIndex ? records.uvs[uvIndex - 1] : glm::vec2(0.0, 0.0));
+			out_normals .push_back(normalIndex ? records.normals[normalIndex - 1] : glm::vec3(0.0, 0.0, 0.0));
+		}
+		out_indices.push_back(first + vertex);
+	}
+
+	printf("%u face corners share %u vertices\n", (unsigned int)count, (unsigned int)(out_vertices.size() - first));
+	return true;
+}
+
+bool loadOBJIndexed(
+	const char * path, 
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	ObjRecords records;
+	if (!readOBJ(path, records, 0))
+		return false;
+
+	return indexOBJ(records, out_indices, out_vertices, out_uvs, out_normals);
+}
+
+bool packIndices16(
+	const std::vector<unsigned int> & indices,
+	size_t vertexCount,
+	std::vector<unsigned short> & out_indices
+){
+	if (vertexCount > 0x10000)
+		return false;
+
+	out_indices.resize(indices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+		out_indices[i] = (unsigned short)indices[i];
 	return true;
 }
 
@@ -156,7 +598,6 @@ bool loadAssImp(
 	const aiScene* scene = importer.ReadFile(path, 0/*aiProcess_JoinIdenticalVertices | aiProcess_SortByPType*/);
 	if( !scene) {
 		fprintf( stderr, importer.GetErrorString());
-		getchar();
 		return false;
 	}
 	const aiMesh* mesh = scene->mMeshes[0]; // In this simple example code we always use the 1rst mesh (in OBJ files there is often only one anyway)
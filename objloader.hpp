@@ -9,6 +9,34 @@ bool loadOBJ(
 	std::vector<glm::vec3> & out_normals
 );
 
+// Same result as loadOBJ. Big files are split into chunks which are parsed on all worker threads.
+// chunkCount 0 picks the number of chunks from the file size, other values force it (for tests).
+bool loadOBJParallel(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs, 
+	std::vector<glm::vec3> & out_normals,
+	size_t chunkCount = 0
+);
+
+// Like loadOBJ, but face corners with the same position, uv and normal index share one vertex.
+// Three consecutive indices give a triangle (glDrawElements).
+bool loadOBJIndexed(
+	const char * path, 
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs, 
+	std::vector<glm::vec3> & out_normals
+);
+
+// Copies the indices into 16 bit values, which halves the index buffer. Returns false
+// (and leaves out_indices alone) if there are too many vertices for that.
+bool packIndices16(
+	const std::vector<unsigned int> & indices,
+	size_t vertexCount,
+	std::vector<unsigned short> & out_indices
+);
+
 bool loadAssImp(
 	const char * path, 
 	std::vector<unsigned short> & indices,
@@ -0,0 +1,99 @@
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "renderqueue.hpp"
+#include "instancing.hpp"
+#include "glstate.hpp"
+#include "meshpool.hpp"
+
+static std::vector<DrawPacket> packets;
+static std::vector<PerObjectUniforms> objects;
+static std::vector<std::pair<unsigned long long, unsigned int> > order;
+
+unsigned long long renderSortKey(unsigned int pass, GLuint program, GLuint texture, GLuint vertexArray, float depth)
+{
+	// The bits of a positive float sort like the float itself, the top 24 are precise enough
+	unsigned int depthBits = 0;
+	if (depth > 0.0f){
+		memcpy(&depthBits, &depth, sizeof(depthBits));
+		depthBits >>= 8;
+	}
+
+	return ((unsigned long long)(pass & 0xf) << 60)
+		| ((unsigned long long)(program & 0xff) << 52)
+		| ((unsigned long long)(texture & 0xfff) << 40)
+		| ((unsigned long long)(vertexArray & 0xffff) << 24)
+		| depthBits;
+}
+
+static void submit(GLuint program, const TextureLayer & texture, const PrimitiveDraw & draw, float depth, size_t instanceOffset, GLsizei instanceCount, int objectUniforms,
+	size_t drawOffset = 0, GLsizei drawCount = 0)
+{
+	DrawPacket packet;
+	packet.key = renderSortKey(RENDER_PASS_OPAQUE, program, texture.texture, draw.vertexArray, depth);
+	packet.program = program;
+	packet.textureTarget = texture.target;
+	packet.texture = texture.texture;
+	packet.draw = draw;
+	packet.instanceCount = instanceCount;
+	packet.instanceOffset = instanceOffset;
+	packet.objectUniforms = objectUniforms;
+	packet.drawOffset = drawOffset;
+	packet.drawCount = drawCount;
+	packets.push_back(packet);
+}
+
+void submitDraw(GLuint program, const TextureLayer & texture, const PrimitiveDraw & draw, float depth, const PerObjectUniforms & object)
+{
+	objects.push_back(object);
+	objects.back().PositionScale.w = (float)texture.layer;
+	submit(program, texture, draw, depth, 0, 0, (int)objects.size() - 1);
+}
+
+void submitInstances(GLuint program, const TextureLayer & texture, const PrimitiveDraw & draw, float depth, size_t instanceOffset, GLsizei instanceCount)
+{
+	if (instanceCount > 0)
+		submit(program, texture, draw, depth, instanceOffset, instanceCount, -1);
+}
+
+void submitMultiDraw(GLuint program, const TextureLayer & texture, const PrimitiveDraw & draw, float depth, size_t drawOffset, GLsizei drawCount)
+{
+	if (drawCount > 0)
+		submit(program, texture, draw, depth, 0, 0, -1, drawOffset, drawCount);
+}
+
+void flushRenderQueue()
+{
+	// Sorting (key, index) pairs moves 16 bytes per packet instead of the whole packet
+	order.resize(packets.size());
+	for (size_t i = 0; i < packets.size(); i++)
+		order[i] = std::make_pair(packets[i].key, (unsigned int)i);
+	std::sort(order.begin(), order.end());
+
+	for (size_t i = 0; i < order.size(); i++){
+		const DrawPacket & packet = packets[order[i].second];
+		useProgram(packet.program);
+		if (packet.texture)
+			bindTexture(0, packet.textureTarget, packet.texture);
+		bindVertexArray(packet.draw.vertexArray);
+
+		if (packet.objectUniforms >= 0)
+			sendPerObject(objects[packet.objectUniforms]);
+
+		if (packet.drawCount > 0){
+			drawMeshBatch(packet.drawOffset, packet.drawCount);
+		}else if (packet.instanceCount > 0){
+			setInstanceAttributes(packet.instanceOffset);
+			drawPrimitive(packet.draw, packet.instanceCount);
+		}else{
+			drawPrimitive(packet.draw);
+		}
+	}
+
+	packets.clear();
+	objects.clear();
+}
@@ -0,0 +1,58 @@
+#ifndef RENDERQUEUE_HPP
+#define RENDERQUEUE_HPP
+
+#include <stddef.h>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "objects.hpp"
+#include "uniformbuffers.hpp"
+#include "texturearray.hpp"
+
+// Draws are not executed where the scene code asks for them. They are collected as packets
+// and sorted by a 64 bit key, so that draws with the same program, texture and vertex array
+// follow each other and the state cache (glstate.hpp) skips the binds in between.
+//
+// Key, most significant bits first :
+//   4 bits  pass (only RENDER_PASS_OPAQUE so far)
+//   8 bits  program
+//  12 bits  texture
+//  16 bits  vertex array
+//  24 bits  depth, front to back (hides more pixels behind the first ones drawn)
+// Object names wider than their field only make the sorting less effective, every packet
+// still binds its own objects. Layers of a texture array (texturearray.hpp) share the texture
+// field, draws with different layers of one array follow each other without a bind.
+
+#define RENDER_PASS_OPAQUE 0
+
+struct DrawPacket
+{
+	unsigned long long key;
+	GLuint program;
+	GLenum textureTarget;   // GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+	GLuint texture;         // on unit 0, 0 leaves the binding alone
+	PrimitiveDraw draw;
+	GLsizei instanceCount;  // 0 : not instanced
+	size_t instanceOffset;  // in the instance buffer, see setInstanceAttributes
+	int objectUniforms;     // index into the PerObject data of the queue, -1 : none
+	size_t drawOffset;      // in the command buffer of the mesh pools, see drawMeshBatch
+	GLsizei drawCount;      // > 0 : multi-draw of pooled meshes
+};
+
+// depth is the distance in front of the camera (view space -z)
+unsigned long long renderSortKey(unsigned int pass, GLuint program, GLuint texture, GLuint vertexArray, float depth);
+
+// One draw with its own PerObject uniform block, the layer of the texture goes to PositionScale.w
+void submitDraw(GLuint program, const TextureLayer & texture, const PrimitiveDraw & draw, float depth, const PerObjectUniforms & object);
+
+// One instanced draw, the instance data (with the layers) is already in the instance buffer
+void submitInstances(GLuint program, const TextureLayer & texture, const PrimitiveDraw & draw, float depth, size_t instanceOffset, GLsizei instanceCount);
+
+// One multi-draw of pooled meshes, commands and per-draw data are already written (see flushMeshDraws)
+void submitMultiDraw(GLuint program, const TextureLayer & texture, const PrimitiveDraw & draw, float depth, size_t drawOffset, GLsizei drawCount);
+
+// Sorts and executes all packets, then empties the queue
+void flushRenderQueue();
+
+#endif
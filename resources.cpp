@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+
+#include <GL/glew.h>
+
+#include "resources.hpp"
+#include "uniforms.hpp"
+#include "glstate.hpp"
+
+struct ResourceEntry
+{
+	std::string name;
+	unsigned long long bytes;
+};
+
+static const char * typeNames[RESOURCE_TYPE_COUNT] = { "buffers", "vertex arrays", "textures", "programs" };
+
+static std::unordered_map<unsigned long long, ResourceEntry> resources;
+static ResourceStatistics statistics;
+
+static unsigned int frame = 0;
+static bool inFrame = false;
+
+#ifdef _DEBUG
+// Frames in a row in which the live count of a type has to grow before it is reported
+#define LEAK_FRAMES 120
+
+static unsigned int previousLiveCount[RESOURCE_TYPE_COUNT];
+static unsigned int growingFrames[RESOURCE_TYPE_COUNT];
+static bool reported[RESOURCE_TYPE_COUNT];
+static std::string lastCreated[RESOURCE_TYPE_COUNT]; // for the message
+#endif
+
+static unsigned long long resourceKey(ResourceType type, GLuint id)
+{
+	return ((unsigned long long)type << 32) | id;
+}
+
+void trackResource(ResourceType type, GLuint id, const char * name)
+{
+	if (id == 0)
+		return;
+
+	ResourceEntry entry;
+	entry.name = name ? name : "";
+	entry.bytes = 0;
+	if (!resources.insert(std::make_pair(resourceKey(type, id), entry)).second)
+		return;
+
+	statistics.liveCount[type]++;
+	statistics.createdThisFrame++;
+
+#ifdef _DEBUG
+	if (inFrame)
+		lastCreated[type] = entry.name;
+#endif
+}
+
+void setResourceBytes(ResourceType type, GLuint id, unsigned long long bytes)
+{
+	std::unordered_map<unsigned long long, ResourceEntry>::iterator it = resources.find(resourceKey(type, id));
+	if (it == resources.end())
+		return;
+	statistics.liveBytes[type] += bytes - it->second.bytes;
+	it->second.bytes = bytes;
+}
+
+void untrackResource(ResourceType type, GLuint id)
+{
+	std::unordered_map<unsigned long long, ResourceEntry>::iterator it = resources.find(resourceKey(type, id));
+	if (it == resources.end())
+		return;
+	statistics.liveCount[type]--;
+	statistics.liveBytes[type] -= it->second.bytes;
+	statistics.deletedThisFrame++;
+	resources.erase(it);
+}
+
+GLuint createBuffer(const char * name)
+{
+	GLuint buffer = 0;
+	glGenBuffers(1, &buffer);
+	trackResource(RESOURCE_BUFFER, buffer, name);
+	return buffer;
+}
+
+GLuint createVertexArray(const char * name)
+{
+	GLuint vertexArray = 0;
+	glGenVertexArrays(1, &vertexArray);
+	trackResource(RESOURCE_VERTEX_ARRAY, vertexArray, name);
+	return vertexArray;
+}
+
+GLuint createTexture(const char * name)
+{
+	GLuint texture = 0;
+	glGenTextures(1, &texture);
+	trackResource(RESOURCE_TEXTURE, texture, name);
+	return texture;
+}
+
+void deleteBuffer(GLuint & buffer)
+{
+	untrackResource(RESOURCE_BUFFER, buffer);
+	glDeleteBuffers(1, &buffer);
+	buffer = 0;
+}
+
+void deleteVertexArray(GLuint & vertexArray)
+{
+	untrackResource(RESOURCE_VERTEX_ARRAY, vertexArray);
+	forgetBinding(RESOURCE_VERTEX_ARRAY, vertexArray);
+	glDeleteVertexArrays(1, &vertexArray);
+	vertexArray = 0;
+}
+
+void deleteTexture(GLuint & texture)
+{
+	untrackResource(RESOURCE_TEXTURE, texture);
+	forgetBinding(RESOURCE_TEXTURE, texture);
+	glDeleteTextures(1, &texture);
+	texture = 0;
+}
+
+void deleteProgram(GLuint & program)
+{
+	untrackResource(RESOURCE_PROGRAM, program);
+	forgetUniforms(program);
+	glDeleteProgram(program);
+	program = 0;
+}
+
+void bufferData(GLenum target, GLuint buffer, GLsizeiptr size, const void * data, GLenum usage)
+{
+	glBindBuffer(target, buffer);
+	glBufferData(target, size, data, usage);
+	setResourceBytes(RESOURCE_BUFFER, buffer, (unsigned long long)size);
+}
+
+void beginResourceFrame()
+{
+	frame++;
+	inFrame = true;
+	statistics.createdThisFrame = 0;
+	statistics.deletedThisFrame = 0;
+}
+
+void endResourceFrame()
+{
+	inFrame = false;
+
+#ifdef _DEBUG
+	// Lazily created geometry, finished uploads and new texture arrays add objects in a few
+	// frames. Objects that are created in every frame and never deleted add them in all frames.
+	for (int type = 0; type < RESOURCE_TYPE_COUNT; type++){
+		unsigned int live = statistics.liveCount[type];
+		growingFrames[type] = live > previousLiveCount[type] ? growingFrames[type] + 1 : 0;
+		previousLiveCount[type] = live;
+		if (growingFrames[type] == LEAK_FRAMES && !reported[type]){
+			reported[type] = true;
+			printf("Warning : the number of %s has grown for %u frames in a row (%u alive at frame %u, last one \"%s\"), "
+				"objects created in the render loop are not deleted\n", typeNames[type], LEAK_FRAMES, live, frame, lastCreated[type].c_str());
+		}
+	}
+#endif
+}
+
+ResourceStatistics getResourceStatistics()
+{
+	return statistics;
+}
+
+void printResourceStatistics()
+{
+	printf("GPU resources :");
+	for (int type = 0; type < RESOURCE_TYPE_COUNT; type++)
+		printf(" %u %s (%.1f KB)%s", statistics.liveCount[type], typeNames[type], statistics.liveBytes[type] / 1024.0, type + 1 < RESOURCE_TYPE_COUNT ? "," : "\n");
+}
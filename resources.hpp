@@ -0,0 +1,55 @@
+#ifndef RESOURCES_HPP
+#define RESOURCES_HPP
+
+#include <GL/glew.h>
+
+// Registry of all OpenGL objects the program creates. It knows how many buffers, vertex arrays,
+// textures and programs are alive and how much memory they use. In debug builds it also reports
+// leaks in the render loop : a type whose number of live objects grows frame after frame. Objects
+// that are created lazily or when an asynchronous load finishes only grow it now and then.
+//
+// Only call these functions from the thread that owns the OpenGL context.
+
+enum ResourceType
+{
+	RESOURCE_BUFFER,
+	RESOURCE_VERTEX_ARRAY,
+	RESOURCE_TEXTURE,
+	RESOURCE_PROGRAM,
+	RESOURCE_TYPE_COUNT
+};
+
+struct ResourceStatistics
+{
+	unsigned int liveCount[RESOURCE_TYPE_COUNT];
+	unsigned long long liveBytes[RESOURCE_TYPE_COUNT];
+	unsigned int createdThisFrame; // since beginResourceFrame
+	unsigned int deletedThisFrame;
+};
+
+// Registers an object created elsewhere. "name" is only used for messages.
+void trackResource(ResourceType type, GLuint id, const char * name);
+// Memory used by the object, replaces the previous value
+void setResourceBytes(ResourceType type, GLuint id, unsigned long long bytes);
+void untrackResource(ResourceType type, GLuint id);
+
+// glGen* / glDelete* plus bookkeeping. The delete functions set the id to 0.
+GLuint createBuffer(const char * name);
+GLuint createVertexArray(const char * name);
+GLuint createTexture(const char * name);
+void deleteBuffer(GLuint & buffer);
+void deleteVertexArray(GLuint & vertexArray);
+void deleteTexture(GLuint & texture);
+void deleteProgram(GLuint & program);
+
+// Binds the buffer to target and calls glBufferData, the size is recorded for the buffer
+void bufferData(GLenum target, GLuint buffer, GLsizeiptr size, const void * data, GLenum usage);
+
+// Call around the body of the render loop
+void beginResourceFrame();
+void endResourceFrame();
+
+ResourceStatistics getResourceStatistics();
+void printResourceStatistics();
+
+#endif
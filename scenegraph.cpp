@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "scenegraph.hpp"
+#include "transformbatch.hpp"
+
+int addSceneNode(SceneGraph & graph, int parent, SceneDrawable drawable)
+{
+	if (parent >= (int)graph.nodes.size()){
+		printf("Scene node %d does not exist\n", parent);
+		parent = -1;
+	}
+
+	SceneNode node;
+	node.parent = parent;
+	node.translation = glm::vec3(0.0f);
+	node.rotation = glm::quat();
+	node.scale = glm::vec3(1.0f);
+	node.world = glm::mat4(1.0f);
+	node.dirty = true;
+	node.drawable = drawable;
+	node.mesh = NULL;
+	node.triangles = NULL;
+	node.color = glm::vec4(1.0f);
+	node.unlit = false;
+
+	graph.nodes.push_back(node);
+	graph.changed.push_back(0);
+	graph.depth.push_back(parent >= 0 ? graph.depth[parent] + 1 : 0);
+	return (int)graph.nodes.size() - 1;
+}
+
+void setTranslation(SceneGraph & graph, int node, const glm::vec3 & translation)
+{
+	SceneNode & n = graph.nodes[node];
+	if (n.translation != translation){
+		n.translation = translation;
+		n.dirty = true;
+	}
+}
+
+void setRotation(SceneGraph & graph, int node, const glm::quat & rotation)
+{
+	SceneNode & n = graph.nodes[node];
+	if (n.rotation.x != rotation.x || n.rotation.y != rotation.y || n.rotation.z != rotation.z || n.rotation.w != rotation.w){
+		n.rotation = rotation;
+		n.dirty = true;
+	}
+}
+
+void setScale(SceneGraph & graph, int node, const glm::vec3 & scale)
+{
+	SceneNode & n = graph.nodes[node];
+	if (n.scale != scale){
+		n.scale = scale;
+		n.dirty = true;
+	}
+}
+
+unsigned int updateSceneGraph(SceneGraph & graph)
+{
+	// Find the changed nodes and count them per depth. Parents come first, so their flag is
+	// already final.
+	std::vector<unsigned int> & levelStart = graph.levelStart;
+	levelStart.assign(1, 0);
+	unsigned int updated = 0;
+	for (size_t i = 0; i < graph.nodes.size(); i++){
+		SceneNode & node = graph.nodes[i];
+		bool parentChanged = node.parent >= 0 && graph.changed[node.parent];
+		graph.changed[i] = (node.dirty || parentChanged) ? 1 : 0;
+		if (!graph.changed[i])
+			continue;
+
+		unsigned int depth = graph.depth[i];
+		if (levelStart.size() < depth + 2)
+			levelStart.resize(depth + 2, 0);
+		levelStart[depth + 1]++;
+		updated++;
+	}
+	if (updated == 0)
+		return 0;
+
+	// Counting sort by depth, within a level the nodes stay in array order
+	for (size_t level = 1; level < levelStart.size(); level++)
+		levelStart[level] += levelStart[level - 1];
+	std::vector<unsigned int> & next = graph.levelNext;
+	next.assign(levelStart.begin(), levelStart.end() - 1);
+	graph.updates.resize(updated);
+	graph.parentWorlds.resize(updated);
+	graph.locals.resize(updated);
+	graph.worlds.resize(updated);
+	for (size_t i = 0; i < graph.nodes.size(); i++){
+		if (!graph.changed[i])
+			continue;
+		SceneNode & node = graph.nodes[i];
+		unsigned int u = next[graph.depth[i]]++;
+		graph.updates[u] = (int)i;
+
+		glm::mat4 & local = graph.locals[u];
+		local = glm::translate(glm::mat4(1.0f), node.translation);
+		local = local * glm::mat4_cast(node.rotation);
+		local = glm::scale(local, node.scale);
+		node.dirty = false;
+	}
+
+	// Roots take their local transform, every deeper level needs the worlds of the one before
+	for (unsigned int u = levelStart[0]; u < levelStart[1]; u++)
+		graph.nodes[graph.updates[u]].world = graph.locals[u];
+	for (size_t level = 1; level + 1 < levelStart.size(); level++){
+		unsigned int first = levelStart[level], count = levelStart[level + 1] - first;
+		if (count == 0)
+			continue;
+		for (unsigned int u = first; u < first + count; u++)
+			graph.parentWorlds[u] = graph.nodes[graph.nodes[graph.updates[u]].parent].world;
+		multiplyMatrices(&graph.parentWorlds[first], &graph.locals[first], &graph.worlds[first], count);
+		for (unsigned int u = first; u < first + count; u++)
+			graph.nodes[graph.updates[u]].world = graph.worlds[u];
+	}
+	return updated;
+}
@@ -0,0 +1,66 @@
+#ifndef SCENEGRAPH_HPP
+#define SCENEGRAPH_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+struct Mesh;
+struct TriangleBvh;
+
+// Hierarchy of transforms. Every node has a local translation, rotation and scale
+// (world = parent world * T * R * S). The nodes are stored flat in one array with parents
+// before their children, updateSceneGraph walks it once from front to back. Only nodes whose
+// own transform or one of whose ancestors changed get a new world matrix. Those are multiplied
+// level by level, all changed nodes of one depth with a single multiplyMatrices call.
+
+enum SceneDrawable
+{
+	DRAW_NOTHING,
+	DRAW_WIRE_CUBE,
+	DRAW_CUBE,
+	DRAW_SPHERE,
+	DRAW_MESH
+};
+
+struct SceneNode
+{
+	int parent;            // -1 for a root, always smaller than the index of the node
+	glm::vec3 translation;
+	glm::quat rotation;
+	glm::vec3 scale;
+	glm::mat4 world;       // valid after updateSceneGraph
+	bool dirty;            // local transform changed since the last update
+
+	SceneDrawable drawable;
+	const Mesh * mesh;     // for DRAW_MESH
+	const TriangleBvh * triangles; // triangles of the mesh for picking, may be NULL
+	glm::vec4 color;
+	bool unlit;            // flat color, no texture and no lighting (e.g. coordinate axes)
+};
+
+struct SceneGraph
+{
+	std::vector<SceneNode> nodes;
+	std::vector<unsigned char> changed; // per node, during updateSceneGraph
+	std::vector<unsigned int> depth;    // per node, 0 for roots
+
+	// Scratch arrays of updateSceneGraph, kept so an update allocates nothing
+	std::vector<int> updates;           // changed nodes, sorted by depth
+	std::vector<unsigned int> levelStart, levelNext;
+	std::vector<glm::mat4> parentWorlds, locals, worlds;
+};
+
+// Appends a node with identity transform, returns its index. The parent must exist already.
+int addSceneNode(SceneGraph & graph, int parent, SceneDrawable drawable = DRAW_NOTHING);
+
+// Setting the value a node already has does not mark it dirty
+void setTranslation(SceneGraph & graph, int node, const glm::vec3 & translation);
+void setRotation(SceneGraph & graph, int node, const glm::quat & rotation);
+void setScale(SceneGraph & graph, int node, const glm::vec3 & scale);
+
+// Recomputes the world matrices of dirty nodes and their descendants, returns how many
+unsigned int updateSceneGraph(SceneGraph & graph);
+
+#endif
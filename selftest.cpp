@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "selftest.hpp"
+#include "objloader.hpp"
+#include "transformbatch.hpp"
+#include "scenegraph.hpp"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)){ printf("%s:%d: check failed : %s\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+static bool writeTextFile(const char * path, const std::string & text)
+{
+	FILE * file = fopen(path, "wb");
+	if (!file){
+		printf("Can't write %s\n", path);
+		return false;
+	}
+	bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+	return fclose(file) == 0 && ok;
+}
+
+template <typename T>
+static bool sameElements(const std::vector<T> & a, const std::vector<T> & b)
+{
+	return a.size() == b.size() && (a.empty() || memcmp(&a[0], &b[0], a.size() * sizeof(T)) == 0);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    OBJ
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A strip of quads. Every quad writes its own vertices, uvs and normals right before its face,
+// every other face uses negative (relative) indices, and some faces reach back to the vertices
+// of the previous quad, so faces at the chunk boundaries depend on elements of the chunk before.
+static std::string quadStripOBJ(int quads)
+{
+	std::string text = "# quad strip\no strip\n";
+	char line[160];
+	for (int q = 0; q < quads; q++){
+		sprintf(line, "v %d.5 0 %d\nv %d.5 1 -%d.25\nvt %d.125 0.5\nvt 0.25 %d.75\nvn 0 0 1\n", q, q % 7, q, q % 5, q % 3, q % 11);
+		text += line;
+		int v = 2 * q + 1, vt = 2 * q + 1, vn = q + 1;
+		if (q % 2 == 0){
+			sprintf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", v, vt, vn, v + 1, vt + 1, vn, v > 2 ? v - 1 : v + 1, vt, vn);
+		}else{
+			// quad with the two vertices of the previous quad, all relative
+			sprintf(line, "f -2/-2/-1 -1/-1/-1 -3/-1/-1 -4/-2/-1\n");
+		}
+		text += line;
+		if (q % 50 == 0)
+			text += "g group\n# a comment between faces\n";
+	}
+	return text;
+}
+
+// The parallel parse (user-002) must give exactly what the serial one gives, for any chunk count
+static void testParallelOBJ()
+{
+	const char * path = "selftest_strip.obj";
+	if (!writeTextFile(path, quadStripOBJ(5000))){
+		failures++;
+		return;
+	}
+
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<glm::vec2> uvs;
+	CHECK(loadOBJ(path, vertices, uvs, normals));
+	CHECK(vertices.size() == 2500 * 3 + 2500 * 6);
+
+	size_t chunkCounts[] = { 1, 2, 7, 64 };
+	for (size_t i = 0; i < sizeof(chunkCounts) / sizeof(chunkCounts[0]); i++){
+		std::vector<glm::vec3> parallelVertices, parallelNormals;
+		std::vector<glm::vec2> parallelUVs;
+		CHECK(loadOBJParallel(path, parallelVertices, parallelUVs, parallelNormals, chunkCounts[i]));
+		CHECK(sameElements(vertices, parallelVertices));
+		CHECK(sameElements(uvs, parallelUVs));
+		CHECK(sameElements(normals, parallelNormals));
+	}
+	remove(path);
+}
+
+// Every triangle has uvs of its own, so there are many more (v, vt, vn) combinations than
+// positions. The corner table of loadOBJIndexed (user-003) used to fill up and probe forever.
+static void testIndexedOBJWithSeams()
+{
+	const char * path = "selftest_seams.obj";
+	std::string text = "vn 0 1 0\n";
+	char line[128];
+	const int size = 10; // 10x10 positions, 9x9x2 triangles, 486 corners with their own uv
+	for (int z = 0; z < size; z++)
+		for (int x = 0; x < size; x++){
+			sprintf(line, "v %d 0 %d\n", x, z);
+			text += line;
+		}
+	int uv = 0;
+	for (int z = 0; z + 1 < size; z++)
+		for (int x = 0; x + 1 < size; x++){
+			int a = z * size + x + 1, b = a + 1, c = a + size, d = c + 1;
+			int corners[6] = { a, b, d, a, d, c };
+			for (int t = 0; t < 2; t++){
+				text += "vt 0 0\nvt 1 0\nvt 1 1\n";
+				sprintf(line, "f %d/%d/1 %d/%d/1 %d/%d/1\n", corners[t * 3], uv + 1, corners[t * 3 + 1], uv + 2, corners[t * 3 + 2], uv + 3);
+				text += line;
+				uv += 3;
+			}
+		}
+	if (!writeTextFile(path, text)){
+		failures++;
+		return;
+	}
+
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<glm::vec2> uvs;
+	CHECK(loadOBJ(path, vertices, uvs, normals));
+
+	std::vector<unsigned int> indices;
+	std::vector<glm::vec3> indexedVertices, indexedNormals;
+	std::vector<glm::vec2> indexedUVs;
+	CHECK(loadOBJIndexed(path, indices, indexedVertices, indexedUVs, indexedNormals));
+	CHECK(indices.size() == vertices.size());
+	CHECK(indexedVertices.size() == (size_t)uv); // no two corners share their uv index
+
+	bool same = indices.size() == vertices.size();
+	for (size_t i = 0; same && i < indices.size(); i++)
+		same = indices[i] < indexedVertices.size() && indexedVertices[indices[i]] == vertices[i]
+			&& indexedUVs[indices[i]] == uvs[i] && indexedNormals[indices[i]] == normals[i];
+	CHECK(same);
+	remove(path);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Transforms
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Small deterministic generator, the values cover several orders of magnitude and both signs
+static unsigned int randomState = 12345;
+static float randomFloat()
+{
+	randomState = randomState * 1664525u + 1013904223u;
+	float unit = (randomState >> 8) / 16777216.0f;
+	return (unit - 0.5f) * ((randomState & 3) == 0 ? 1000.0f : 2.0f);
+}
+
+static glm::mat4 randomMatrix()
+{
+	glm::mat4 m;
+	for (int c = 0; c < 4; c++)
+		for (int r = 0; r < 4; r++)
+			m[c][r] = randomFloat();
+	return m;
+}
+
+static bool sameMatrix(const glm::mat4 & a, const glm::mat4 & b)
+{
+	return memcmp(&a[0][0], &b[0][0], sizeof(glm::mat4)) == 0;
+}
+
+// The kernels (user-013) promise the bits of glm's operator*, whichever one the CPU gets
+static void testTransformBatch()
+{
+	printf("Matrix kernel : %s\n", transformKernelName());
+	const size_t count = 37; // not a multiple of any vector width
+	std::vector<glm::mat4> a(count), b(count), out(count);
+	for (size_t i = 0; i < count; i++){
+		a[i] = randomMatrix();
+		b[i] = randomMatrix();
+	}
+
+	glm::mat4 single;
+	multiplyMatrix(a[0], b[0], single);
+	CHECK(sameMatrix(single, a[0] * b[0]));
+
+	bool same = true;
+	multiplyMatrices(a[0], &b[0], &out[0], count);
+	for (size_t i = 0; i < count; i++)
+		same = same && sameMatrix(out[i], a[0] * b[i]);
+	CHECK(same);
+
+	same = true;
+	multiplyMatrices(&a[0], &b[0], &out[0], count);
+	for (size_t i = 0; i < count; i++)
+		same = same && sameMatrix(out[i], a[i] * b[i]);
+	CHECK(same);
+
+	// "out" may be "b"
+	std::vector<glm::mat4> inPlace = b;
+	multiplyMatrices(&a[0], &inPlace[0], &inPlace[0], count);
+	same = true;
+	for (size_t i = 0; i < count; i++)
+		same = same && sameMatrix(inPlace[i], a[i] * b[i]);
+	CHECK(same);
+}
+
+// updateSceneGraph multiplies level by level, the result must be that of walking the parents
+static void testSceneGraph()
+{
+	SceneGraph graph;
+	for (int i = 0; i < 200; i++){
+		int parent = i == 0 ? -1 : (i % 17 == 0 ? -1 : (int)(randomState % i));
+		randomFloat();
+		int node = addSceneNode(graph, parent);
+		setTranslation(graph, node, glm::vec3(randomFloat(), randomFloat(), randomFloat()));
+		setRotation(graph, node, glm::angleAxis(randomFloat() * 100.0f, glm::normalize(glm::vec3(randomFloat(), randomFloat(), 1.0f))));
+		setScale(graph, node, glm::vec3(1.0f + randomFloat() * 0.001f));
+	}
+
+	for (int round = 0; round < 2; round++){
+		unsigned int updated = updateSceneGraph(graph);
+		CHECK(updated == (round == 0 ? 200u : 0u));
+
+		bool same = true;
+		for (size_t i = 0; i < graph.nodes.size(); i++){
+			const SceneNode & node = graph.nodes[i];
+			glm::mat4 local = glm::translate(glm::mat4(1.0f), node.translation);
+			local = local * glm::mat4_cast(node.rotation);
+			local = glm::scale(local, node.scale);
+			glm::mat4 world = node.parent >= 0 ? graph.nodes[node.parent].world * local : local;
+			same = same && sameMatrix(world, node.world);
+		}
+		CHECK(same);
+	}
+
+	// A changed node updates its whole subtree and nothing else
+	setTranslation(graph, 1, glm::vec3(5.0f));
+	unsigned int expected = 0;
+	std::vector<bool> inSubtree(graph.nodes.size(), false);
+	for (size_t i = 0; i < graph.nodes.size(); i++){
+		inSubtree[i] = i == 1 || (graph.nodes[i].parent >= 0 && inSubtree[graph.nodes[i].parent]);
+		expected += inSubtree[i] ? 1 : 0;
+	}
+	CHECK(updateSceneGraph(graph) == expected);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool runSelfTests()
+{
+	failures = 0;
+	testParallelOBJ();
+	testIndexedOBJWithSeams();
+	testTransformBatch();
+	testSceneGraph();
+
+	if (failures)
+		printf("%d checks failed\n", failures);
+	else
+		printf("All checks passed\n");
+	return failures == 0;
+}
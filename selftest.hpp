@@ -0,0 +1,11 @@
+#ifndef SELFTEST_HPP
+#define SELFTEST_HPP
+
+// Checks of the loaders and the math that need no window and no OpenGL context, started with
+// "CGTutorial --selftest". Every failed check prints a line, the temporary files are written to
+// the working directory and removed again.
+
+// true if all checks passed
+bool runSelfTests();
+
+#endif
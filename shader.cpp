@@ -1,8 +1,7 @@
 #include <stdio.h>
 #include <string>
 #include <vector>
-#include <iostream>
-#include <fstream>
+#include <map>
 #include <algorithm>
 using namespace std;
 
@@ -10,100 +9,380 @@ using namespace std;
 #include <string.h>
 
 #include <GL/glew.h>
+#include <GLFW/glfw3.h>
 
 #include "shader.hpp"
+#include "resources.hpp"
+#include "uniforms.hpp"
+#include "uniformbuffers.hpp"
+#include "mappedfile.hpp"
+#include "meshpool.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+// KHR_parallel_shader_compile is newer than GLEW 1.13, it works like the ARB version
+typedef void (GLAPIENTRY * PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) (GLuint count);
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}else{
-		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
-		return 0;
-	}
+#define PROGRAM_CACHE_MAGIC   0x47525043 // "CPRG"
+#define PROGRAM_CACHE_VERSION 1
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
-	}
+// Start of a *.cgprogram file, followed by the binary from glGetProgramBinary
+struct ProgramCacheHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int binaryFormat;
+	unsigned int binarySize;
+	unsigned long long key; // see programKey
+};
 
+// Lets the driver use as many compiler threads as it likes
+static void enableParallelCompile()
+{
+	static bool enabled = false;
+	if (enabled)
+		return;
+	enabled = true;
 
+	if (GLEW_ARB_parallel_shader_compile){
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	}else if (glewGetExtension("GL_KHR_parallel_shader_compile")){
+		PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads =
+			(PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+		if (maxShaderCompilerThreads)
+			maxShaderCompilerThreads(0xFFFFFFFF);
+	}
+}
+
+// ARB_get_program_binary is there and the driver offers at least one format
+static bool programBinariesSupported()
+{
+	static int supported = -1;
+	if (supported < 0){
+		GLint formats = 0;
+		if (GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		supported = formats > 0;
+	}
+	return supported != 0;
+}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
+static unsigned long long hashString(const GLubyte * text, unsigned long long hash)
+{
+	const char * s = text ? (const char *)text : "";
+	return hashBytes(s, strlen(s) + 1, hash);
+}
 
+// Binaries are only valid for the same sources (and defines) on the same driver
+static unsigned long long programKey(const MappedFile & vertexSource, const MappedFile & fragmentSource, const char * defines)
+{
+	unsigned long long key = hashBytes(vertexSource.data, vertexSource.size);
+	key = hashBytes(&vertexSource.size, sizeof(vertexSource.size), key); // separates the two sources
+	key = hashBytes(fragmentSource.data, fragmentSource.size, key);
+	key = hashString((const GLubyte *)defines, key);
+	key = hashString(glGetString(GL_VENDOR), key);
+	key = hashString(glGetString(GL_RENDERER), key);
+	return hashString(glGetString(GL_VERSION), key);
+}
 
+static bool loadProgramBinary(GLuint program, const char * path, unsigned long long key)
+{
+	MappedFile file;
+	if (!mapFile(path, file))
+		return false;
 
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
+	const ProgramCacheHeader * header = (const ProgramCacheHeader *)file.data;
+	bool ok = file.size >= sizeof(ProgramCacheHeader)
+		&& header->magic == PROGRAM_CACHE_MAGIC
+		&& header->version == PROGRAM_CACHE_VERSION
+		&& header->key == key
+		&& file.size == sizeof(ProgramCacheHeader) + header->binarySize;
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
+	// The driver may still reject the binary, e.g. after an update that kept the version string
+	if (ok){
+		glProgramBinary(program, header->binaryFormat, file.data + sizeof(ProgramCacheHeader), header->binarySize);
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		ok = linked == GL_TRUE;
 	}
+	unmapFile(file);
+	return ok;
+}
 
+static void saveProgramBinary(GLuint program, const char * path, unsigned long long key)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
 
+	std::vector<char> data(sizeof(ProgramCacheHeader) + length);
+	GLenum format = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(program, length, &written, &format, &data[sizeof(ProgramCacheHeader)]);
+	if (written <= 0)
+		return;
+	data.resize(sizeof(ProgramCacheHeader) + written);
 
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
+	ProgramCacheHeader * header = (ProgramCacheHeader *)&data[0];
+	header->magic = PROGRAM_CACHE_MAGIC;
+	header->version = PROGRAM_CACHE_VERSION;
+	header->binaryFormat = format;
+	header->binarySize = (unsigned int)written;
+	header->key = key;
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
+	FILE * file = fopen(path, "wb");
+	bool ok = file && fwrite(&data[0], 1, data.size(), file) == data.size();
+	if (file && fclose(file) != 0)
+		ok = false;
+	if (!ok)
+		printf("Could not write %s\n", path);
+}
+
+// The defines go right after the #version line, which has to stay the first line
+static GLuint compileShader(GLenum type, const MappedFile & source, const char * defines)
+{
+	GLint versionLength = 0;
+	if (defines && source.size > 8 && memcmp(source.data, "#version", 8) == 0){
+		const char * end = (const char *)memchr(source.data, '\n', source.size);
+		versionLength = end ? (GLint)(end - source.data + 1) : (GLint)source.size;
 	}
 
+	// "#line 2" keeps the line numbers in error messages those of the file
+	std::string header = defines ? std::string(defines) + "#line 2\n" : std::string();
+	const char * texts[3] = { source.data, header.c_str(), source.data + versionLength };
+	GLint lengths[3] = { versionLength, (GLint)header.size(), (GLint)source.size - versionLength };
 
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 3, texts, lengths);
+	glCompileShader(shader);
+	return shader;
+}
 
-	// Link the program
-	printf("Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
+static void printShaderLog(GLuint shader)
+{
+	int InfoLogLength = 0;
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if ( InfoLogLength > 1 ){
+		std::vector<char> ShaderErrorMessage(InfoLogLength+1);
+		glGetShaderInfoLog(shader, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+		printf("%s\n", &ShaderErrorMessage[0]);
+	}
+}
 
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
+static void printProgramLog(GLuint program)
+{
+	int InfoLogLength = 0;
+	glGetProgramiv(program, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if ( InfoLogLength > 1 ){
 		std::vector<char> ProgramErrorMessage(InfoLogLength+1);
-		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+		glGetProgramInfoLog(program, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 		printf("%s\n", &ProgramErrorMessage[0]);
 	}
+}
+
+// A program between submitting and checking
+struct PendingProgram
+{
+	GLuint program;
+	GLuint vertexShader;
+	GLuint fragmentShader;
+	bool fromCache;
+	unsigned long long key;
+	std::string cachePath;
+};
+
+void LoadShadersBatch(const ShaderProgramFiles * programs, size_t count, GLuint * out_programs)
+{
+	enableParallelCompile();
+	bool useCache = programBinariesSupported();
+
+	// Submit everything, nothing here waits for the compiler
+	std::vector<PendingProgram> pending(count);
+	for (size_t i = 0; i < count; i++){
+		PendingProgram & p = pending[i];
+		p.program = p.vertexShader = p.fragmentShader = 0;
+		p.fromCache = false;
+		p.key = 0;
+
+		// Each source is read in one go, straight from the mapped file
+		MappedFile vertexSource, fragmentSource;
+		if (!mapFile(programs[i].vertexPath, vertexSource)){
+			printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", programs[i].vertexPath);
+			continue;
+		}
+		if (!mapFile(programs[i].fragmentPath, fragmentSource)){
+			printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", programs[i].fragmentPath);
+			unmapFile(vertexSource);
+			continue;
+		}
+
+		p.program = glCreateProgram();
+		trackResource(RESOURCE_PROGRAM, p.program, programs[i].vertexPath);
+
+		if (useCache){
+			p.key = programKey(vertexSource, fragmentSource, programs[i].defines);
+			char suffix[32];
+			sprintf(suffix, ".%016llx.cgprogram", p.key);
+			p.cachePath = std::string(programs[i].vertexPath) + suffix;
+			p.fromCache = loadProgramBinary(p.program, p.cachePath.c_str(), p.key);
+		}
+
+		if (p.fromCache){
+			printf("Loaded program %s from the cache\n", programs[i].vertexPath);
+		}else{
+			printf("Compiling shader : %s\n", programs[i].vertexPath);
+			p.vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource, programs[i].defines);
+			printf("Compiling shader : %s\n", programs[i].fragmentPath);
+			p.fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource, programs[i].defines);
+
+			printf("Linking program\n");
+			glAttachShader(p.program, p.vertexShader);
+			glAttachShader(p.program, p.fragmentShader);
+			if (useCache)
+				glProgramParameteri(p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			glLinkProgram(p.program);
+		}
+
+		// glShaderSource has copied the sources
+		unmapFile(vertexSource);
+		unmapFile(fragmentSource);
+	}
 
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	// Only now ask for the results, by then the first programs are likely done
+	for (size_t i = 0; i < count; i++){
+		PendingProgram & p = pending[i];
+		if (p.program && !p.fromCache){
+			GLint Result = GL_FALSE;
+			glGetProgramiv(p.program, GL_LINK_STATUS, &Result);
+			printShaderLog(p.vertexShader);
+			printShaderLog(p.fragmentShader);
+			printProgramLog(p.program);
 
+			glDeleteShader(p.vertexShader);
+			glDeleteShader(p.fragmentShader);
+
+			if (Result != GL_TRUE){
+				printf("Linking %s failed\n", programs[i].vertexPath);
+				deleteProgram(p.program);
+			}else if (useCache){
+				saveProgramBinary(p.program, p.cachePath.c_str(), p.key);
+			}
+		}
+
+		// Look up all uniforms once, see uniforms.hpp, and connect the shared uniform blocks
+		if (p.program){
+			reflectUniforms(p.program);
+			bindUniformBlocks(p.program);
+			bindMeshDrawBlock(p.program);
+		}
+		out_programs[i] = p.program;
+	}
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+	ShaderProgramFiles files = { vertex_file_path, fragment_file_path, NULL };
+	GLuint ProgramID = 0;
+	LoadShadersBatch(&files, 1, &ProgramID);
 	return ProgramID;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Permutations
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// All permutations loaded so far, by files and defines
+typedef std::map<std::string, GLuint> PermutationMap;
+static PermutationMap permutations;
+
+// Features that make no difference are dropped, so equal shaders get equal defines
+static void normalizePermutation(unsigned int & features, unsigned int & lights)
+{
+	if (lights > SHADER_MAX_LIGHTS)
+		lights = SHADER_MAX_LIGHTS;
+	if (!(features & SHADER_NORMALS))
+		lights = 0; // nothing to light
+	if (lights == 0)
+		features &= ~SHADER_NORMALS; // normals are only read for the lighting
+	if (features & SHADER_TEXTURE_ARRAY)
+		features |= SHADER_TEXTURE;
+	if (features & SHADER_MULTI_DRAW)
+		features &= ~SHADER_INSTANCED;
+	if (features & SHADER_INSTANCED)
+		features &= ~SHADER_QUANTIZED; // instances have no PositionScale/PositionBias
+}
+
+std::string shaderDefines(unsigned int features, unsigned int lights)
+{
+	normalizePermutation(features, lights);
+
+	std::string defines;
+	if (features & SHADER_TEXTURE)
+		defines += "#define HAS_TEXTURE\n";
+	if (features & SHADER_NORMALS)
+		defines += "#define HAS_NORMALS\n";
+	if (features & SHADER_QUANTIZED)
+		defines += "#define QUANTIZED_ATTRIBS\n";
+	if (features & SHADER_INSTANCED)
+		defines += "#define INSTANCED\n";
+	if (features & SHADER_TEXTURE_ARRAY)
+		defines += "#define TEXTURE_ARRAY\n";
+	if (features & SHADER_MULTI_DRAW)
+		defines += "#define MULTI_DRAW\n";
+
+	char line[32];
+	sprintf(line, "#define NUM_LIGHTS %u\n", lights);
+	return defines + line;
+}
+
+static std::string permutationName(const char * vertexPath, const char * fragmentPath, const std::string & defines)
+{
+	return std::string(vertexPath) + "\n" + fragmentPath + "\n" + defines;
+}
+
+void preloadShaderPermutations(const char * vertexPath, const char * fragmentPath, const ShaderPermutation * list, size_t count)
+{
+	std::vector<std::string> defines;
+	std::vector<std::string> names;
+	for (size_t i = 0; i < count; i++){
+		std::string d = shaderDefines(list[i].features, list[i].lights);
+		std::string name = permutationName(vertexPath, fragmentPath, d);
+		if (permutations.count(name) || std::find(names.begin(), names.end(), name) != names.end())
+			continue;
+		defines.push_back(d);
+		names.push_back(name);
+	}
+	if (names.empty())
+		return;
 
+	// c_str stays valid, "defines" is not changed any more
+	std::vector<ShaderProgramFiles> files(names.size());
+	for (size_t i = 0; i < names.size(); i++){
+		ShaderProgramFiles f = { vertexPath, fragmentPath, defines[i].c_str() };
+		files[i] = f;
+	}
+
+	std::vector<GLuint> programs(names.size());
+	LoadShadersBatch(&files[0], files.size(), &programs[0]);
+	for (size_t i = 0; i < names.size(); i++)
+		permutations[names[i]] = programs[i];
+}
+
+GLuint LoadShaderPermutation(const char * vertexPath, const char * fragmentPath, unsigned int features, unsigned int lights)
+{
+	std::string name = permutationName(vertexPath, fragmentPath, shaderDefines(features, lights));
+	PermutationMap::iterator it = permutations.find(name);
+	if (it != permutations.end())
+		return it->second;
+
+	ShaderPermutation permutation = { features, lights };
+	preloadShaderPermutations(vertexPath, fragmentPath, &permutation, 1);
+	return permutations[name];
+}
+
+void deleteShaderPermutations()
+{
+	for (PermutationMap::iterator it = permutations.begin(); it != permutations.end(); ++it){
+		if (it->second)
+			deleteProgram(it->second);
+	}
+	permutations.clear();
+}
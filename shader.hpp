@@ -1,6 +1,59 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
+#include <stddef.h>
+#include <string>
+
+// Compiles and links one program. Linked programs are cached next to the vertex shader as
+// "<vertex shader>.<hash>.cgprogram" (glGetProgramBinary), the hash covers both sources and the
+// driver (vendor, renderer, version), so a changed shader or driver simply misses the cache.
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
 
+struct ShaderProgramFiles
+{
+	const char * vertexPath;
+	const char * fragmentPath;
+	const char * defines;   // "#define ...\n" lines inserted after #version, may be NULL
+};
+
+// Like LoadShaders for many programs at once. All programs are submitted for compiling and
+// linking before the status of the first one is queried, so a driver with
+// KHR_parallel_shader_compile (or the ARB version) compiles them in parallel instead of
+// stalling on each one. out_programs[i] is 0 if program i failed.
+void LoadShadersBatch(const ShaderProgramFiles * programs, size_t count, GLuint * out_programs);
+
+// Permutations : one pair of shader files (e.g. StandardShading.*) compiled with different
+// #defines, so every draw can use the cheapest variant that still does what it needs.
+// Each feature bit becomes a #define, see StandardShading.vertexshader.
+enum ShaderFeature
+{
+	SHADER_TEXTURE       = 1, // HAS_TEXTURE : diffuse color from myTextureSampler (texture unit 0)
+	SHADER_NORMALS       = 2, // HAS_NORMALS : reads the normals, needed for lighting
+	SHADER_QUANTIZED     = 4, // QUANTIZED_ATTRIBS : positions relative to the bounding box (see mesh.hpp), ignored with SHADER_INSTANCED
+	SHADER_INSTANCED     = 8, // INSTANCED : model matrix and color per instance (see instancing.hpp)
+	SHADER_TEXTURE_ARRAY = 16, // TEXTURE_ARRAY : myTextureSampler is a layer of an array (see texturearray.hpp), implies SHADER_TEXTURE
+	SHADER_MULTI_DRAW    = 32  // MULTI_DRAW : model matrix per draw from "MeshDraws" (see meshpool.hpp), replaces SHADER_INSTANCED
+};
+
+#define SHADER_MAX_LIGHTS 1 // NUM_LIGHTS, PerFrame holds a single light
+
+struct ShaderPermutation
+{
+	unsigned int features; // ShaderFeature bits
+	unsigned int lights;   // 0 : flat color without lighting
+};
+
+// The #define lines of a permutation. Features without effect are dropped (lights without
+// normals, normals without lights), so permutations that compile to the same program are equal.
+std::string shaderDefines(unsigned int features, unsigned int lights);
+
+// Program of a permutation, compiled (or read from the program cache) on first use.
+// Equal permutations share one program, a failed one stays 0.
+GLuint LoadShaderPermutation(const char * vertexPath, const char * fragmentPath, unsigned int features, unsigned int lights = 1);
+
+// Compiles all permutations in the list at once (see LoadShadersBatch), e.g. at startup
+void preloadShaderPermutations(const char * vertexPath, const char * fragmentPath, const ShaderPermutation * permutations, size_t count);
+
+void deleteShaderPermutations();
+
 #endif
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "streambuffer.hpp"
+#include "resources.hpp"
+
+// All live stream buffers, for endStreamFrames
+static std::vector<StreamBuffer *> streams;
+
+bool createStreamBuffer(StreamBuffer & stream, GLenum target, GLsizeiptr regionSize, GLsizeiptr alignment, const char * name)
+{
+	stream.target = target;
+	stream.alignment = alignment > 0 ? alignment : 1;
+	stream.regionSize = (regionSize + stream.alignment - 1) / stream.alignment * stream.alignment;
+	stream.persistent = NULL;
+	memset(stream.fences, 0, sizeof(stream.fences));
+	stream.region = 0;
+	stream.regionOffset = 0;
+
+	GLsizeiptr total = stream.regionSize * STREAM_REGIONS;
+	stream.buffer = createBuffer(name);
+	glBindBuffer(target, stream.buffer);
+
+	if (GLEW_ARB_buffer_storage){
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(target, total, NULL, flags);
+		setResourceBytes(RESOURCE_BUFFER, stream.buffer, (unsigned long long)total);
+		stream.persistent = (char *)glMapBufferRange(target, 0, total, flags);
+		if (!stream.persistent)
+			printf("Could not map %s persistently, mapping every allocation instead\n", name);
+	}else{
+		bufferData(target, stream.buffer, total, NULL, GL_STREAM_DRAW);
+	}
+
+	streams.push_back(&stream);
+	return stream.buffer != 0;
+}
+
+void deleteStreamBuffer(StreamBuffer & stream)
+{
+	streams.erase(std::remove(streams.begin(), streams.end(), &stream), streams.end());
+	if (!stream.buffer)
+		return;
+
+	for (int i = 0; i < STREAM_REGIONS; i++){
+		if (stream.fences[i])
+			glDeleteSync(stream.fences[i]);
+		stream.fences[i] = 0;
+	}
+	if (stream.persistent){
+		glBindBuffer(stream.target, stream.buffer);
+		glUnmapBuffer(stream.target);
+		stream.persistent = NULL;
+	}
+	deleteBuffer(stream.buffer);
+	std::vector<char>().swap(stream.staging);
+}
+
+bool growStreamBuffer(StreamBuffer & stream, GLsizeiptr size, const char * name)
+{
+	GLsizeiptr regionSize = stream.regionSize > 0 ? stream.regionSize : 1;
+	while (regionSize < size)
+		regionSize *= 2;
+
+	GLenum target = stream.target;
+	GLsizeiptr alignment = stream.alignment;
+	deleteStreamBuffer(stream);
+	printf("Growing %s to %.1f MB per frame\n", name, regionSize / (1024.0 * 1024.0));
+	return createStreamBuffer(stream, target, regionSize, alignment, name);
+}
+
+// Fences the current region and moves to the next one, waits until the GPU no longer reads it
+static void nextRegion(StreamBuffer & stream)
+{
+	if (stream.regionOffset > 0)
+		stream.fences[stream.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	stream.region = (stream.region + 1) % STREAM_REGIONS;
+	stream.regionOffset = 0;
+
+	GLsync & fence = stream.fences[stream.region];
+	if (fence){
+		GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED)
+			printf("Waiting for a stream buffer failed\n");
+		glDeleteSync(fence);
+		fence = 0;
+	}
+}
+
+bool allocateStream(StreamBuffer & stream, GLsizeiptr size, StreamAllocation & out_allocation)
+{
+	if (size <= 0 || size > stream.regionSize)
+		return false;
+	if (stream.regionOffset + size > stream.regionSize)
+		nextRegion(stream);
+
+	GLintptr offset = stream.region * stream.regionSize + stream.regionOffset;
+	stream.regionOffset += (size + stream.alignment - 1) / stream.alignment * stream.alignment;
+
+	out_allocation.offset = offset;
+	out_allocation.size = size;
+	out_allocation.mapped = false;
+
+	if (stream.persistent){
+		out_allocation.data = stream.persistent + offset;
+		return true;
+	}
+
+	// Unsynchronized : the fences make sure this range is not in use
+	glBindBuffer(stream.target, stream.buffer);
+	out_allocation.data = glMapBufferRange(stream.target, offset, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (out_allocation.data){
+		out_allocation.mapped = true;
+	}else{
+		if ((GLsizeiptr)stream.staging.size() < size)
+			stream.staging.resize(size);
+		out_allocation.data = &stream.staging[0];
+	}
+	return true;
+}
+
+void commitStream(StreamBuffer & stream, const StreamAllocation & allocation)
+{
+	if (stream.persistent)
+		return; // coherent, the GPU sees the writes without any call
+
+	glBindBuffer(stream.target, stream.buffer);
+	if (allocation.mapped)
+		glUnmapBuffer(stream.target);
+	else
+		glBufferSubData(stream.target, allocation.offset, allocation.size, allocation.data);
+}
+
+GLintptr streamData(StreamBuffer & stream, const void * data, GLsizeiptr size)
+{
+	StreamAllocation allocation;
+	if (!allocateStream(stream, size, allocation))
+		return -1;
+	memcpy(allocation.data, data, size);
+	commitStream(stream, allocation);
+	return allocation.offset;
+}
+
+void endStreamFrames()
+{
+	for (size_t i = 0; i < streams.size(); i++)
+		nextRegion(*streams[i]);
+}
@@ -0,0 +1,63 @@
+#ifndef STREAMBUFFER_HPP
+#define STREAMBUFFER_HPP
+
+#include <vector>
+
+#include <GL/glew.h>
+
+// Buffers for data that is written by the CPU every frame (uniform blocks, instance data, ...).
+// The buffer is split into STREAM_REGIONS regions, one per frame in flight. Allocations are
+// taken from the current region, endStreamFrames places a fence behind the frame and moves on
+// to the next region, waiting only if the GPU still reads it. The CPU therefore never
+// overwrites data the GPU needs and the driver never has to copy or synchronise.
+//
+// With ARB_buffer_storage the whole buffer stays mapped (persistent, coherent), allocations
+// are plain pointers into it. Without it every allocation maps its range with
+// GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT, and if even that fails the data goes
+// through glBufferSubData.
+
+#define STREAM_REGIONS 3
+
+struct StreamBuffer
+{
+	GLuint buffer;
+	GLenum target;          // used for mapping and glBufferSubData
+	GLsizeiptr regionSize;
+	GLsizeiptr alignment;   // of every allocation
+	char * persistent;      // the whole buffer, NULL if not persistently mapped
+	GLsync fences[STREAM_REGIONS];
+	int region;
+	GLsizeiptr regionOffset; // next free byte in the current region
+	std::vector<char> staging; // for the glBufferSubData fallback
+};
+
+// Space handed out by allocateStream, write "size" bytes to "data", then call commitStream
+struct StreamAllocation
+{
+	void * data;
+	GLintptr offset;        // in the buffer, e.g. for glBindBufferRange or attribute pointers
+	GLsizeiptr size;
+	bool mapped;            // mapped with glMapBufferRange, unmapped in commitStream
+};
+
+bool createStreamBuffer(StreamBuffer & stream, GLenum target, GLsizeiptr regionSize, GLsizeiptr alignment, const char * name);
+void deleteStreamBuffer(StreamBuffer & stream);
+
+// Replaces the buffer with a new one whose regions hold at least "size" bytes (the region size
+// doubles until it fits), for a frame that needs more than the buffer was created for. Offsets
+// of earlier allocations are meaningless afterwards, so only grow a buffer before its first
+// allocation of the frame. The GPU still finishes reading the old buffer, OpenGL frees it later.
+bool growStreamBuffer(StreamBuffer & stream, GLsizeiptr size, const char * name);
+
+// False if size is larger than a region. If the current region is full, the next one is used
+// (waiting for the GPU if necessary), so regionSize should hold a whole frame.
+bool allocateStream(StreamBuffer & stream, GLsizeiptr size, StreamAllocation & out_allocation);
+void commitStream(StreamBuffer & stream, const StreamAllocation & allocation);
+
+// allocateStream, memcpy and commitStream in one, returns the offset or -1
+GLintptr streamData(StreamBuffer & stream, const void * data, GLsizeiptr size);
+
+// Once per frame after the last draw, for all stream buffers
+void endStreamFrames();
+
+#endif
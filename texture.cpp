@@ -1,91 +1,96 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 
 #include <GL/glew.h>
 
 #include <GLFW/glfw3.h>
 
+#include "resources.hpp"
+#include "glstate.hpp"
+#include "texture.hpp"
+#include "mappedfile.hpp"
 
-GLuint loadBMP_custom(const char * imagepath){
-
-	printf("Reading image %s\n", imagepath);
-
-	// Data read from the header of the BMP file
-	unsigned char header[54];
-	unsigned int dataPos;
-	unsigned int imageSize;
-	unsigned int width, height;
-	// Actual RGB data
-	unsigned char * data;
 
-	// Open the file
-	FILE * file = fopen(imagepath,"rb");
-	if (!file)							    {printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); return 0;}
+bool readBMP(const char * imagepath, Image & out_image){
 
-	// Read the header, i.e. the 54 first bytes
+	printf("Reading image %s\n", imagepath);
 
-	// If less than 54 bytes are read, problem
-	if ( fread(header, 1, 54, file)!=54 ){ 
-		printf("Not a correct BMP file\n");
-		return 0;
-	}
-	// A BMP files always begins with "BM"
-	if ( header[0]!='B' || header[1]!='M' ){
-		printf("Not a correct BMP file\n");
-		return 0;
+	// The whole file is mapped, the header fields are read byte by byte (see decodeBMP)
+	MappedFile file;
+	if (!mapFile(imagepath, file)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return false;
 	}
-	// Make sure this is a 24bpp file
-	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    return 0;}
-	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    return 0;}
 
-	// Read the information about the image
-	dataPos    = *(int*)&(header[0x0A]);
-	imageSize  = *(int*)&(header[0x22]);
-	width      = *(int*)&(header[0x12]);
-	height     = *(int*)&(header[0x16]);
+	bool ok = decodeBMP((const unsigned char *)file.data, file.size, out_image);
+	unmapFile(file);
+	if (!ok)
+		printf("%s could not be read\n", imagepath);
+	return ok;
+}
 
-	// Some BMP files are misformatted, guess missing information
-	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
-	if (dataPos==0)      dataPos=54; // The BMP header is done that way
+bool readBMPMipmapped(const char * imagepath, MipChain & out_chain){
 
-	// Create a buffer
-	data = new unsigned char [imageSize];
+	Image image;
+	if (!readBMP(imagepath, image))
+		return false;
+	buildMipChain(image, out_chain);
+	return true;
+}
 
-	// Read the actual data from the file into the buffer
-	fread(data,1,imageSize,file);
+GLuint uploadMipChain(const MipChain & chain, const char * name){
 
-	// Everything is in memory now, the file wan be closed
-	fclose (file);
+	const Image & base = chain.levels[0];
+	GLsizei levels = (GLsizei)chain.levels.size();
 
 	// Create one OpenGL texture
-	GLuint textureID;
-	glGenTextures(1, &textureID);
+	GLuint textureID = createTexture(name);
 	
 	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-
-	// Give the image to OpenGL
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
-
-	// OpenGL has now copied the data. Free our own version
-	delete [] data;
+	bindTexture(0, GL_TEXTURE_2D, textureID);
+
+	// Give the image to OpenGL. RGBA rows need no repacking by the driver, and with immutable
+	// storage all levels are allocated at once and the texture is complete from the start.
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (GLEW_ARB_texture_storage)
+		glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, base.width, base.height);
+
+	unsigned long long bytes = 0;
+	for (GLsizei level = 0; level < levels; level++){
+		const Image & image = chain.levels[level];
+		if (GLEW_ARB_texture_storage)
+			glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, &image.pixels[0]);
+		else
+			glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &image.pixels[0]);
+		bytes += image.pixels.size();
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	setResourceBytes(RESOURCE_TEXTURE, textureID, bytes);
 
 	// Poor filtering, or ...
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
 
-	// ... nice trilinear filtering.
+	// ... nice trilinear filtering. The mipmaps come from buildMipChain, not glGenerateMipmap.
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
-	glGenerateMipmap(GL_TEXTURE_2D);
 
 	// Return the ID of the texture we just created
 	return textureID;
 }
 
+GLuint loadBMP_custom(const char * imagepath){
+
+	MipChain chain;
+	if (!readBMPMipmapped(imagepath, chain))
+		return 0;
+	return uploadMipChain(chain, imagepath);
+}
+
 /* Geht nicht mehr ab GLFW3
 GLuint loadTGA_glfw(const char * imagepath){
 
@@ -94,7 +99,7 @@ GLuint loadTGA_glfw(const char * imagepath){
 	glGenTextures(1, &textureID);
 
 	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
+	bindTexture(0, GL_TEXTURE_2D, textureID);
 
 	// Read the file, call glTexImage2D with the right parameters
 	glfwLoadTexture2D(imagepath, 0);
@@ -112,51 +117,38 @@ GLuint loadTGA_glfw(const char * imagepath){
 
 */
 
+// DDS header fields are little endian and not aligned
+static unsigned int readU32(const unsigned char * p){
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
 #define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
 #define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
 #define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
 
-GLuint loadDDS(const char * imagepath){
-
-	unsigned char header[124];
+bool readDDS(const char * imagepath, CompressedImage & out_image){
 
-	FILE *fp; 
- 
-	/* try to open the file */ 
-	fp = fopen(imagepath, "rb"); 
-	if (fp == NULL){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
-		return 0;
+	// The whole file is mapped, every size is checked against the file size before it is used
+	MappedFile & file = out_image.file;
+	if (!mapFile(imagepath, file)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return false;
 	}
-   
-	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
+	const unsigned char * data = (const unsigned char *)file.data;
+
+	/* verify the type of file, "DDS " and the 124 bytes of the surface desc */ 
+	if (file.size < 128 || memcmp(data, "DDS ", 4) != 0 || readU32(data + 4) != 124) { 
+		printf("%s is not a DDS file\n", imagepath);
+		unmapFile(file);
+		return false; 
 	}
-	
-	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
-
-	unsigned int height      = *(unsigned int*)&(header[8 ]);
-	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
-	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
-	unsigned int fourCC      = *(unsigned int*)&(header[80]);
-
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
-
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
+	const unsigned char * header = data + 4;
+
+	unsigned int height      = readU32(header + 8);
+	unsigned int width	     = readU32(header + 12);
+	unsigned int mipMapCount = readU32(header + 24);
+	unsigned int fourCC      = readU32(header + 80);
+
 	unsigned int format;
 	switch(fourCC) 
 	{ 
@@ -170,27 +162,74 @@ GLuint loadDDS(const char * imagepath){
 		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
 		break; 
 	default: 
-		free(buffer); 
-		return 0; 
+		printf("%s : only DXT1, DXT3 and DXT5 are supported\n", imagepath);
+		unmapFile(file);
+		return false; 
+	}
+
+	if (width == 0 || height == 0 || width > 65536 || height > 65536){
+		printf("%s has an invalid size\n", imagepath);
+		unmapFile(file);
+		return false;
+	}
+
+	// No more levels than down to 1x1, files without mipmaps may say 0
+	unsigned int maxLevels = 1;
+	while ((width >> maxLevels) || (height >> maxLevels))
+		maxLevels++;
+	if (mipMapCount == 0)
+		mipMapCount = 1;
+	if (mipMapCount > maxLevels)
+		mipMapCount = maxLevels;
+
+	/* how big is it going to be including all mipmaps? Computed exactly instead of guessed */ 
+	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
+	unsigned long long bufsize = 0;
+	for (unsigned int level = 0; level < mipMapCount; ++level){
+		unsigned int w = width >> level, h = height >> level;
+		bufsize += (unsigned long long)((std::max(w, 1u) + 3) / 4) * ((std::max(h, 1u) + 3) / 4) * blockSize;
+	}
+	if (file.size - 128 < bufsize){
+		printf("%s is truncated\n", imagepath);
+		unmapFile(file);
+		return false;
 	}
 
+	out_image.format = format;
+	out_image.width = width;
+	out_image.height = height;
+	out_image.levels = mipMapCount;
+	out_image.blocks = data + 128;
+	out_image.bytes = bufsize;
+	return true;
+}
+
+void closeDDS(CompressedImage & image){
+
+	unmapFile(image.file);
+	image.blocks = 0;
+}
+
+GLuint uploadCompressed(const CompressedImage & image, const char * name){
+
+	unsigned int width = image.width, height = image.height;
+	unsigned int blockSize = (image.format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
+
 	// Create one OpenGL texture
-	GLuint textureID;
-	glGenTextures(1, &textureID);
+	GLuint textureID = createTexture(name);
 
 	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
+	bindTexture(0, GL_TEXTURE_2D, textureID);
 	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
 	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
 	unsigned int offset = 0;
 
 	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
+	for (unsigned int level = 0; level < image.levels; ++level) 
 	{ 
 		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, image.format, width, height,  
+			0, size, image.blocks + offset); 
 	 
 		offset += size; 
 		width  /= 2; 
@@ -201,8 +240,25 @@ GLuint loadDDS(const char * imagepath){
 		if(height < 1) height = 1;
 
 	} 
+	glPixelStorei(GL_UNPACK_ALIGNMENT,4);
+	setResourceBytes(RESOURCE_TEXTURE, textureID, offset);
+
+	// Without this a file with fewer levels than down to 1x1 would be an incomplete texture
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR); 
 
-	free(buffer); 
+	return textureID;
+}
 
+GLuint loadDDS(const char * imagepath){
+
+	CompressedImage image;
+	if (!readDDS(imagepath, image))
+		return 0;
+	GLuint textureID = uploadCompressed(image, imagepath);
+	closeDDS(image);
 	return textureID;
 }
\ No newline at end of file
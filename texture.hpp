@@ -1,9 +1,21 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
-// Load a .BMP file using our custom loader
+#include <GL/glew.h>
+
+#include "image.hpp"
+#include "mappedfile.hpp"
+
+// Load a .BMP file using our custom loader. Every call creates a new texture, loadTextureAsync
+// (see assets.hpp) shares textures that are loaded already.
 GLuint loadBMP_custom(const char * imagepath);
 
+// The two halves of loadBMP_custom : readBMPMipmapped reads the file and computes the mip
+// levels (any thread, see image.hpp), uploadMipChain creates the texture (OpenGL thread)
+bool readBMP(const char * imagepath, Image & out_image);
+bool readBMPMipmapped(const char * imagepath, MipChain & out_chain);
+GLuint uploadMipChain(const MipChain & chain, const char * name);
+
 // Load a .TGA file using GLFW's own loader
 // Geht nicht mehr ab GLFW3
 //GLuint loadTGA_glfw(const char * imagepath);
@@ -11,5 +23,20 @@ GLuint loadBMP_custom(const char * imagepath);
 // Load a .DDS file using GLFW's own loader
 GLuint loadDDS(const char * imagepath);
 
+// The two halves of loadDDS, like readBMPMipmapped and uploadMipChain. "blocks" point into
+// the mapped file, they stay valid until closeDDS.
+struct CompressedImage
+{
+	MappedFile file;
+	GLenum format; // GL_COMPRESSED_RGBA_S3TC_DXT1/3/5_EXT
+	unsigned int width, height, levels;
+	const unsigned char * blocks;
+	unsigned long long bytes; // all levels
+};
+
+bool readDDS(const char * imagepath, CompressedImage & out_image);
+GLuint uploadCompressed(const CompressedImage & image, const char * name);
+void closeDDS(CompressedImage & image);
+
 
 #endif
\ No newline at end of file
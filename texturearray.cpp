@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "texturearray.hpp"
+#include "resources.hpp"
+#include "glstate.hpp"
+
+struct TextureArray
+{
+	GLuint texture;
+	unsigned int width, height, levels, capacity;
+	unsigned long long bytes;       // all layers and levels
+	std::vector<GLuint> freeLayers; // highest first, layers are handed out from the back
+};
+
+static std::vector<TextureArray *> arrays;
+static unsigned long long arrayBytes = 0;
+static GLint maxLayers = 0;
+static GLuint copyFramebuffer = 0; // for copying layers without ARB_copy_image
+
+static TextureArray * createTextureArray(unsigned int width, unsigned int height, unsigned int levels, unsigned int capacity)
+{
+	char name[64];
+	sprintf(name, "texture array %ux%u", width, height);
+
+	TextureArray * array = new TextureArray();
+	array->texture = createTexture(name);
+	array->width = width;
+	array->height = height;
+	array->levels = levels;
+	array->capacity = capacity;
+	for (unsigned int layer = capacity; layer > 0; layer--)
+		array->freeLayers.push_back(layer - 1);
+
+	// All layers are allocated at once, they are filled by addTextureLayer
+	bindTexture(0, GL_TEXTURE_2D_ARRAY, array->texture);
+	if (GLEW_ARB_texture_storage)
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, width, height, capacity);
+
+	unsigned long long bytes = 0;
+	for (unsigned int level = 0; level < levels; level++){
+		unsigned int w = std::max(width >> level, 1u), h = std::max(height >> level, 1u);
+		if (!GLEW_ARB_texture_storage)
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, w, h, capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		bytes += (unsigned long long)w * h * 4 * capacity;
+	}
+	setResourceBytes(RESOURCE_TEXTURE, array->texture, bytes);
+	array->bytes = bytes;
+	arrayBytes += bytes;
+
+	// The same filtering as uploadMipChain
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	arrays.push_back(array);
+	return array;
+}
+
+static void deleteTextureArray(size_t index)
+{
+	TextureArray * array = arrays[index];
+	arrayBytes -= array->bytes;
+	deleteTexture(array->texture);
+	delete array;
+	arrays.erase(arrays.begin() + index);
+}
+
+TextureLayer plainTexture(GLuint texture)
+{
+	TextureLayer result = { GL_TEXTURE_2D, texture, 0 };
+	return result;
+}
+
+TextureLayer addTextureLayer(const MipChain & chain)
+{
+	const Image & base = chain.levels[0];
+	unsigned int levels = (unsigned int)chain.levels.size();
+
+	TextureArray * array = NULL;
+	unsigned int largest = 0;
+	for (size_t i = 0; i < arrays.size() && !array; i++){
+		if (arrays[i]->width != base.width || arrays[i]->height != base.height || arrays[i]->levels != levels)
+			continue;
+		if (!arrays[i]->freeLayers.empty())
+			array = arrays[i];
+		largest = std::max(largest, arrays[i]->capacity);
+	}
+
+	if (!array){
+		if (!maxLayers)
+			glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers); // at least 256 in OpenGL 3.3
+		unsigned int capacity = largest ? largest * 2 : FIRST_ARRAY_LAYERS;
+		if (maxLayers > 0 && capacity > (unsigned int)maxLayers)
+			capacity = (unsigned int)maxLayers;
+		array = createTextureArray(base.width, base.height, levels, capacity);
+	}
+
+	TextureLayer result = { GL_TEXTURE_2D_ARRAY, array->texture, array->freeLayers.back() };
+	array->freeLayers.pop_back();
+
+	bindTexture(0, GL_TEXTURE_2D_ARRAY, array->texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	for (unsigned int level = 0; level < levels; level++){
+		const Image & image = chain.levels[level];
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, result.layer, image.width, image.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, &image.pixels[0]);
+	}
+	return result;
+}
+
+void removeTextureLayer(const TextureLayer & layer)
+{
+	for (size_t i = 0; i < arrays.size(); i++){
+		TextureArray * array = arrays[i];
+		if (array->texture != layer.texture)
+			continue;
+
+		array->freeLayers.push_back(layer.layer);
+		if (array->freeLayers.size() == array->capacity)
+			deleteTextureArray(i);
+		return;
+	}
+}
+
+unsigned long long textureArrayBytes()
+{
+	return arrayBytes;
+}
+
+// All levels of one layer, on the GPU
+static void copyLayer(const TextureArray & source, GLuint sourceLayer, const TextureArray & destination, GLuint destinationLayer)
+{
+	for (unsigned int level = 0; level < source.levels; level++){
+		GLsizei w = std::max(source.width >> level, 1u), h = std::max(source.height >> level, 1u);
+		if (GLEW_ARB_copy_image){
+			glCopyImageSubData(source.texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, sourceLayer,
+				destination.texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, destinationLayer, w, h, 1);
+		}else{
+			// OpenGL 3.0 : read from the layer through a framebuffer
+			if (!copyFramebuffer)
+				glGenFramebuffers(1, &copyFramebuffer);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, copyFramebuffer);
+			glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, source.texture, level, sourceLayer);
+			glReadBuffer(GL_COLOR_ATTACHMENT0);
+			bindTexture(0, GL_TEXTURE_2D_ARRAY, destination.texture);
+			glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, destinationLayer, 0, 0, w, h);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		}
+	}
+}
+
+void compactTextureArrays(std::vector<TextureLayerMove> & out_moves)
+{
+	size_t count = arrays.size(); // new arrays are appended, they are small enough already
+	for (size_t i = 0; i < count; ){
+		TextureArray * array = arrays[i];
+		unsigned int used = array->capacity - (unsigned int)array->freeLayers.size();
+		unsigned int capacity = 1;
+		while (capacity < used)
+			capacity *= 2;
+		if (used == 0 || capacity >= array->capacity){
+			i++;
+			continue;
+		}
+
+		std::vector<bool> isFree(array->capacity, false);
+		for (size_t f = 0; f < array->freeLayers.size(); f++)
+			isFree[array->freeLayers[f]] = true;
+
+		TextureArray * smaller = createTextureArray(array->width, array->height, array->levels, capacity);
+		for (GLuint layer = 0; layer < array->capacity; layer++){
+			if (isFree[layer])
+				continue;
+			TextureLayerMove move;
+			move.from.target = move.to.target = GL_TEXTURE_2D_ARRAY;
+			move.from.texture = array->texture;
+			move.from.layer = layer;
+			move.to.texture = smaller->texture;
+			move.to.layer = smaller->freeLayers.back();
+			smaller->freeLayers.pop_back();
+			copyLayer(*array, move.from.layer, *smaller, move.to.layer);
+			out_moves.push_back(move);
+		}
+		deleteTextureArray(i);
+		count--;
+	}
+}
+
+void deleteTextureArrays()
+{
+	while (!arrays.empty())
+		deleteTextureArray(arrays.size() - 1);
+	if (copyFramebuffer){
+		glDeleteFramebuffers(1, &copyFramebuffer);
+		copyFramebuffer = 0;
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef TEXTUREARRAY_HPP
+#define TEXTUREARRAY_HPP
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "image.hpp"
+
+// Packing of textures into GL_TEXTURE_2D_ARRAY objects. Textures with the same size and number
+// of levels become layers of one array, so draws that only differ in their texture bind the
+// same object and can be merged : instanced draws read the layer per instance
+// (InstanceData::layer), single draws from PerObject.PositionScale.w (see renderqueue.hpp).
+//
+// All layers of an array are allocated when it is created. When all arrays of a size are full,
+// the next one gets twice as many layers as the largest one so far, up to
+// GL_MAX_ARRAY_TEXTURE_LAYERS. A removed layer frees no memory until compactTextureArrays moves
+// the remaining layers into a smaller array (or the last layer is removed).
+//
+// Only call these functions from the thread that owns the OpenGL context.
+
+#define FIRST_ARRAY_LAYERS 4
+
+// A texture as the shaders see it : a GL_TEXTURE_2D (layer 0) or one layer of a
+// GL_TEXTURE_2D_ARRAY. texture 0 : none.
+struct TextureLayer
+{
+	GLenum target;
+	GLuint texture;
+	GLuint layer;
+};
+
+// GL_TEXTURE_2D, e.g. from loadBMP_custom or loadDDS
+TextureLayer plainTexture(GLuint texture);
+
+// Uploads all levels of the chain into a free layer of an array with its size
+TextureLayer addTextureLayer(const MipChain & chain);
+
+// Frees the layer for the next texture. The array is deleted with its last layer.
+void removeTextureLayer(const TextureLayer & layer);
+
+// Memory allocated by all arrays, used and free layers
+unsigned long long textureArrayBytes();
+
+struct TextureLayerMove
+{
+	TextureLayer from, to;
+};
+
+// Copies the used layers of every array that needs fewer layers than it has into a new array
+// with just enough (a power of two) and deletes the old one. Every TextureLayer that names a
+// moved layer must be replaced, out_moves lists them.
+void compactTextureArrays(std::vector<TextureLayerMove> & out_moves);
+
+// Deletes the arrays that still have layers, e.g. at shutdown
+void deleteTextureArrays();
+
+#endif
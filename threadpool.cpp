@@ -0,0 +1,128 @@
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+#include "threadpool.hpp"
+
+struct WorkerPool
+{
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()> > jobs;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	bool stopping;
+
+	WorkerPool() : stopping(false)
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		unsigned int count = cores > 1 ? cores - 1 : 1;
+		for (unsigned int i = 0; i < count; i++)
+			threads.push_back(std::thread(&WorkerPool::run, this));
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeUp.notify_all();
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+
+	void run()
+	{
+		for (;;){
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeUp.wait(lock, [this]{ return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return; // stopping and nothing left to do
+				job.swap(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+};
+
+static WorkerPool & pool()
+{
+	static WorkerPool workers; // thread safe initialisation since C++11
+	return workers;
+}
+
+unsigned int workerThreadCount()
+{
+	return (unsigned int)pool().threads.size();
+}
+
+void runOnWorker(const std::function<void()> & job)
+{
+	WorkerPool & workers = pool();
+	{
+		std::lock_guard<std::mutex> lock(workers.mutex);
+		workers.jobs.push_back(job);
+	}
+	workers.wakeUp.notify_one();
+}
+
+// Shared between the caller of parallelFor and its helper jobs. Helpers may still be
+// queued when parallelFor returns, so it must not live on the caller's stack.
+struct ParallelForState
+{
+	std::atomic<size_t> next;
+	std::atomic<size_t> done;
+	size_t count;
+	const std::function<void(size_t)> * body;
+	std::mutex mutex;
+	std::condition_variable finished;
+};
+
+static void workOn(const std::shared_ptr<ParallelForState> & state)
+{
+	for (;;){
+		size_t i = state->next++;
+		if (i >= state->count)
+			return;
+		(*state->body)(i);
+		if (++state->done == state->count){
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->finished.notify_all();
+		}
+	}
+}
+
+void parallelFor(size_t count, const std::function<void(size_t)> & body)
+{
+	if (count == 0)
+		return;
+	if (count == 1){
+		body(0);
+		return;
+	}
+
+	std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+	state->next = 0;
+	state->done = 0;
+	state->count = count;
+	state->body = &body;
+
+	size_t helpers = count - 1;
+	if (helpers > workerThreadCount())
+		helpers = workerThreadCount();
+	for (size_t i = 0; i < helpers; i++)
+		runOnWorker([state]{ workOn(state); });
+
+	// The calling thread works as well, so nested calls from worker threads cannot dead-lock
+	workOn(state);
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [&state]{ return state->done == state->count; });
+}
@@ -0,0 +1,20 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <stddef.h>
+#include <functional>
+
+// A handful of worker threads shared by all loaders. They are started on first use
+// and joined when the program exits.
+
+// Number of worker threads (the calling thread of parallelFor comes on top of it)
+unsigned int workerThreadCount();
+
+// Runs job on one of the worker threads
+void runOnWorker(const std::function<void()> & job);
+
+// Calls body(i) for every i in [0, count) on the worker threads and the calling thread.
+// Returns when all calls are done. Can be used from inside a worker thread as well.
+void parallelFor(size_t count, const std::function<void(size_t)> & body);
+
+#endif
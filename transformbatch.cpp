@@ -0,0 +1,200 @@
+#include <stddef.h>
+
+#include <glm/glm.hpp>
+
+#include "transformbatch.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define TRANSFORM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// GCC and clang only emit SSE/AVX instructions in functions that ask for them,
+// MSVC accepts the intrinsics everywhere
+#if defined(TRANSFORM_X86) && defined(__GNUC__)
+#define TARGET_SSE __attribute__((target("sse")))
+#define TARGET_AVX __attribute__((target("avx")))
+#else
+#define TARGET_SSE
+#define TARGET_AVX
+#endif
+
+// Kernel : out[i] = a[i * aStride] * b[i] for count matrices, aStride is 0 or 1
+typedef void (*MultiplyKernel)(const float * a, size_t aStride, const float * b, float * out, size_t count);
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    Scalar
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void multiplyScalar(const float * a, size_t aStride, const float * b, float * out, size_t count)
+{
+	for (size_t m = 0; m < count; m++, a += 16 * aStride, b += 16, out += 16){
+		float result[16];
+		for (int column = 0; column < 4; column++){
+			const float * bc = b + column * 4;
+			for (int row = 0; row < 4; row++)
+				result[column * 4 + row] = a[row] * bc[0] + a[4 + row] * bc[1] + a[8 + row] * bc[2] + a[12 + row] * bc[3];
+		}
+		for (int i = 0; i < 16; i++)
+			out[i] = result[i];
+	}
+}
+
+#ifdef TRANSFORM_X86
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    SSE, one column per instruction
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TARGET_SSE static void multiplySSE(const float * a, size_t aStride, const float * b, float * out, size_t count)
+{
+	for (size_t m = 0; m < count; m++, a += 16 * aStride, b += 16, out += 16){
+		__m128 a0 = _mm_loadu_ps(a);
+		__m128 a1 = _mm_loadu_ps(a + 4);
+		__m128 a2 = _mm_loadu_ps(a + 8);
+		__m128 a3 = _mm_loadu_ps(a + 12);
+
+		__m128 b0 = _mm_loadu_ps(b);
+		__m128 b1 = _mm_loadu_ps(b + 4);
+		__m128 b2 = _mm_loadu_ps(b + 8);
+		__m128 b3 = _mm_loadu_ps(b + 12);
+
+		__m128 columns[4] = { b0, b1, b2, b3 };
+		for (int c = 0; c < 4; c++){
+			__m128 bc = columns[c];
+			__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(0, 0, 0, 0)));
+			r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(1, 1, 1, 1))));
+			r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(2, 2, 2, 2))));
+			r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(bc, bc, _MM_SHUFFLE(3, 3, 3, 3))));
+			_mm_storeu_ps(out + c * 4, r);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////    AVX, two columns per instruction
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TARGET_AVX static void multiplyAVX(const float * a, size_t aStride, const float * b, float * out, size_t count)
+{
+	for (size_t m = 0; m < count; m++, a += 16 * aStride, b += 16, out += 16){
+		// Every column of a in both halves
+		__m256 a0 = _mm256_broadcast_ps((const __m128 *)a);
+		__m256 a1 = _mm256_broadcast_ps((const __m128 *)(a + 4));
+		__m256 a2 = _mm256_broadcast_ps((const __m128 *)(a + 8));
+		__m256 a3 = _mm256_broadcast_ps((const __m128 *)(a + 12));
+
+		// Columns 0 and 1 of b, then 2 and 3. The shuffle works per half, so element k of each
+		// column ends up in all four lanes of its half.
+		__m256 b01 = _mm256_loadu_ps(b);
+		__m256 b23 = _mm256_loadu_ps(b + 8);
+
+		__m256 r01 = _mm256_mul_ps(a0, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(0, 0, 0, 0)));
+		__m256 r23 = _mm256_mul_ps(a0, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(0, 0, 0, 0)));
+		r01 = _mm256_add_ps(r01, _mm256_mul_ps(a1, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(1, 1, 1, 1))));
+		r23 = _mm256_add_ps(r23, _mm256_mul_ps(a1, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(1, 1, 1, 1))));
+		r01 = _mm256_add_ps(r01, _mm256_mul_ps(a2, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(2, 2, 2, 2))));
+		r23 = _mm256_add_ps(r23, _mm256_mul_ps(a2, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(2, 2, 2, 2))));
+		r01 = _mm256_add_ps(r01, _mm256_mul_ps(a3, _mm256_shuffle_ps(b01, b01, _MM_SHUFFLE(3, 3, 3, 3))));
+		r23 = _mm256_add_ps(r23, _mm256_mul_ps(a3, _mm256_shuffle_ps(b23, b23, _MM_SHUFFLE(3, 3, 3, 3))));
+
+		_mm256_storeu_ps(out, r01);
+		_mm256_storeu_ps(out + 8, r23);
+	}
+	_mm256_zeroupper();
+}
+
+static void cpuid(int leaf, unsigned int registers[4])
+{
+#ifdef _MSC_VER
+	__cpuid((int *)registers, leaf);
+#else
+	__cpuid(leaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// The CPU has to support AVX and the OS has to save the upper halves of the registers
+static bool haveAVX()
+{
+	unsigned int registers[4];
+	cpuid(0, registers);
+	if (registers[0] < 1)
+		return false;
+	cpuid(1, registers);
+	bool osxsave = (registers[2] & (1u << 27)) != 0;
+	bool avx = (registers[2] & (1u << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+
+#ifdef _MSC_VER
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)edx << 32) | eax;
+#endif
+	return (xcr0 & 6) == 6; // XMM and YMM state
+}
+
+static bool haveSSE()
+{
+	unsigned int registers[4];
+	cpuid(1, registers);
+	return (registers[3] & (1u << 25)) != 0;
+}
+
+#endif
+
+struct KernelChoice
+{
+	MultiplyKernel kernel;
+	const char * name;
+};
+
+static KernelChoice chooseKernel()
+{
+	KernelChoice choice = { multiplyScalar, "scalar" };
+#ifdef TRANSFORM_X86
+	if (haveAVX()){
+		choice.kernel = multiplyAVX;
+		choice.name = "AVX";
+	}else if (haveSSE()){
+		choice.kernel = multiplySSE;
+		choice.name = "SSE";
+	}
+#endif
+	return choice;
+}
+
+static const KernelChoice & kernel()
+{
+	static const KernelChoice choice = chooseKernel();
+	return choice;
+}
+
+void multiplyMatrix(const glm::mat4 & a, const glm::mat4 & b, glm::mat4 & out)
+{
+	kernel().kernel(&a[0][0], 0, &b[0][0], &out[0][0], 1);
+}
+
+void multiplyMatrices(const glm::mat4 & a, const glm::mat4 * b, glm::mat4 * out, size_t count)
+{
+	if (count)
+		kernel().kernel(&a[0][0], 0, &b[0][0][0], &out[0][0][0], count);
+}
+
+void multiplyMatrices(const glm::mat4 * a, const glm::mat4 * b, glm::mat4 * out, size_t count)
+{
+	if (count)
+		kernel().kernel(&a[0][0][0], 1, &b[0][0][0], &out[0][0][0], count);
+}
+
+const char * transformKernelName()
+{
+	return kernel().name;
+}
@@ -0,0 +1,26 @@
+#ifndef TRANSFORMBATCH_HPP
+#define TRANSFORMBATCH_HPP
+
+#include <stddef.h>
+
+#include <glm/glm.hpp>
+
+// Matrix products with SSE or AVX, chosen once at runtime by what the CPU supports, and a
+// scalar fallback. Every kernel multiplies and adds in the same order as glm's operator*
+// (no fused multiply-add), so the results are bit for bit those of glm.
+//
+// "out" may be the same array as "b" (but not as "a" in the array version).
+
+// out = a * b
+void multiplyMatrix(const glm::mat4 & a, const glm::mat4 & b, glm::mat4 & out);
+
+// out[i] = a * b[i], e.g. ViewProjection * world
+void multiplyMatrices(const glm::mat4 & a, const glm::mat4 * b, glm::mat4 * out, size_t count);
+
+// out[i] = a[i] * b[i], e.g. parent world * local
+void multiplyMatrices(const glm::mat4 * a, const glm::mat4 * b, glm::mat4 * out, size_t count);
+
+// "AVX", "SSE" or "scalar"
+const char * transformKernelName();
+
+#endif
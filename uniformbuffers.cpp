@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "uniformbuffers.hpp"
+#include "resources.hpp"
+#include "streambuffer.hpp"
+
+// std140 : mat4 and vec4 have no padding, the structs match the blocks byte by byte
+static_assert(sizeof(PerFrameUniforms) == 144, "PerFrameUniforms does not match the std140 layout");
+static_assert(sizeof(PerObjectUniforms) == 160, "PerObjectUniforms does not match the std140 layout");
+
+// Room for a frame of PerFrame and PerObject blocks (each padded to the offset alignment)
+static const GLsizeiptr frameSize = 256 * 1024;
+
+static StreamBuffer ring;
+
+bool createUniformBuffers()
+{
+	GLint offsetAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+	return createStreamBuffer(ring, GL_UNIFORM_BUFFER, frameSize, offsetAlignment > 0 ? offsetAlignment : 256, "uniform ring");
+}
+
+void deleteUniformBuffers()
+{
+	deleteStreamBuffer(ring);
+}
+
+void bindUniformBlocks(GLuint program)
+{
+	GLuint perFrame = glGetUniformBlockIndex(program, "PerFrame");
+	if (perFrame != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, perFrame, PER_FRAME_BINDING);
+
+	GLuint perObject = glGetUniformBlockIndex(program, "PerObject");
+	if (perObject != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, perObject, PER_OBJECT_BINDING);
+}
+
+static void sendBlock(GLuint binding, const void * data, GLsizeiptr size)
+{
+	GLintptr offset = streamData(ring, data, size);
+	if (offset >= 0)
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, ring.buffer, offset, size);
+}
+
+void sendPerFrame(const PerFrameUniforms & uniforms)
+{
+	sendBlock(PER_FRAME_BINDING, &uniforms, sizeof(uniforms));
+}
+
+void sendPerObject(const PerObjectUniforms & uniforms)
+{
+	sendBlock(PER_OBJECT_BINDING, &uniforms, sizeof(uniforms));
+}
@@ -0,0 +1,44 @@
+#ifndef UNIFORMBUFFERS_HPP
+#define UNIFORMBUFFERS_HPP
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Uniform blocks shared by all programs. Each block has a fixed binding point, LoadShaders
+// connects the blocks of every program to them (bindUniformBlocks). Switching programs
+// therefore needs no uniform uploads at all.
+//
+// Both blocks are written into one stream buffer (streambuffer.hpp). Every write goes to a
+// fresh range, the range is then bound to the binding point, so the GPU never waits for a
+// previous draw and the CPU never overwrites data a draw still needs.
+
+#define PER_FRAME_BINDING  0
+#define PER_OBJECT_BINDING 1
+
+// layout(std140) uniform PerFrame in the shaders, written once per frame
+struct PerFrameUniforms
+{
+	glm::mat4 P;
+	glm::mat4 V;
+	glm::vec4 LightPosition_worldspace; // w unused
+};
+
+// layout(std140) uniform PerObject in the shaders, written before every draw
+struct PerObjectUniforms
+{
+	glm::mat4 M;
+	glm::mat4 MVP;
+	glm::vec4 PositionScale; // see Mesh::positionScale, w : texture array layer (see submitDraw)
+	glm::vec4 PositionBias;
+};
+
+bool createUniformBuffers();
+void deleteUniformBuffers();
+
+// Binds the PerFrame and PerObject blocks of a program to their binding points
+void bindUniformBlocks(GLuint program);
+
+void sendPerFrame(const PerFrameUniforms & uniforms);
+void sendPerObject(const PerObjectUniforms & uniforms);
+
+#endif
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "uniforms.hpp"
+
+// std::map, the tables must not move when other programs are added
+static std::map<GLuint, UniformTable> tables;
+static unsigned int nextGeneration = 1; // 0 is never used, see findUniform
+
+static unsigned long long uploads = 0;
+static unsigned long long skipped = 0;
+
+UniformTable * reflectUniforms(GLuint program)
+{
+	UniformTable & table = tables[program];
+	table.program = program;
+	table.generation = nextGeneration++;
+	table.slots.clear();
+
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+	std::vector<char> name(maxLength + 1);
+	for (GLint i = 0; i < count; i++){
+		GLsizei length = 0;
+		UniformSlot slot;
+		glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), &length, &slot.arraySize, &slot.type, &name[0]);
+
+		slot.location = glGetUniformLocation(program, &name[0]);
+		if (slot.location < 0)
+			continue; // member of a uniform block
+
+		slot.name.assign(&name[0], length);
+		if (slot.name.size() > 3 && slot.name.compare(slot.name.size() - 3, 3, "[0]") == 0)
+			slot.name.resize(slot.name.size() - 3);
+		slot.uploaded = false;
+		table.slots.push_back(slot);
+	}
+	return &table;
+}
+
+UniformTable * findUniformTable(GLuint program)
+{
+	std::map<GLuint, UniformTable>::iterator it = tables.find(program);
+	return it == tables.end() ? NULL : &it->second;
+}
+
+void forgetUniforms(GLuint program)
+{
+	tables.erase(program);
+}
+
+Uniform findUniform(GLuint program, const char * name)
+{
+	UniformTable * table = findUniformTable(program);
+	if (!table)
+		table = reflectUniforms(program);
+
+	Uniform uniform = { program, table->generation, -1 };
+	for (size_t i = 0; i < table->slots.size(); i++){
+		if (table->slots[i].name == name){
+			uniform.index = (int)i;
+			break;
+		}
+	}
+	return uniform;
+}
+
+// Samplers and bools are set with glUniform1i as well
+static bool isIntegerType(GLenum type)
+{
+	switch (type){
+	case GL_INT:
+	case GL_BOOL:
+	case GL_SAMPLER_1D:
+	case GL_SAMPLER_2D:
+	case GL_SAMPLER_3D:
+	case GL_SAMPLER_CUBE:
+	case GL_SAMPLER_2D_SHADOW:
+	case GL_SAMPLER_2D_ARRAY:
+	case GL_SAMPLER_2D_ARRAY_SHADOW:
+	case GL_SAMPLER_BUFFER:
+	case GL_SAMPLER_2D_MULTISAMPLE:
+	case GL_INT_SAMPLER_2D:
+	case GL_UNSIGNED_INT_SAMPLER_2D:
+		return true;
+	}
+	return false;
+}
+
+// Returns the slot if the value has to be uploaded, NULL if it did not change
+static UniformSlot * changedSlot(Uniform uniform, GLenum type, const void * value, size_t size)
+{
+	if (uniform.index < 0)
+		return NULL;
+
+	UniformTable * table = findUniformTable(uniform.program);
+	bool alive = table && table->generation == uniform.generation;
+	assert(alive && "uniform handle of a deleted or relinked program");
+	if (!alive){
+		printf("Uniform of program %u was found before the program was deleted or linked again\n", uniform.program);
+		return NULL;
+	}
+
+	UniformSlot & slot = table->slots[uniform.index];
+	if (slot.type != type && !(type == GL_INT && isIntegerType(slot.type))){
+		printf("Uniform %s has a different type in the shader\n", slot.name.c_str());
+		return NULL;
+	}
+
+	if (slot.uploaded && memcmp(slot.value, value, size) == 0){
+		skipped++;
+		return NULL;
+	}
+
+	memcpy(slot.value, value, size);
+	slot.uploaded = true;
+	uploads++;
+	return &slot;
+}
+
+void setUniform(Uniform uniform, float value)
+{
+	if (UniformSlot * slot = changedSlot(uniform, GL_FLOAT, &value, sizeof(value)))
+		glUniform1f(slot->location, value);
+}
+
+void setUniform(Uniform uniform, int value)
+{
+	if (UniformSlot * slot = changedSlot(uniform, GL_INT, &value, sizeof(value)))
+		glUniform1i(slot->location, value);
+}
+
+void setUniform(Uniform uniform, const glm::vec2 & value)
+{
+	if (UniformSlot * slot = changedSlot(uniform, GL_FLOAT_VEC2, &value[0], sizeof(value)))
+		glUniform2fv(slot->location, 1, &value[0]);
+}
+
+void setUniform(Uniform uniform, const glm::vec3 & value)
+{
+	if (UniformSlot * slot = changedSlot(uniform, GL_FLOAT_VEC3, &value[0], sizeof(value)))
+		glUniform3fv(slot->location, 1, &value[0]);
+}
+
+void setUniform(Uniform uniform, const glm::vec4 & value)
+{
+	if (UniformSlot * slot = changedSlot(uniform, GL_FLOAT_VEC4, &value[0], sizeof(value)))
+		glUniform4fv(slot->location, 1, &value[0]);
+}
+
+void setUniform(Uniform uniform, const glm::mat3 & value)
+{
+	if (UniformSlot * slot = changedSlot(uniform, GL_FLOAT_MAT3, &value[0][0], sizeof(value)))
+		glUniformMatrix3fv(slot->location, 1, GL_FALSE, &value[0][0]);
+}
+
+void setUniform(Uniform uniform, const glm::mat4 & value)
+{
+	if (UniformSlot * slot = changedSlot(uniform, GL_FLOAT_MAT4, &value[0][0], sizeof(value)))
+		glUniformMatrix4fv(slot->location, 1, GL_FALSE, &value[0][0]);
+}
+
+void getUniformStatistics(unsigned long long & out_uploads, unsigned long long & out_skipped)
+{
+	out_uploads = uploads;
+	out_skipped = skipped;
+}
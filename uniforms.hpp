@@ -0,0 +1,68 @@
+#ifndef UNIFORMS_HPP
+#define UNIFORMS_HPP
+
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Reflection of the active uniforms of a program. LoadShaders queries them once after linking,
+// afterwards uniforms are set through handles instead of glGetUniformLocation by name, and a
+// value is only uploaded if it differs from the last value sent to that program.
+//
+// The cache only knows about values set with setUniform. Don't mix it with direct glUniform*
+// calls for the same uniform.
+
+struct UniformSlot
+{
+	std::string name;  // without "[0]" for arrays
+	GLint location;
+	GLenum type;       // GL_FLOAT_MAT4, GL_FLOAT_VEC3, GL_SAMPLER_2D, ...
+	GLint arraySize;
+	bool uploaded;     // value is valid
+	unsigned char value[64]; // last uploaded value, large enough for a mat4
+};
+
+struct UniformTable
+{
+	GLuint program;
+	unsigned int generation; // new for every reflectUniforms, see Uniform
+	std::vector<UniformSlot> slots;
+};
+
+// A uniform of one program. index is -1 if the program has no such active uniform, setting it
+// does nothing then (like location -1 in OpenGL).
+// Handles die with their program : after deleteProgram, forgetUniforms or a new
+// reflectUniforms (e.g. when the program is linked again) they must be looked up again. The
+// table is found by program and generation, so a stale handle is caught (assert in debug
+// builds, ignored with a message otherwise) instead of writing into a deleted table, even if
+// OpenGL hands out the same program id again.
+struct Uniform
+{
+	GLuint program;
+	unsigned int generation;
+	int index;
+};
+
+// Queries all active uniforms of a linked program, replaces older information about it.
+// The table pointers stay valid until forgetUniforms, don't keep them longer.
+UniformTable * reflectUniforms(GLuint program);
+UniformTable * findUniformTable(GLuint program);
+void forgetUniforms(GLuint program);
+
+Uniform findUniform(GLuint program, const char * name);
+
+// The program of the uniform must be in use (glUseProgram)
+void setUniform(Uniform uniform, float value);
+void setUniform(Uniform uniform, int value); // also for samplers
+void setUniform(Uniform uniform, const glm::vec2 & value);
+void setUniform(Uniform uniform, const glm::vec3 & value);
+void setUniform(Uniform uniform, const glm::vec4 & value);
+void setUniform(Uniform uniform, const glm::mat3 & value);
+void setUniform(Uniform uniform, const glm::mat4 & value);
+
+// Number of glUniform* calls made and skipped because the value was unchanged
+void getUniformStatistics(unsigned long long & uploads, unsigned long long & skipped);
+
+#endif